@@ -0,0 +1,32 @@
+/*
+ * Run the startup calibration (see rhd2000calibrate.hpp) against the
+ * simulated board with each USB latency profile, and print the measured
+ * distributions and the period and FIFO headroom it chooses.
+ *
+ * usage: bench_calibrate [seconds in total] [profile]
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include "rhd2000calibrate.hpp"
+#include "rhd2k_sim.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+
+int
+main(int argc, char ** argv)
+{
+        calibration_options options;
+        char const * only = 0;
+        if (argc > 1) options.seconds = atof(argv[1]);
+        if (argc > 2) only = argv[2];
+
+        for (size_t p = 0; p < sizeof(usb_profiles) / sizeof(usb_profile); ++p) {
+                if (only && strcmp(only, usb_profiles[p].name) != 0) continue;
+                sim_board board(2, 30000, usb_profiles[p], 997);
+                std::cout << "profile: " << usb_profiles[p].name << '\n'
+                          << calibrate(board, options) << "\n\n";
+        }
+        return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * End-to-end latency and jitter of the direct-mode process cycle, run
+ * against a simulated board (see rhd2k_sim.hpp) instead of hardware. Each
+ * cycle polls the FIFO, sleeps, reads, and validates a period as
+ * rhd2k_driver_run_cycle does, then converts the marker channel as
+ * rhd2k_driver_read does. The latency of a marked sample is the time from
+ * its acquisition on the simulated board to when it is in the port buffer.
+ *
+ * Cases are run for each USB latency profile, period size, and FIFO latency
+ * (-I). For each case, reports the number of cycles, delayed cycles and
+ * xruns per 1000 cycles, and the median, 99th, and 99.9th percentiles and
+ * maximum of the marker latency in ms.
+ *
+ * usage: bench_latency [seconds per case] [profile]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "rhd2000cycle.hpp"
+#include "rhd2k_stats.h"
+#include "rhd2k_sim.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+using std::vector;
+
+static const size_t sampling_rate = 30000;
+static const size_t nstreams = 2;
+// not a divisor of any period, so markers fall at every position in a period
+static const size_t marker_interval = 997;
+
+struct result {
+        uint64_t cycles;
+        uint64_t delayed;
+        uint64_t xruns;
+        rhd2k_histogram_t * latency;
+};
+
+static void
+run_case(usb_profile const & profile, size_t period, size_t fifo_latency, double seconds,
+         result & r)
+{
+        sim_board board(nstreams, sampling_rate, profile, marker_interval);
+        vector<char> buffer(period * board.frame_size());
+        vector<float> port(period);
+        const size_t expected = period + fifo_latency;
+        const uint64_t stop_ns = sim_board::now_ns() + (uint64_t)(seconds * 1e9);
+
+        start_acquisition(board, &buffer[0], period, fifo_latency);
+        uint32_t last_frame = 0;
+        while (sim_board::now_ns() < stop_ns) {
+                const size_t nframes = board.nframes();
+                if (nframes > expected) r.delayed += 1;
+                else usleep(fifo_fill_usecs(nframes, expected, sampling_rate));
+
+                const size_t got = board.read(&buffer[0], period);
+                const period_status status = check_period(board, &buffer[0], period, got,
+                                                          last_frame);
+                if (status == PERIOD_OK) {
+                        convert_channel(&buffer[0] + board.marker_offset(), board.frame_size(),
+                                        period, 0.0f, &port[0]);
+                        const uint64_t now = sim_board::now_ns();
+                        for (size_t t = 0; t < period; ++t) {
+                                if (port[t] < 1.0f) continue;
+                                rhd2k_hist_record(*r.latency, now - board.frame_time(last_frame + t));
+                        }
+                        last_frame += period;
+                        r.cycles += 1;
+                }
+                else if (status == PERIOD_UNDERFULL) {
+                        board.stop();
+                        start_acquisition(board, &buffer[0], period, fifo_latency);
+                        last_frame = 0;
+                        r.xruns += 1;
+                }
+                else {
+                        fprintf(stderr, "simulated board failed\n");
+                        exit(1);
+                }
+        }
+        board.stop();
+}
+
+int
+main(int argc, char ** argv)
+{
+        const size_t periods[] = { 64, 256, 1024 };
+        const size_t fifo_latencies[] = { 0, 32, 128 };
+        const size_t nprofiles = sizeof(usb_profiles) / sizeof(usb_profile);
+        double seconds = 2.0;
+        char const * only = 0;
+
+        if (argc > 1) seconds = atof(argv[1]);
+        if (argc > 2) only = argv[2];
+
+        rhd2k_histogram_t * latency =
+                static_cast<rhd2k_histogram_t *>(malloc(sizeof(rhd2k_histogram_t)));
+        printf("%-8s %6s %5s %8s %8s %8s %8s %8s %8s %8s\n", "profile", "period", "fifo",
+               "cycles", "delay/k", "xrun/k", "p50", "p99", "p99.9", "max");
+        for (size_t p = 0; p < nprofiles; ++p) {
+                if (only && strcmp(only, usb_profiles[p].name) != 0) continue;
+                for (size_t i = 0; i < sizeof(periods) / sizeof(size_t); ++i) {
+                        for (size_t j = 0; j < sizeof(fifo_latencies) / sizeof(size_t); ++j) {
+                                result r = { 0, 0, 0, latency };
+                                memset(latency, 0, sizeof(rhd2k_histogram_t));
+                                run_case(usb_profiles[p], periods[i], fifo_latencies[j], seconds, r);
+                                const double per_k = (r.cycles) ? 1000.0 / r.cycles : 0;
+                                printf("%-8s %6zu %5zu %8llu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+                                       usb_profiles[p].name, periods[i], fifo_latencies[j],
+                                       (unsigned long long)r.cycles, r.delayed * per_k,
+                                       r.xruns * per_k,
+                                       1e-6 * rhd2k_hist_quantile(*latency, 0.5),
+                                       1e-6 * rhd2k_hist_quantile(*latency, 0.99),
+                                       1e-6 * rhd2k_hist_quantile(*latency, 0.999),
+                                       1e-6 * latency->max_ns);
+                                fflush(stdout);
+                        }
+                }
+        }
+        free(latency);
+        return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Microbenchmarks for the frame readout path, using synthetic frames so that
+ * no hardware is needed. Each kernel is timed in isolation:
+ *
+ *   validate:  checking the last frame of a period
+ *   check:     checking every frame of a period
+ *   convert:   deinterleaving and converting a single channel
+ *   copyout:   converting every channel in the ADC table into its own
+ *              buffer, as the driver does for connected ports
+ *
+ * Times are reported per sample (one channel in one frame; for validate and
+ * check, one frame) and as the throughput of the samples processed (2 bytes
+ * per sample, in GB/s).
+ *
+ * usage: bench_readout [msecs per case]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "rhd2000eval.hpp"
+#include "rhd2000frame.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+using std::vector;
+
+static double msecs_per_case = 50;
+static volatile float sink;
+
+struct bench_case {
+        size_t nstreams;
+        ulong amp_power;
+        size_t period;
+        size_t frame_size;
+        char * frames;
+        vector<evalboard::channel_info_t> table;
+        vector<float> out;      // period * channels
+};
+
+static double
+now_ns()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+run_validate(bench_case & c)
+{
+        sink += last_frame_valid(c.frames, c.period, c.frame_size, 0);
+}
+
+static void
+run_check(bench_case & c)
+{
+        sink += check_frames(c.frames, c.period, c.frame_size, 0);
+}
+
+static void
+run_convert(bench_case & c)
+{
+        evalboard::channel_info_t const & chan = c.table[0];
+        convert_channel(c.frames + chan.byte_offset, c.frame_size, c.period, -1.0f, &c.out[0]);
+        sink += c.out[c.period - 1];
+}
+
+static void
+run_convert_signed(bench_case & c)
+{
+        evalboard::channel_info_t const & chan = c.table[0];
+        convert_channel_signed(c.frames + chan.byte_offset, c.frame_size, c.period, &c.out[0]);
+        sink += c.out[c.period - 1];
+}
+
+static void
+run_copyout(bench_case & c)
+{
+        for (size_t i = 0; i < c.table.size(); ++i) {
+                evalboard::channel_info_t const & chan = c.table[i];
+                const float offset = (chan.stream != evalboard::EvalADC) ? -1.0f : 0.0f;
+                convert_channel(c.frames + chan.byte_offset, c.frame_size, c.period, offset,
+                                &c.out[i * c.period]);
+        }
+        sink += c.out[c.out.size() - 1];
+}
+
+/* time a kernel; returns the best ns per call over several batches */
+static double
+time_kernel(void (*kernel)(bench_case &), bench_case & c)
+{
+        size_t reps = 1;
+        double elapsed = 0;
+        // calibrate batch size to ~1/10 of the time per case
+        while (elapsed < msecs_per_case * 1e5) {
+                reps *= 2;
+                const double t0 = now_ns();
+                for (size_t r = 0; r < reps; ++r) kernel(c);
+                elapsed = now_ns() - t0;
+        }
+        double best = elapsed / reps;
+        for (int b = 0; b < 10; ++b) {
+                const double t0 = now_ns();
+                for (size_t r = 0; r < reps; ++r) kernel(c);
+                const double per = (now_ns() - t0) / reps;
+                if (per < best) best = per;
+        }
+        return best;
+}
+
+static void
+report(char const * kernel, bench_case const & c, double ns, size_t samples)
+{
+        const double bytes = double(samples) * sizeof(evalboard::data_type);
+        printf("%-9s %7zu 0x%08lx %6zu %8zu %10.3f %8.2f\n",
+               kernel, c.nstreams, c.amp_power, c.period, samples, ns / samples, bytes / ns);
+}
+
+int
+main(int argc, char ** argv)
+{
+        const size_t nstreams[] = { 0, 1, 2, 4, 8 };
+        const ulong amp_power[] = { 0xffffffff, 0x0000ffff, 0x00000001 };
+        const size_t periods[] = { 32, 128, 1024, 4096 };
+
+        if (argc > 1) msecs_per_case = atof(argv[1]);
+
+        printf("%-9s %7s %10s %6s %8s %10s %8s\n",
+               "kernel", "streams", "amp_power", "period", "samples", "ns/sample", "GB/s");
+        for (size_t s = 0; s < sizeof(nstreams) / sizeof(size_t); ++s) {
+                for (size_t m = 0; m < sizeof(amp_power) / sizeof(ulong); ++m) {
+                        // amp power is irrelevant with no streams
+                        if (nstreams[s] == 0 && m > 0) continue;
+                        for (size_t p = 0; p < sizeof(periods) / sizeof(size_t); ++p) {
+                                bench_case c;
+                                c.nstreams = nstreams[s];
+                                c.amp_power = (nstreams[s]) ? amp_power[m] : 0;
+                                c.period = periods[p];
+                                c.frame_size = frame_size(c.nstreams);
+
+                                ulong powers[evalboard::nmiso];
+                                for (size_t i = 0; i < evalboard::nmiso; ++i) powers[i] = c.amp_power;
+                                evalboard::make_adc_table(c.table, (1UL << c.nstreams) - 1, powers);
+                                c.frames = static_cast<char *>(malloc(c.frame_size * c.period));
+                                synthesize_frames(c.frames, c.period, c.nstreams, 0);
+                                c.out.resize(c.period * c.table.size());
+
+                                const size_t nchan = c.table.size();
+                                report("validate", c, time_kernel(run_validate, c), c.period);
+                                report("check", c, time_kernel(run_check, c), c.period);
+                                report("convert", c, time_kernel(run_convert, c), c.period);
+                                report("convert16", c, time_kernel(run_convert_signed, c), c.period);
+                                report("copyout", c, time_kernel(run_copyout, c), c.period * nchan);
+                                free(c.frames);
+                        }
+                }
+        }
+        return 0;
+}
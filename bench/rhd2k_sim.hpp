@@ -0,0 +1,149 @@
+#ifndef _RHD2K_SIM_H
+#define _RHD2K_SIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstddef>
+#include "daq_interface.hpp"
+#include "rhd2000frame.hpp"
+
+/*
+ * A simulated eval board for testing the driver's cycle logic without
+ * hardware. Frames are "acquired" in real time from the moment start() is
+ * called, and every USB transaction sleeps for a latency drawn from a
+ * configurable distribution. Reading more frames than are in the FIFO
+ * returns invalid frames and leaves the FIFO corrupt until acquisition is
+ * restarted, as with the real board.
+ *
+ * Every marker_interval frames, the first eval board ADC is set to
+ * marker_value (it is zero otherwise), so that the time a sample takes to
+ * get from the board to a port buffer can be measured against frame_time().
+ */
+namespace rhd2k {
+
+/** a distribution of USB latencies, all in microseconds */
+struct usb_profile {
+        char const * name;
+        double poll_usecs;              // fixed cost of a wire-out update
+        double transfer_usecs;          // fixed cost of a pipe read
+        double bytes_per_usec;          // bulk transfer rate
+        double jitter_usecs;            // mean of exponential jitter added to each
+        double spike_prob;              // probability of a scheduling/bus stall
+        double spike_usecs;             // duration of a stall
+};
+
+/** profiles used by the benchmarks */
+static const usb_profile usb_profiles[] = {
+        // name       poll    xfer   B/us  jitter  spike p  spike us
+        { "fast",      50,    150,   35,     10,   0,       0 },
+        { "typical",  200,   1000,   35,    100,   0.001,   5000 },
+        { "spiky",    200,   1000,   35,    300,   0.01,   20000 },
+};
+
+class sim_board : public daq_interface {
+
+public:
+        static const evalboard::data_type marker_value = 0xffff;
+
+        sim_board(std::size_t nstreams, std::size_t sampling_rate,
+                  usb_profile const & profile, std::size_t marker_interval,
+                  unsigned short seed = 1)
+                : _nstreams(nstreams), _sampling_rate(sampling_rate),
+                  _frame_size(rhd2k::frame_size(nstreams)), _profile(profile),
+                  _marker_interval(marker_interval), _running(false), _corrupt(false),
+                  _start_ns(0), _stop_ns(0), _consumed(0) {
+                _rng[0] = 0x330e;
+                _rng[1] = seed;
+                _rng[2] = seed >> 8;
+        }
+
+        void start(std::size_t max_frames=0) {
+                _start_ns = now_ns();
+                _stop_ns = 0;
+                _consumed = 0;
+                _corrupt = false;
+                _running = true;
+        }
+        bool running() const { return _running; }
+        void stop() {
+                _stop_ns = now_ns();
+                _running = false;
+        }
+        std::size_t sampling_rate() const { return _sampling_rate; }
+        std::size_t frame_size() const { return _frame_size; }
+
+        std::size_t nframes() const {
+                stall(_profile.poll_usecs);
+                const std::size_t n = acquired();
+                return (n > _consumed) ? n - _consumed : 0;
+        }
+
+        std::size_t read(void * tgt, std::size_t nframes) {
+                stall(_profile.transfer_usecs);
+                const std::size_t bytes = nframes * _frame_size;
+                const std::size_t n = acquired();
+                const std::size_t avail = (_corrupt || n < _consumed) ? 0 : n - _consumed;
+                const std::size_t good = (avail < nframes) ? avail : nframes;
+                usleep(bytes / _profile.bytes_per_usec);
+
+                char * buf = static_cast<char *>(tgt);
+                synthesize_frames(buf, good, _nstreams, _consumed);
+                const std::size_t adc = 2 * (6 + 36 * _nstreams);
+                for (std::size_t t = 0; t < good; ++t) {
+                        const evalboard::data_type v =
+                                ((_consumed + t) % _marker_interval == 0) ? marker_value : 0;
+                        memcpy(buf + t * _frame_size + adc, &v, sizeof(v));
+                }
+                memset(buf + good * _frame_size, 0, (nframes - good) * _frame_size);
+                if (good < nframes) _corrupt = true;
+                _consumed += nframes;
+                return nframes;
+        }
+
+        /** the time (in ns, CLOCK_MONOTONIC) at which a frame was acquired */
+        uint64_t frame_time(uint32_t timestamp) const {
+                return _start_ns + (uint64_t)((timestamp + 1) * 1e9 / _sampling_rate);
+        }
+
+        /** byte offset of the marker channel in a frame */
+        std::size_t marker_offset() const { return 2 * (6 + 36 * _nstreams); }
+
+        static uint64_t now_ns() {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+
+private:
+        /** frames acquired since start(); frozen when stopped */
+        std::size_t acquired() const {
+                const uint64_t t = (_running) ? now_ns() : _stop_ns;
+                return (t > _start_ns) ? (t - _start_ns) * _sampling_rate / 1000000000ULL : 0;
+        }
+
+        void stall(double usecs) const {
+                usecs += -_profile.jitter_usecs * log(1.0 - erand48(_rng));
+                if (erand48(_rng) < _profile.spike_prob) usecs += _profile.spike_usecs;
+                usleep(usecs);
+        }
+
+        const std::size_t _nstreams;
+        const std::size_t _sampling_rate;
+        const std::size_t _frame_size;
+        const usb_profile _profile;
+        const std::size_t _marker_interval;
+        bool _running;
+        bool _corrupt;
+        uint64_t _start_ns;
+        uint64_t _stop_ns;
+        std::size_t _consumed;
+        mutable unsigned short _rng[3];
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ *   Intan RHD2000 eval board acquisition daemon
+ *
+ *   Streams raw frames from an eval board into a shared memory ring (see
+ *   lib/rhd2000shm.hpp), where any number of processes can read them without
+ *   going through JACK. Readers attach with rhd2k::shm_reader; see
+ *   tools/rhd2k_shmcat.cpp for an example.
+ *
+ *   usage: rhd2k_daemon [options]
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <iostream>
+
+#include "rhd2000cycle.hpp"
+#include "rhd2000shm.hpp"
+#include "rhd2k_settings.h"
+
+using namespace rhd2k;
+using std::size_t;
+
+static volatile sig_atomic_t running = 1;
+
+static void
+handle_signal(int)
+{
+        running = 0;
+}
+
+static void
+usage()
+{
+        fprintf(stderr,
+                "usage: rhd2k_daemon [options]\n\n"
+                "  -d serial    serial number of the Opal Kelly device (default first)\n"
+                "  -F path      firmware file (default rhythm_130302.bit in $RHD2K_LIBDIR)\n"
+                "  -r rate      sampling rate, in Hz (default 30000)\n"
+                "  -A..-D conf  configure an SPI port, as in the JACK driver\n"
+                "  -t frames    frames per USB transfer (default 512)\n"
+                "  -I frames    extra FIFO latency (default 0)\n"
+                "  -n name      shared memory segment (default /rhd2000)\n"
+                "  -s seconds   size of the ring (default 10)\n"
+                "  -R priority  run with SCHED_FIFO at this priority\n"
+                "  -z           read two's complement samples from the amplifiers\n");
+        exit(1);
+}
+
+int
+main(int argc, char ** argv)
+{
+        rhd2k_jack_settings_t settings;
+        memcpy(&settings, &default_settings, sizeof(settings));
+        char const * serial = 0;
+        char const * firmware = 0;
+        char const * name = "/rhd2000";
+        size_t transfer = 512;
+        double seconds = 10;
+        int priority = 0;
+        int c;
+
+        while ((c = getopt(argc, argv, "d:F:r:A:B:C:D:t:I:n:s:R:zh")) != -1) {
+                switch (c) {
+                case 'd':
+                        serial = optarg;
+                        break;
+                case 'F':
+                        firmware = optarg;
+                        break;
+                case 'r':
+                        settings.sample_rate = atoi(optarg);
+                        break;
+                case 'A':
+                case 'B':
+                case 'C':
+                case 'D':
+                        parse_port_config(c, optarg, settings);
+                        break;
+                case 't':
+                        transfer = atoi(optarg);
+                        break;
+                case 'I':
+                        settings.capture_frame_latency = atoi(optarg);
+                        break;
+                case 'n':
+                        name = optarg;
+                        break;
+                case 's':
+                        seconds = atof(optarg);
+                        break;
+                case 'R':
+                        priority = atoi(optarg);
+                        break;
+                case 'z':
+                        settings.twoscomp = 1;
+                        break;
+                default:
+                        usage();
+                }
+        }
+        if (transfer == 0 || seconds <= 0) usage();
+
+        signal(SIGINT, handle_signal);
+        signal(SIGTERM, handle_signal);
+
+        try {
+                evalboard dev(settings.sample_rate, serial, firmware, getenv("RHD2K_LIBDIR"));
+                std::cerr << "scanning SPI ports" << std::endl;
+                rhd2k_configure_board(&dev, settings);
+                std::cerr << dev << std::endl;
+
+                // the ring holds a whole number of transfers, so that each
+                // one can be read straight into it
+                const size_t rate = dev.sampling_rate();
+                const size_t capacity = std::max<size_t>(2, seconds * rate / transfer) * transfer;
+                const size_t fifo_latency = settings.capture_frame_latency;
+                shm_writer ring(name, dev.frame_size(), rate, capacity, dev.adc_table(),
+                                dev.twoscomp());
+                std::cerr << "publishing " << capacity << " frames in " << name
+                          << " (" << transfer << " frames per transfer)" << std::endl;
+
+                if (priority > 0) {
+                        struct sched_param param;
+                        param.sched_priority = priority;
+                        if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+                                std::cerr << "warning: unable to set priority: " << strerror(errno) << std::endl;
+                }
+                mlockall(MCL_CURRENT | MCL_FUTURE);
+
+                void * buf = ring.reserve(transfer);
+                if (!start_acquisition(dev, buf, transfer, fifo_latency))
+                        throw daq_error("failed to start acquisition");
+
+                const size_t expected = transfer + fifo_latency;
+                while (running) {
+                        const size_t nframes = dev.nframes();
+                        if (nframes < expected) {
+                                usleep(fifo_fill_usecs(nframes, expected, rate));
+                        }
+                        buf = ring.reserve(transfer);
+                        const size_t got = dev.read(buf, transfer);
+                        size_t bad_frame;
+                        frame_fault fault;
+                        const period_status status = check_period(dev, buf, transfer, got,
+                                                                  ring.next_timestamp(),
+                                                                  &bad_frame, &fault);
+                        if (status == PERIOD_OK) {
+                                ring.commit(transfer);
+                                continue;
+                        }
+                        if (status != PERIOD_UNDERFULL) {
+                                std::cerr << "error: "
+                                          << ((status == PERIOD_STOPPED) ?
+                                              "device is not running or was disconnected" :
+                                              "error reading data from device")
+                                          << std::endl;
+                                break;
+                        }
+                        // readers see a jump in the timestamps but not in the
+                        // sequence numbers
+                        std::cerr << "frame " << ring.next_timestamp() << ": underfull FIFO: "
+                                  << "first bad frame: " << bad_frame << " ("
+                                  << frame_fault_name(fault) << "); restarting" << std::endl;
+                        dev.stop();
+                        if (!start_acquisition(dev, buf, transfer, fifo_latency))
+                                throw daq_error("failed to restart acquisition");
+                        ring.restart();
+                }
+                dev.stop();
+        }
+        catch (std::runtime_error const & e) {
+                std::cerr << "fatal error: " << e.what() << std::endl;
+                return 1;
+        }
+        return 0;
+}
@@ -28,93 +28,50 @@
 #include <string>
 #include <iostream>
 #include <list>
+#include <sstream>
+#include <algorithm>
 
 #include "rhd2000eval.hpp"
+#include "rhd2000cycle.hpp"
+#include "rhd2000calibrate.hpp"
 #include "rhd2k.hpp"
-
-#include <jack/types.h>
-#include <jack/jslist.h>
-#include <jack/jack.h>
-
-extern "C"
-{
-#include "driver.h"
-#include "internal.h"
-#include "engine.h"
-}
+#include "jack_rhd2k_driver.h"
+#include "rhd2k_boards.h"
+#include "rhd2k_control.h"
+#include "rhd2k_epochs.h"
+#include "rhd2k_blank.h"
+#include "rhd2k_packed.h"
+#include "rhd2k_reader.h"
+#include "rhd2k_settings.h"
+#include "rhd2k_ttl.h"
+#include "rhd2k_worker.h"
 
 using std::size_t;
 using std::string;
 using namespace rhd2k;
 
-struct rhd2k_driver_t {
-        JACK_DRIVER_NT_DECL;
-
-        evalboard * dev;
-        void * buffer;
-        uint32_t last_frame;    // the timestamp in the RHD data stream
-
-	jack_nframes_t  period_size;
-        jack_nframes_t  fifo_latency; // extra fifo buffering, in frames
-
-	jack_client_t  * client;
-        std::vector<jack_port_t*> capture_ports;
-        long eval_adc_enabled;
-};
-
-struct rhd2k_amp_settings_t {
-        unsigned long amp_power;
-        double lowpass;
-        double highpass;
-        double dsp;
-        double cable_m;
-};
-
-struct rhd2k_jack_settings_t {
-        jack_nframes_t period_size;
-        jack_nframes_t sample_rate;
-
-        jack_nframes_t capture_frame_latency;
-
-        rhd2k_amp_settings_t amplifiers[evalboard::nmosi];
-
-};
-
-static const rhd2k_amp_settings_t default_amp_config = {0xffffffff, 100, 3000, 1, 0};
-static const rhd2k_jack_settings_t default_settings = {1024U, 30000U, 0U,
-                                                       {default_amp_config,
-                                                        default_amp_config,
-                                                        default_amp_config,
-                                                        default_amp_config}};
-
 extern const char driver_client_name[] = "rhd2000";
 
+/*
+ * reset the capture latency to the nominal value until it can be measured
+ * (see rhd2k_worker.cpp)
+ */
 static void
-parse_port_config(char pchar, char const * arg, rhd2k_jack_settings_t & s)
+rhd2k_latency_reset (rhd2k_driver_t * driver)
 {
-        rhd2k_amp_settings_t * pptr;
-        evalboard::mosi_id port;
-
-        switch(pchar) {
-        case 'A':
-                port = evalboard::PortA;
-                break;
-        case 'B':
-                port = evalboard::PortB;
-                break;
-        case 'C':
-                port = evalboard::PortC;
-                break;
-        case 'D':
-                port = evalboard::PortD;
-                break;
-        default:
-                return;
-        }
-        pptr = &s.amplifiers[(size_t)port];
-        // should really do some more validation
-        sscanf(arg, "%lx,%lf,%lf,%lf,%lf", &pptr->amp_power, &pptr->lowpass,
-               &pptr->highpass, &pptr->dsp, &pptr->cable_m);
+        driver->latency_count = 0;
+        driver->latency_min = driver->latency_max = driver->period_size + driver->fifo_latency;
+        // with a reader thread, up to a transfer's worth of frames
+        // can be waiting in the ring
+        driver->latency_max += driver->transfer_size;
+}
+
+/* record the age (in frames) of the oldest frame in the current period */
+static inline void
+rhd2k_latency_record (rhd2k_driver_t * driver, size_t frames)
+{
+        driver->latency_window[driver->latency_count % rhd2k_latency_window] = frames;
+        driver->latency_count += 1;
 }
 
 static void
@@ -123,9 +80,9 @@ rhd2k_latency_callback (jack_latency_callback_mode_t mode, void* arg)
         rhd2k_driver_t* driver = (rhd2k_driver_t*) arg;
         jack_latency_range_t range;
 
-        // TODO get upper range of latency by polling FIFO at times
         if (mode == JackCaptureLatency) {
-                range.min = range.max = driver->period_size + driver->fifo_latency;
+                range.min = driver->latency_min;
+                range.max = driver->latency_max;
         }
         else {
                 range.min = range.max = 0;
@@ -138,9 +95,141 @@ rhd2k_latency_callback (jack_latency_callback_mode_t mode, void* arg)
 	for (it = driver->capture_ports.begin(); it != driver->capture_ports.end(); ++it) {
                 jack_port_set_latency_range (*it, mode, &range);
 	}
+	for (it = driver->monitor_ports.begin(); it != driver->monitor_ports.end(); ++it) {
+                jack_port_set_latency_range (*it, mode, &range);
+	}
+        std::vector<rhd2k_packed_group_t*>::const_iterator g;
+        for (g = driver->packed_groups.begin(); g != driver->packed_groups.end(); ++g) {
+                jack_port_set_latency_range ((*g)->port, mode, &range);
+        }
+        if (driver->ttl_in_port)
+                jack_port_set_latency_range (driver->ttl_in_port, mode, &range);
+        if (driver->ttl_out_port)
+                jack_port_set_latency_range (driver->ttl_out_port, mode, &range);
 }
 
 
+/* update the connection count for one end of a connection */
+static void
+rhd2k_port_connect_update (rhd2k_driver_t* driver, jack_port_id_t id, int connect)
+{
+        jack_port_t const * port = jack_port_by_id (driver->client, id);
+        if (port == 0 || !jack_port_is_mine (driver->client, port)) return;
+
+        std::map<jack_port_t const*, size_t>::const_iterator it = driver->port_index.find(port);
+        if (it == driver->port_index.end()) return;
+
+        const size_t idx = it->second;
+        // monitoring is usually requested by the client that connects
+        if (idx < driver->capture_ports.size())
+                rhd2k_worker_monitors_changed(driver, idx);
+        driver->port_connections[idx] += (connect) ? 1 : -1;
+        if (driver->port_connections[idx] < 0) driver->port_connections[idx] = 0;
+        char connected = (driver->port_connections[idx] > 0);
+        if (connected != driver->port_connected[idx]) {
+                driver->port_connected[idx] = connected;
+                __sync_fetch_and_add(&driver->connection_serial, 1);
+        }
+}
+
+static void
+rhd2k_port_connect_callback (jack_port_id_t a, jack_port_id_t b, int connect, void * arg)
+{
+        rhd2k_driver_t* driver = (rhd2k_driver_t*) arg;
+        rhd2k_port_connect_update (driver, a, connect);
+        rhd2k_port_connect_update (driver, b, connect);
+}
+
+/*
+ * called by the process thread when the connection serial or the monitor
+ * plan has changed. rebuilds the list of channels that need to be converted
+ * and silences ports that have been disconnected, so that they don't need to
+ * be touched in every cycle
+ */
+static void
+rhd2k_update_active_channels (rhd2k_driver_t* driver, jack_nframes_t nframes)
+{
+        const int serial = driver->connection_serial;
+        const size_t nchannels = driver->capture_ports.size();
+        rhd2k_monitor_plan_t * plan = driver->monitor_plan;
+        __sync_synchronize();
+
+        driver->active_monitors.clear();
+        for (size_t m = 0; m < driver->monitor_ports.size(); ++m) {
+                const size_t i = nchannels + m;
+                const char connected = driver->port_connected[i];
+                if (connected) {
+                        driver->active_monitors.push_back(m);
+                }
+                else if (driver->rt_connected[i]) {
+                        void * buf = jack_port_get_buffer (driver->monitor_ports[m], nframes);
+                        memset(buf, 0, nframes * sizeof(jack_default_audio_sample_t));
+                }
+                driver->rt_connected[i] = connected;
+        }
+
+        // the packed ports are silent; their blocks are only filled while
+        // they're connected
+        const size_t first_packed = nchannels + driver->monitor_ports.size();
+        driver->active_packed.clear();
+        for (size_t g = 0; g < driver->packed_groups.size(); ++g) {
+                const size_t i = first_packed + g;
+                const char connected = driver->port_connected[i];
+                if (connected) {
+                        driver->active_packed.push_back(g);
+                        if (!driver->rt_connected[i]) {
+                                void * buf = jack_port_get_buffer (driver->packed_groups[g]->port, nframes);
+                                memset(buf, 0, nframes * sizeof(jack_default_audio_sample_t));
+                        }
+                }
+                driver->rt_connected[i] = connected;
+        }
+
+        const size_t ttl_index = first_packed + driver->packed_groups.size();
+        rhd2k_ttl_connected(driver, driver->port_connected[ttl_index]);
+
+        driver->active_channels.clear();
+        plan->active_taps.clear();
+        for (size_t i = 0; i < nchannels; ++i) {
+                const char connected = driver->port_connected[i];
+                if (!connected && driver->rt_connected[i]) {
+                        void * buf = jack_port_get_buffer (driver->capture_ports[i], nframes);
+                        memset(buf, 0, nframes * sizeof(jack_default_audio_sample_t));
+                }
+                driver->rt_connected[i] = connected;
+
+                // only mix into monitors that are connected
+                rhd2k_active_channel_t chan = { i, 0, plan->active_taps.size(), 0, 0, 0, 0.0f, false };
+                for (size_t k = plan->tap_offset[i]; k < plan->tap_offset[i+1]; ++k) {
+                        if (driver->rt_connected[nchannels + plan->taps[k].index])
+                                plan->active_taps.push_back(plan->taps[k]);
+                }
+                chan.tap_end = plan->active_taps.size();
+                if (connected) chan.port = driver->capture_ports[i];
+                if (connected || chan.tap_end > chan.tap_begin) {
+                        // find the board the channel belongs to
+                        evalboard const * dev = driver->dev;
+                        char const * buf = static_cast<char const *>(driver->buffer);
+                        size_t c = i;
+                        std::vector<rhd2k_board_t*>::const_iterator b;
+                        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                                if (i < (*b)->first_port) break;
+                                dev = (*b)->dev;
+                                buf = static_cast<char const *>((*b)->buffer);
+                                c = i - (*b)->first_port;
+                        }
+                        evalboard::channel_info_t const & info = dev->adc_table()[c];
+                        chan.src = buf + info.byte_offset;
+                        chan.stride = dev->frame_size();
+                        // adjust offset of SPI adcs, unless they're signed
+                        chan.twoscomp = (info.stream != evalboard::EvalADC) && dev->twoscomp();
+                        chan.offset = (info.stream != evalboard::EvalADC) ? -1.0f : 0.0f;
+                        driver->active_channels.push_back(chan);
+                }
+        }
+        driver->rt_connection_serial = serial;
+}
+
 static int
 rhd2k_driver_attach (rhd2k_driver_t *driver)
 {
@@ -184,11 +273,61 @@ rhd2k_driver_attach (rhd2k_driver_t *driver)
                         break;
                 }
 
+                driver->port_index[port] = driver->capture_ports.size();
                 driver->capture_ports.push_back(port);
         }
+        if (rhd2k_boards_attach(driver)) {
+                return -1;
+        }
 
+        // software monitors
+        for (size_t m = 0; m < driver->monitor_configs.size(); ++m) {
+                char name[32];
+                sprintf(name, "monitor_%zu", m + 1);
+                if ((port = jack_port_register (driver->client, name,
+                                                JACK_DEFAULT_AUDIO_TYPE,
+                                                JackPortIsOutput|JackPortIsTerminal, 0)) == 0) {
+                        jack_error ("RHD2K: cannot register port for %s", name);
+                        break;
+                }
+                driver->port_index[port] = driver->capture_ports.size() + driver->monitor_ports.size();
+                driver->monitor_ports.push_back(port);
+        }
+        driver->monitor_configs.resize(driver->monitor_ports.size());
+        driver->monitor_plan = rhd2k_monitor_plan_new(driver->monitor_configs,
+                                                      driver->capture_ports.size(),
+                                                      driver->dev->sampling_rate());
+        driver->monitor_bufs.assign(driver->monitor_ports.size(), 0);
+        driver->active_monitors.reserve(driver->monitor_ports.size());
+        driver->monitor_scratch = (float *) calloc(driver->period_size, sizeof(float));
+
+        if (!driver->packed_mode.empty() &&
+            rhd2k_packed_attach(driver, driver->packed_mode.c_str())) {
+                return -1;
+        }
+        if (rhd2k_ttl_attach(driver) || rhd2k_epochs_attach(driver) ||
+            rhd2k_blank_attach(driver)) {
+                return -1;
+        }
+
+        // all ports start out unconnected. marking them as connected in the
+        // process thread's copy forces them to be silenced in the first cycle
+        const size_t nports = driver->capture_ports.size() + driver->monitor_ports.size() +
+                driver->packed_groups.size() + 1;
+        driver->port_connections.assign(nports, 0);
+        driver->port_connected.assign(nports, 0);
+        driver->rt_connected.assign(nports, 1);
+        driver->active_channels.reserve(driver->capture_ports.size());
+        driver->connection_serial = 1;
+        driver->rt_connection_serial = 0;
+
+        rhd2k_latency_reset(driver);
         rhd2k_latency_callback(JackCaptureLatency, driver);
 
+        if (rhd2k_worker_start(driver) || rhd2k_control_start(driver)) {
+                return -1;
+        }
+
 	return jack_activate (driver->client);
 
 }
@@ -203,6 +342,9 @@ rhd2k_driver_detach (rhd2k_driver_t *driver)
 		return 0;
 	}
 
+        rhd2k_control_stop(driver);
+        rhd2k_worker_stop(driver);
+
         std::vector<jack_port_t*>::const_iterator it;
 	for (it = driver->capture_ports.begin(); it != driver->capture_ports.end(); ++it) {
 #ifndef NDEBUG
@@ -211,33 +353,83 @@ rhd2k_driver_detach (rhd2k_driver_t *driver)
                 jack_port_unregister (driver->client, *it);
 	}
         driver->capture_ports.clear();
-
-        // release scratch buffer
+	for (it = driver->monitor_ports.begin(); it != driver->monitor_ports.end(); ++it) {
+                jack_port_unregister (driver->client, *it);
+	}
+        driver->monitor_ports.clear();
+        rhd2k_packed_detach(driver);
+        rhd2k_ttl_detach(driver);
+        rhd2k_epochs_detach(driver);
+        rhd2k_blank_detach(driver);
+        driver->port_index.clear();
+        driver->active_channels.clear();
+        rhd2k_monitor_cleanup(driver);
+        free(driver->monitor_scratch);
+        driver->monitor_scratch = 0;
+
+        // release scratch buffers
         free(driver->buffer);
+        rhd2k_boards_detach(driver);
 
         return 0;
 }
 
+/*
+ * start acquisition, flushing any stale data out of the FIFO first. buf must
+ * hold at least nframes frames. caller must hold dev_lock.
+ */
+int
+rhd2k_acquisition_start (rhd2k_driver_t *driver, void * buf, size_t nframes, rhd2k_log_t * log)
+{
+        if (!start_acquisition(*driver->dev, buf, nframes, driver->fifo_latency)) {
+                if (log)
+                        rhd2k_log(log, RHD2K_LOG_START_FAILED, driver->last_frame, 0);
+                else
+                        jack_error("RHD2K: failed to start acquisition");
+                return -1;
+        }
+        return 0;
+}
+
+/* stop acquisition. caller must hold dev_lock */
+int
+rhd2k_acquisition_stop (rhd2k_driver_t *driver, rhd2k_log_t * log)
+{
+        // TODO silence output ports
+        driver->dev->stop();
+        if (driver->dev->running()) {
+                if (log)
+                        rhd2k_log(log, RHD2K_LOG_STOP_FAILED, driver->last_frame, 0);
+                else
+                        jack_error("RHD2K: failed to stop acquisition");
+                return -1;
+        }
+        return 0;
+}
+
 static int
 rhd2k_driver_start (rhd2k_driver_t *driver)
 {
 #ifndef NDEBUG
         jack_info("RHD2K: starting acquisition");
 #endif
-        // flush FIFO
-        while (driver->dev->nframes()) {
-                driver->dev->read (driver->buffer, driver->period_size);
-        }
-        driver->dev->start();
-        if (!driver->dev->running()) {
-                jack_error("RHD2K: failed to start acquisition");
+        // the other boards start first so that they have data when the
+        // first board's period is ready
+        if (rhd2k_boards_start(driver)) {
+                rhd2k_boards_stop(driver);
                 return -1;
         }
-        // add any additional latency to the fifo
-        usleep(driver->fifo_latency * 1e6 / driver->dev->sampling_rate());
+        rhd2k_boards_reset(driver);
+        driver->phase->reset();
+        pthread_mutex_lock(&driver->dev_lock);
+        int ret = rhd2k_acquisition_start(driver, driver->buffer, driver->period_size);
+        pthread_mutex_unlock(&driver->dev_lock);
         driver->last_wait_ust = driver->engine->get_microseconds();
         driver->last_frame = 0U;
-        return 0;
+        if (ret == 0 && driver->transfer_size) {
+                ret = rhd2k_reader_start(driver);
+        }
+        return ret;
 }
 
 static int
@@ -246,130 +438,211 @@ rhd2k_driver_stop (rhd2k_driver_t *driver)
 #ifndef NDEBUG
         jack_info("RHD2K: stopping acquisition");
 #endif
-        // TODO silence output ports
-        driver->dev->stop();
-        if (driver->dev->running()) {
-                jack_error("RHD2K: failed to stop acquisition");
-                return -1;
+        if (driver->transfer_size) {
+                rhd2k_reader_stop(driver);
         }
-        return 0;
+        pthread_mutex_lock(&driver->dev_lock);
+        int ret = rhd2k_acquisition_stop(driver);
+        pthread_mutex_unlock(&driver->dev_lock);
+        rhd2k_boards_stop(driver);
+        return ret;
 }
 
 /* this function copies data from the scratch buffer into the port buffers */
 static int
 rhd2k_driver_read (rhd2k_driver_t * driver, jack_nframes_t nframes)
 {
-        const float data_scale = 1.0f / 32768.0f;
-        evalboard::data_type * p;
         if (driver->engine->freewheeling) {
                 return 0;
         }
+        uint64_t t0 = rhd2k_stats_now();
+
+        if (rhd2k_monitor_receive(driver) ||
+            driver->rt_connection_serial != driver->connection_serial) {
+                rhd2k_update_active_channels(driver, nframes);
+        }
 
-        // the port list
-        std::vector<evalboard::channel_info_t>::const_iterator chan = driver->dev->adc_table().begin();
-        std::vector<jack_port_t*>::const_iterator port = driver->capture_ports.begin();
-	for (; port != driver->capture_ports.end(); ++port, ++chan) {
-                jack_default_audio_sample_t * buf =
-                        reinterpret_cast<jack_default_audio_sample_t *>(jack_port_get_buffer (*port, nframes));
-                int nconnections = jack_port_connected (*port);
-                if (nconnections) {
-                        // copy the data, converting to floats
+        std::vector<size_t>::const_iterator m;
+        for (m = driver->active_monitors.begin(); m != driver->active_monitors.end(); ++m) {
+                float * buf = reinterpret_cast<float *>(
+                        jack_port_get_buffer (driver->monitor_ports[*m], nframes));
+                memset(buf, 0, nframes * sizeof(jack_default_audio_sample_t));
+                driver->monitor_bufs[*m] = buf;
+        }
+
+        // only connected or monitored channels are touched; the others were
+        // silenced when they were disconnected. Each channel is converted
+        // once, into its port buffer or a scratch buffer, and then added to
+        // any monitors while it's still in cache.
+        std::vector<rhd2k_monitor_tap_t> const & taps = driver->monitor_plan->active_taps;
+        std::vector<rhd2k_active_channel_t>::const_iterator it;
+        for (it = driver->active_channels.begin(); it != driver->active_channels.end(); ++it) {
+                jack_default_audio_sample_t * buf = (it->port == 0) ? driver->monitor_scratch :
+                        reinterpret_cast<jack_default_audio_sample_t *>(
+                                jack_port_get_buffer (it->port, nframes));
+                if (it->twoscomp)
+                        convert_channel_signed(it->src, it->stride, nframes, buf);
+                else
+                        convert_channel(it->src, it->stride, nframes, it->offset, buf);
+                for (size_t k = it->tap_begin; k < it->tap_end; ++k) {
+                        float * out = driver->monitor_bufs[taps[k].index];
+                        const float gain = taps[k].gain;
                         for (jack_nframes_t t = 0; t < nframes; ++t) {
-                                p = reinterpret_cast<evalboard::data_type*>(
-                                        (char*)driver->buffer + chan->byte_offset + t * driver->dev->frame_size());
-                                buf[t] = *p * data_scale;
-                                if (chan->stream != evalboard::EvalADC) {
-                                        // adjust offset of SPI adcs
-                                        buf[t] -= 1.0f;
-                                }
+                                out[t] += gain * buf[t];
                         }
                 }
-                else {
-                        // silence the port buffer
-                        memset(buf, 0, nframes * sizeof(jack_default_audio_sample_t));
-                }
         }
+
+        rhd2k_monitor_plan_t * plan = driver->monitor_plan;
+        for (m = driver->active_monitors.begin(); m != driver->active_monitors.end(); ++m) {
+                if (!plan->filtered[*m]) continue;
+                rhd2k_biquad_process(plan->highpass[*m], driver->monitor_bufs[*m], nframes);
+                rhd2k_biquad_process(plan->lowpass[*m], driver->monitor_bufs[*m], nframes);
+        }
+        rhd2k_packed_write(driver, nframes);
+        rhd2k_ttl_read(driver, nframes);
+        rhd2k_epochs_read(driver, nframes);
+        rhd2k_blank_read(driver, nframes);
+        rhd2k_stats_lap(driver->stats, RHD2K_STAGE_CONVERT, &t0);
         return 0;
 }
 
-/* this function sets up hardware monitoring. no data is actually copied */
+/*
+ * hardware monitoring and TTL outputs involve USB transactions, which are
+ * handled by the worker thread (see rhd2k_worker.cpp). This only passes on
+ * the clients' TTL output events.
+ */
 static int
 rhd2k_driver_write (rhd2k_driver_t * driver, jack_nframes_t nframes)
 {
         if (driver->engine->freewheeling) {
                 return 0;
         }
+        rhd2k_ttl_write(driver, nframes);
+        rhd2k_epochs_write(driver, nframes);
+        rhd2k_blank_write(driver, nframes);
+        return 0;
+}
 
-        // the port list
-        const size_t available_dacs = driver->dev->dac_nchannels();
-        size_t dac = 0;
-        std::vector<jack_port_t*>::const_iterator port = driver->capture_ports.begin();
-	for (size_t chan = 0; port != driver->capture_ports.end() && dac < available_dacs; ++port, ++chan) {
-                if (jack_port_monitoring_input(*port)) {
-                        driver->dev->dac_monitor(dac++, chan);
-                }
+/* process cycle when a reader thread is handling USB transfers */
+static int
+rhd2k_driver_run_cycle_threaded (rhd2k_driver_t *driver)
+{
+	jack_engine_t * engine = driver->engine;
+        uint64_t t0 = rhd2k_stats_now();
+        const uint64_t cycle_start = t0;
+
+        int ret = rhd2k_reader_wait(driver);
+        rhd2k_stats_lap(driver->stats, RHD2K_STAGE_WAIT, &t0);
+        if (ret < 0) {
+                // the reader thread or rhd2k_reader_wait logs the cause
+                return -1;
         }
-        while (dac < available_dacs) {
-                driver->dev->dac_disable(dac++);
+        else if (ret > 0) {
+                // the reader has restarted acquisition
+                driver->stats->xruns += 1;
+                rhd2k_log(driver->process_log, RHD2K_LOG_XRUN, driver->last_frame,
+                          driver->stats->fifo_frames, driver->xrun_usecs);
+                driver->last_frame = 0U;
+                rhd2k_boards_reset(driver);
+                driver->last_wait_ust = engine->get_microseconds();
+                engine->delay (engine, driver->xrun_usecs);
+                return 0;
         }
-        return 0;
+        if (rhd2k_boards_read(driver, driver->last_frame)) {
+                return -1;
+        }
+        driver->last_wait_ust = engine->get_microseconds();
+        engine->transport_cycle_start (engine, driver->last_wait_ust);
+        // the period, what's left in the ring, and what was in the FIFO at
+        // the reader's last poll
+        const size_t queued = jack_ringbuffer_read_space(driver->ring) / driver->dev->frame_size();
+        rhd2k_latency_record(driver, driver->period_size + queued + driver->stats->fifo_frames);
+        driver->last_frame += driver->period_size;
+        ret = engine->run_cycle(engine, driver->period_size, 0.0);
+        driver->stats->cycles += 1;
+        rhd2k_hist_record(driver->stats->stages[RHD2K_STAGE_CYCLE],
+                          rhd2k_stats_now() - cycle_start);
+        return ret;
 }
 
 static int
 rhd2k_driver_run_cycle (rhd2k_driver_t *driver)
 {
-        uint64_t const * magic;
-        uint32_t const * timestamp;
-        uint16_t const * filler;
 	jack_engine_t * engine = driver->engine;
 
+        if (driver->transfer_size) {
+                return rhd2k_driver_run_cycle_threaded(driver);
+        }
+
+        uint64_t t0 = rhd2k_stats_now();
+        const uint64_t cycle_start = t0;
+        pthread_mutex_lock(&driver->dev_lock);
         const jack_time_t wait_enter = engine->get_microseconds();
         const size_t nframes = driver->dev->nframes();
         const size_t expected = driver->period_size + driver->fifo_latency;
+        rhd2k_stats_lap(driver->stats, RHD2K_STAGE_POLL, &t0);
+        rhd2k_stats_fifo(driver->stats, nframes);
+        const uint64_t polled = t0;
+        driver->phase->observe(driver->last_frame + nframes, polled);
 
 #ifndef NDEBUG
         if (engine->verbose &&
             engine->rolling_client_usecs_cnt % engine->rolling_interval == 0) {
-                jack_info("RHD2K: fifo = %d", nframes);
+                rhd2k_log(driver->process_log, RHD2K_LOG_FIFO, driver->last_frame, nframes);
         }
 #endif
 
         // wait long enough to ensure enough data is in the FIFO
         if (nframes > expected) {
-                jack_info("RHD2K: delayed process cycle (%zu frames)", nframes - expected);
+                rhd2k_log(driver->process_log, RHD2K_LOG_DELAYED, driver->last_frame, nframes,
+                          0.0f, nframes - expected);
+                driver->stats->delayed_cycles += 1;
                 driver->last_wait_ust = wait_enter;
         }
         else {
-                usleep(1e6 / driver->dev->sampling_rate() * (expected - nframes));
+                usleep(fifo_fill_usecs(nframes, expected, driver->dev->sampling_rate()));
         }
+        rhd2k_stats_lap(driver->stats, RHD2K_STAGE_SLEEP, &t0);
         //driver->last_wait_ust += driver->period_usecs;
         driver->last_wait_ust = engine->get_microseconds(); // use actual time
         engine->transport_cycle_start (engine, driver->last_wait_ust);
 
         // read the data. this is relatively slow and eats into the process
-        // cycle. consider threading.
-        if (driver->dev->read (driver->buffer, driver->period_size) == 0) {
-                jack_error ("RHD2K: fatal error reading data from device");
-                return -1;
-        }
-
-        // verify that the last frame is correct
-        magic = (uint64_t const *)((char*)driver->buffer + driver->dev->frame_size() * (driver->period_size - 1));
-        timestamp = (uint32_t const *)(magic + 1);
-        // back in 10 words for ADC results + TTL data; however, filler is only
-        // present if a stream is enabled and frame size is > 32)
-        filler = (uint16_t const *)((char*)magic + driver->dev->frame_size() - 22);
-
-        if (*magic == evalboard::frame_header &&
-            *timestamp == (driver->last_frame + driver->period_size - 1) &&
-            (*filler == 0 || driver->dev->frame_size() == 32))
-        {
+        // cycle; use a transfer size (-t) to move it to a reader thread.
+        const size_t got = driver->dev->read (driver->buffer, driver->period_size);
+        rhd2k_stats_lap(driver->stats, RHD2K_STAGE_READ, &t0);
+
+        // verify every frame
+        size_t bad_frame;
+        frame_fault fault;
+        const period_status status = check_period(*driver->dev, driver->buffer,
+                                                  driver->period_size, got, driver->last_frame,
+                                                  &bad_frame, &fault);
+        rhd2k_stats_lap(driver->stats, RHD2K_STAGE_VALIDATE, &t0);
+        if (status == PERIOD_OK) {
+                pthread_mutex_unlock(&driver->dev_lock);
+                // everything acquired since the poll is behind the oldest
+                // frame in this period
+                const size_t acquired = nframes + (size_t)((t0 - polled) * 1e-9 *
+                                                           driver->dev->sampling_rate());
+                rhd2k_latency_record(driver, std::max(acquired, (size_t)driver->period_size));
+                if (rhd2k_boards_read(driver, driver->last_frame)) {
+                        return -1;
+                }
                 driver->last_frame += driver->period_size;
-                return engine->run_cycle(engine, driver->period_size, 0.0);
+                int ret = engine->run_cycle(engine, driver->period_size, 0.0);
+                driver->stats->cycles += 1;
+                rhd2k_hist_record(driver->stats->stages[RHD2K_STAGE_CYCLE],
+                                  rhd2k_stats_now() - cycle_start);
+                return ret;
         }
 
-        else if (!driver->dev->running()) {
-                jack_error ("RHD2K: device is not running or was disconnected");
+        else if (status != PERIOD_UNDERFULL) {
+                pthread_mutex_unlock(&driver->dev_lock);
+                rhd2k_log(driver->process_log,
+                          (status == PERIOD_STOPPED) ? RHD2K_LOG_STOPPED : RHD2K_LOG_READ_ERROR,
+                          driver->last_frame, nframes);
                 return -1;
         }
 
@@ -377,27 +650,21 @@ rhd2k_driver_run_cycle (rhd2k_driver_t *driver)
         // could try to recover by finding the next valid frame, but it's
         // simpler to just restart acquisition. the xruns will be fairly large
         // with this method.
-#ifndef NDEBUG
-        // try to find last good frame
-        if (*filler != 0) {
-                jack_info("underfull FIFO: last frame in FIFO corrupted");
-        }
-        else {
-                size_t t;
-                for (t = 0; t < driver->period_size; ++t) {
-                        magic = (uint64_t const *)((char*)driver->buffer + driver->dev->frame_size() * t);
-                        if (*magic != evalboard::frame_header) {
-                                jack_info("underfull FIFO: first bad frame: %zu; magic=0x%lx", t, *magic);
-                                break;
-                        }
-                }
-        }
-#endif
+        driver->stats->frame_faults[fault] += 1;
+        rhd2k_log(driver->process_log, RHD2K_LOG_UNDERFULL, driver->last_frame, nframes,
+                  0.0f, bad_frame, fault);
+        const uint32_t xrun_frame = driver->last_frame;
         float delayed_usecs = -1.0f * driver->last_wait_ust;
-        rhd2k_driver_stop(driver);
-        rhd2k_driver_start(driver); // sets new ust
+        rhd2k_acquisition_stop(driver, driver->process_log);
+        rhd2k_acquisition_start(driver, driver->buffer, driver->period_size, driver->process_log);
+        pthread_mutex_unlock(&driver->dev_lock);
+        driver->last_wait_ust = engine->get_microseconds();
+        driver->last_frame = 0U;
+        driver->phase->reset();
+        rhd2k_boards_reset(driver);
+        driver->stats->xruns += 1;
         delayed_usecs += driver->last_wait_ust;
-        jack_error("RHD2K: xrun of %.3f usec", delayed_usecs);
+        rhd2k_log(driver->process_log, RHD2K_LOG_XRUN, xrun_frame, nframes, delayed_usecs);
         engine->delay (engine, delayed_usecs);
         return 0;
 }
@@ -406,14 +673,22 @@ static int
 rhd2k_driver_null_cycle (rhd2k_driver_t* driver, jack_nframes_t nframes)
 {
 #ifndef NDEBUG
-        jack_info("RHD2K: null cycle");
+        rhd2k_log(driver->process_log, RHD2K_LOG_NULL_CYCLE, driver->last_frame,
+                  driver->stats->fifo_frames);
 #endif
         /* null cycle - read and discard input data */
 	if (driver->engine->freewheeling) {
 		return 0;
 	}
 
+        rhd2k_boards_discard(driver);
+        if (driver->transfer_size) {
+                rhd2k_reader_discard(driver);
+                return 0;
+        }
+        pthread_mutex_lock(&driver->dev_lock);
         driver->dev->read (driver->buffer, driver->period_size);
+        pthread_mutex_unlock(&driver->dev_lock);
         return 0;
 }
 
@@ -432,6 +707,16 @@ rhd2k_driver_bufsize (rhd2k_driver_t* driver, jack_nframes_t nframes)
 		jack_error ("RHD2K: cannot set engine buffer size to %d", nframes);
 		return -1;
 	}
+        driver->stats->period_size = nframes;
+        rhd2k_latency_reset(driver);
+
+        // port buffers are reallocated, so unconnected ports need to be
+        // silenced again
+        driver->rt_connected.assign(driver->rt_connected.size(), 1);
+        driver->rt_connection_serial = driver->connection_serial - 1;
+
+        free (driver->monitor_scratch);
+        driver->monitor_scratch = (float *) calloc (nframes, sizeof(float));
 
         // realloc buffer
         free (driver->buffer);
@@ -440,8 +725,11 @@ rhd2k_driver_bufsize (rhd2k_driver_t* driver, jack_nframes_t nframes)
                 jack_error ("RHD2K: unable to allocate buffer");
                 return -1;
         }
+        if (rhd2k_packed_bufsize(driver) || rhd2k_epochs_bufsize(driver)) {
+                return -1;
+        }
 
-        return 0;
+        return rhd2k_boards_bufsize(driver);
 }
 
 static rhd2k_driver_t *
@@ -470,37 +758,160 @@ rhd2k_driver_new(jack_client_t * client, char const * serial, char const * firmw
 	driver->client = client;
 	driver->engine = 0;
         driver->dev = 0;
+        driver->phase = 0;
+        driver->sync_bit = -1;
+        driver->sync_level = false;
 	driver->period_size = settings.period_size;
 	driver->last_wait_ust = 0;
+        driver->dac_pinned = 0;
+        driver->monitor_dirty = 0;
+        driver->worker_running = false;
+        driver->control_fd = -1;
+        driver->control_running = false;
+        driver->transfer_size = settings.transfer_size;
+        driver->reader_running = false;
+        driver->ring = 0;
+        driver->reader_buffer = 0;
+        driver->xrun_pending = 0;
+        driver->reader_error = 0;
+        driver->xrun_usecs = 0;
+        driver->process_log = rhd2k_log_new();
+        driver->reader_log = rhd2k_log_new();
+        driver->connection_serial = 0;
+        driver->rt_connection_serial = 0;
+        if (settings.control_socket) driver->control_path = settings.control_socket;
+        driver->stats = 0;
+        driver->stats_shared = false;
+        if (settings.stats_name && strcmp(settings.stats_name, "none") != 0)
+                driver->stats_name = settings.stats_name;
+        if (settings.packed) driver->packed_mode = settings.packed;
+        driver->packed_raw = settings.packed_raw;
+        driver->ttl_in_port = 0;
+        driver->ttl_in_active = false;
+        driver->ttl_in_state = 0;
+        driver->ttl_out_port = 0;
+        driver->ttl_out_request = 0;
+        driver->ttl_out_waiting = 0;
+        driver->epochs = 0;
+        driver->blank = 0;
+
+        // priority inheritance keeps the process thread from waiting on a
+        // preempted control thread
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+        pthread_mutex_init(&driver->dev_lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        driver->commands = jack_ringbuffer_create(rhd2k_command_queue_size * sizeof(rhd2k_command_t));
+        jack_ringbuffer_mlock(driver->commands);
+        sem_init(&driver->worker_wakeup, 0, 0);
+        sem_init(&driver->reader_ready, 0, 0);
+        driver->monitor_plan = 0;
+        driver->monitor_scratch = 0;
+        driver->monitor_plans_in = jack_ringbuffer_create(8 * sizeof(rhd2k_monitor_plan_t*));
+        driver->monitor_plans_out = jack_ringbuffer_create(16 * sizeof(rhd2k_monitor_plan_t*));
 
         jack_set_latency_callback (client, rhd2k_latency_callback, driver);
+        jack_set_port_connect_callback (client, rhd2k_port_connect_callback, driver);
 
         // try to find the lib for the opal kelly board in the same directory as
         // the driver slib
         libdir = getenv("JACK_DRIVER_DIR");
 
         try {
-                driver->dev = new evalboard(settings.sample_rate, serial, firmware, libdir);
-                // configure ports
-                for (size_t i = 0; i < evalboard::nmosi; ++i) {
-                        rhd2k_amp_settings_t * a = &settings.amplifiers[i];
-                        driver->dev->configure_port((evalboard::mosi_id)i, a->lowpass, a->highpass, a->dsp, a->amp_power);
+                // the realtime threads log unconditionally
+                if (driver->process_log == 0 || driver->reader_log == 0) {
+                        throw daq_error("unable to allocate logs");
                 }
-                // scan ports
+                driver->dev = new evalboard(settings.sample_rate, serial, firmware, libdir);
                 jack_info("RHD2K: scanning SPI ports");
-                driver->dev->scan_ports();
-                // disable streams where the user sets power off to all amps -
-                // note that it's not possible to only enable one MISO line on a
-                // port (a rare unsupported use case)
-                for (size_t i = 0; i < evalboard::nmosi; ++i) {
-                        rhd2k_amp_settings_t * a = &settings.amplifiers[i];
-                        if (a->amp_power == 0x0) {
-                                driver->dev->enable_stream(evalboard::miso_id(i*2), false);
-                                driver->dev->enable_stream(evalboard::miso_id(i*2+1), false);
+                const size_t saved = rhd2k_configure_board(driver->dev, settings);
+                jack_info("RHD2K: %zu USB streams in use (%zu bytes/s less than all %zu)",
+                          driver->dev->streams_enabled(), saved, evalboard::nmiso);
+                driver->phase = new clock_phase(driver->dev->sampling_rate());
+
+                // additional boards, with the same settings
+                if (settings.sync_bit < -1 || settings.sync_bit > 15) {
+                        throw daq_error("sync input must be between 0 and 15");
+                }
+                driver->sync_bit = settings.sync_bit;
+                if (settings.boards) {
+                        std::istringstream serials(settings.boards);
+                        string board_serial;
+                        while (std::getline(serials, board_serial, ',')) {
+                                if (board_serial.empty()) continue;
+                                const size_t number = driver->boards.size() + 2;
+                                jack_info("RHD2K: connecting to board %zu (%s)", number,
+                                          board_serial.c_str());
+                                evalboard * dev = new evalboard(settings.sample_rate,
+                                                                board_serial.c_str(),
+                                                                firmware, libdir);
+                                if (dev->sampling_rate() != driver->dev->sampling_rate()) {
+                                        delete dev;
+                                        throw daq_error("boards have different sampling rates");
+                                }
+                                rhd2k_board_t * board = rhd2k_board_new(driver, dev,
+                                                                        board_serial.c_str(), number);
+                                if (board == 0) {
+                                        throw daq_error("unable to allocate board state");
+                                }
+                                driver->boards.push_back(board);
+                                jack_info("RHD2K: scanning SPI ports on board %zu", number);
+                                rhd2k_configure_board(dev, settings);
                         }
-                        // manually specified cable length
-                        if (a->cable_m > 0) {
-                                driver->dev->set_cable_meters((evalboard::mosi_id)i, a->cable_m);
+                }
+
+                if (!driver->packed_mode.empty() &&
+                    driver->packed_mode != "all" && driver->packed_mode != "port") {
+                        throw daq_error("packed groups must be 'all' or 'port'");
+                }
+                if (settings.monitors) {
+                        string err;
+                        if (!rhd2k_monitor_parse(settings.monitors, *driver->dev,
+                                                 driver->monitor_configs, err)) {
+                                throw daq_error("bad monitor specification: " + err);
+                        }
+                }
+                if (settings.epochs) {
+                        string err;
+                        driver->epochs = rhd2k_epochs_new(settings.epochs, settings.epoch_dir,
+                                                          *driver->dev, err);
+                        if (driver->epochs == 0) {
+                                throw daq_error("bad capture specification: " + err);
+                        }
+                }
+                if (settings.blank) {
+                        string err;
+                        driver->blank = rhd2k_blank_new(settings.blank, *driver->dev, err);
+                        if (driver->blank == 0) {
+                                throw daq_error("bad blanking specification: " + err);
+                        }
+                }
+
+                // choose the period (or transfer size) and FIFO headroom by
+                // streaming at candidate sizes
+                if (settings.autotune) {
+                        calibration_options options;
+                        options.target = atof(settings.autotune);
+                        if (!(options.target > 0 && options.target < 1)) {
+                                throw daq_error("auto-tune target must be between 0 and 1");
+                        }
+                        jack_info("RHD2K: calibrating USB latency (target xrun probability %g)",
+                                  options.target);
+                        calibration_result cal = calibrate(*driver->dev, options);
+                        std::cout << cal << std::endl;
+                        if (cal.ok) {
+                                if (driver->transfer_size)
+                                        driver->transfer_size = cal.read_size;
+                                else
+                                        driver->period_size = cal.read_size;
+                                settings.capture_frame_latency = cal.headroom;
+                        }
+                        else {
+                                jack_error("RHD2K: calibration didn't meet the target; keeping "
+                                           "the requested %s size and FIFO latency",
+                                           driver->transfer_size ? "transfer" : "period");
                         }
                 }
 
@@ -508,17 +919,69 @@ rhd2k_driver_new(jack_client_t * client, char const * serial, char const * firmw
                         (jack_time_t) floor ((((float) driver->period_size) * 1000000.0f) / driver->dev->sampling_rate());
                 driver->fifo_latency = settings.capture_frame_latency;
 
+                driver->stats = rhd2k_stats_create((driver->stats_name.empty()) ? 0 :
+                                                   driver->stats_name.c_str(),
+                                                   &driver->stats_shared);
+                if (driver->stats == 0) {
+                        throw daq_error("unable to allocate timing statistics");
+                }
+                driver->stats->sample_rate = driver->dev->sampling_rate();
+                driver->stats->period_size = driver->period_size;
+                driver->stats->fifo_latency = driver->fifo_latency;
+                driver->stats->transfer_size = driver->transfer_size;
+
                 std::cout << *driver->dev
                           << "\nperiod = " << driver->period_size
                           << " frames (" << (driver->period_usecs / 1000.0f) << " ms)"
                           << "\nFIFO buffering = " << settings.capture_frame_latency
-                          << " frames (" << (driver->fifo_latency * 1e3f / driver->dev->sampling_rate()) << " ms)" << std::endl;
+                          << " frames (" << (driver->fifo_latency * 1e3f / driver->dev->sampling_rate()) << " ms)"
+                          << "\nUSB transfer = ";
+                if (driver->transfer_size)
+                        std::cout << driver->transfer_size << " frames (reader thread)";
+                else
+                        std::cout << "one period";
+                std::cout
+                          << "\nsoftware monitors = " << driver->monitor_configs.size();
+                if (!driver->packed_mode.empty())
+                        std::cout << "\npacked groups = " << driver->packed_mode
+                                  << (driver->packed_raw ? " (raw)" : "");
+                std::vector<rhd2k_board_t*>::const_iterator b;
+                for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                        std::cout << "\n\nboard " << (*b)->number << " (ports prefixed "
+                                  << (*b)->prefix << "):\n" << *(*b)->dev;
+                }
+                if (driver->sync_bit >= 0)
+                        std::cout << "\nsync input = TTL " << driver->sync_bit;
+                if (driver->epochs) {
+                        std::cout << "\ntriggered capture = " << driver->epochs->pre << " + "
+                                  << driver->epochs->post << " frames, saved in "
+                                  << driver->epochs->dir;
+                }
+                if (driver->blank) {
+                        std::cout << "\nartifact blanking = " << driver->blank->msecs << " ms";
+                        if (driver->blank->ttl_bit >= 0)
+                                std::cout << " after TTL " << driver->blank->ttl_bit;
+                }
+                std::cout << std::endl;
                 return driver;
         }
         catch (std::runtime_error const & e) {
                 jack_error("fatal error: %s", e.what());
         }
+        std::for_each(driver->boards.begin(), driver->boards.end(), rhd2k_board_free);
+        delete driver->phase;
         if (driver->dev) delete driver->dev;
+        jack_ringbuffer_free(driver->commands);
+        jack_ringbuffer_free(driver->monitor_plans_in);
+        jack_ringbuffer_free(driver->monitor_plans_out);
+        rhd2k_log_free(driver->process_log);
+        rhd2k_log_free(driver->reader_log);
+        rhd2k_stats_destroy(driver->stats, driver->stats_name.c_str(), driver->stats_shared);
+        rhd2k_epochs_free(driver->epochs);
+        rhd2k_blank_free(driver->blank);
+        sem_destroy(&driver->worker_wakeup);
+        sem_destroy(&driver->reader_ready);
+        pthread_mutex_destroy(&driver->dev_lock);
         delete driver;
         return 0;
 }
@@ -531,7 +994,20 @@ rhd2k_driver_delete(rhd2k_driver_t * driver)
 #endif
         if (driver == 0) return;
         jack_driver_nt_finish ((jack_driver_nt_t *) driver);
+        std::for_each(driver->boards.begin(), driver->boards.end(), rhd2k_board_free);
+        delete driver->phase;
         if (driver->dev) delete driver->dev;
+        jack_ringbuffer_free(driver->commands);
+        jack_ringbuffer_free(driver->monitor_plans_in);
+        jack_ringbuffer_free(driver->monitor_plans_out);
+        rhd2k_log_free(driver->process_log);
+        rhd2k_log_free(driver->reader_log);
+        rhd2k_stats_destroy(driver->stats, driver->stats_name.c_str(), driver->stats_shared);
+        rhd2k_epochs_free(driver->epochs);
+        rhd2k_blank_free(driver->blank);
+        sem_destroy(&driver->worker_wakeup);
+        sem_destroy(&driver->reader_ready);
+        pthread_mutex_destroy(&driver->dev_lock);
         delete driver;
 }
 
@@ -546,7 +1022,7 @@ driver_get_descriptor ()
 
 	desc = (jack_driver_desc_t *) calloc (1, sizeof (jack_driver_desc_t));
 	strcpy (desc->name, "rhd2000");
-	desc->nparams = 6 + evalboard::nmosi;
+	desc->nparams = 19 + evalboard::nmosi;
 	desc->params = (jack_driver_param_desc_t *) calloc (desc->nparams,
                                                             sizeof (jack_driver_param_desc_t));
         param = desc->params;
@@ -600,6 +1076,134 @@ driver_get_descriptor ()
         strcpy(param->short_desc, "extra fifo latency (frames) ");
         strcpy(param->long_desc, param->short_desc);
 
+        param++;
+        strcpy(param->name, "transfer");
+        param->character = 't';
+        param->type = JackDriverParamUInt;
+        param->value.ui = default_settings.transfer_size;
+        strcpy(param->short_desc, "frames per USB transfer (0 = one period)");
+        strcpy(param->long_desc,
+               "frames per USB transfer. If nonzero, a reader thread moves data off "
+               "the board in transfers of this size, and the period can be much "
+               "shorter. If 0, each period is read in the process thread.");
+
+        param++;
+        strcpy(param->name, "control-socket");
+        param->character = 'S';
+        param->type = JackDriverParamString;
+        strcpy(param->short_desc, "path of control socket (default: none)");
+        strcpy(param->long_desc, param->short_desc);
+
+        param++;
+        strcpy(param->name, "monitors");
+        param->character = 'M';
+        param->type = JackDriverParamString;
+        strcpy(param->short_desc, "software monitor ports");
+        strcpy(param->long_desc,
+               "software monitor ports: number of ports, or mixes separated by ';' "
+               "(e.g. A1_0+0.5*A1_3@300:6000;B1_7)");
+
+        param++;
+        strcpy(param->name, "stats");
+        param->character = 'T';
+        param->type = JackDriverParamString;
+        strcpy(param->value.str, RHD2K_STATS_DEFAULT_NAME);
+        strcpy(param->short_desc, "shared memory segment for timing statistics");
+        strcpy(param->long_desc,
+               "name of the POSIX shared memory segment for timing statistics "
+               "(read with rhd2k_stats), or 'none'");
+
+        param++;
+        strcpy(param->name, "auto-tune");
+        param->character = 'a';
+        param->type = JackDriverParamString;
+        strcpy(param->short_desc, "choose period and FIFO latency (target xrun probability)");
+        strcpy(param->long_desc,
+               "measure USB latency at startup and choose the smallest period (or "
+               "transfer size, with -t) and FIFO latency that meet this xrun "
+               "probability, e.g. 0.001. Overrides -p or -t, and -I.");
+
+        param++;
+        strcpy(param->name, "boards");
+        param->character = 'b';
+        param->type = JackDriverParamString;
+        strcpy(param->short_desc, "serial numbers of additional boards");
+        strcpy(param->long_desc,
+               "serial numbers of additional eval boards, separated by commas. "
+               "Their channels are aligned with the first board's and exposed "
+               "with the prefix b2_, b3_, etc.");
+
+        param++;
+        strcpy(param->name, "sync");
+        param->character = 'y';
+        param->type = JackDriverParamInt;
+        param->value.i = default_settings.sync_bit;
+        strcpy(param->short_desc, "TTL input with a sync signal shared by all boards (-1 = none)");
+        strcpy(param->long_desc,
+               "TTL input (0-15) wired to a sync signal shared by all the boards. "
+               "Rising edges, at least half a second apart, are used to align "
+               "the boards exactly. Without it, the boards are aligned using the "
+               "host clock, to within a few frames.");
+
+        param++;
+        strcpy(param->name, "twos-complement");
+        param->character = 'z';
+        param->type = JackDriverParamBool;
+        param->value.i = default_settings.twoscomp;
+        strcpy(param->short_desc, "read signed samples from the amplifiers");
+        strcpy(param->long_desc,
+               "program the amplifiers to return two's complement samples, which "
+               "are converted without an offset. The eval board DACs can't "
+               "monitor channels in this mode.");
+
+        param++;
+        strcpy(param->name, "packed");
+        param->character = 'P';
+        param->type = JackDriverParamString;
+        strcpy(param->short_desc, "packed ports: 'all' or 'port' (default: none)");
+        strcpy(param->long_desc,
+               "create ports whose channels are delivered as one channel-major "
+               "block in shared memory: 'all' for one port with all channels, or "
+               "'port' for one per SPI port plus one for the eval board ADCs. "
+               "The layout is in the ports' metadata.");
+
+        param++;
+        strcpy(param->name, "raw-packed");
+        param->character = 'R';
+        param->type = JackDriverParamBool;
+        param->value.i = default_settings.packed_raw;
+        strcpy(param->short_desc, "packed ports carry raw 16-bit samples");
+        strcpy(param->long_desc,
+               "copy the samples for the packed ports without converting them. "
+               "The scale and offset of each channel are in the ports' metadata.");
+
+        param++;
+        strcpy(param->name, "epochs");
+        param->character = 'e';
+        param->type = JackDriverParamString;
+        strcpy(param->short_desc, "triggered capture: <ttl>,<pre ms>,<post ms>");
+        strcpy(param->long_desc,
+               "save a window of raw frames around each rising edge of a TTL input "
+               "(0-15, or -1 for none) and each note on event on the trigger port");
+
+        param++;
+        strcpy(param->name, "epoch-dir");
+        param->character = 'o';
+        param->type = JackDriverParamString;
+        strcpy(param->value.str, default_settings.epoch_dir);
+        strcpy(param->short_desc, "directory for triggered captures (default: /tmp)");
+        strcpy(param->long_desc, param->short_desc);
+
+        param++;
+        strcpy(param->name, "blank");
+        param->character = 'k';
+        param->type = JackDriverParamString;
+        strcpy(param->short_desc, "artifact blanking: <ttl>,<ms>[,<ports>]");
+        strcpy(param->long_desc,
+               "hold the amplifiers on the given SPI ports (default ABCD) in fast "
+               "settle for this many ms after each rising edge of a TTL input "
+               "(0-15, or -1 for none) and each note on event on the blank port");
+
         param++;
         strcpy(param->name, "version");
         param->character = 'V';
@@ -643,6 +1247,45 @@ driver_initialize(jack_client_t * client, JSList * params)
                 case 'I':
                         cmlparams.capture_frame_latency = param->value.ui;
                         break;
+                case 't':
+                        cmlparams.transfer_size = param->value.ui;
+                        break;
+                case 'S':
+                        cmlparams.control_socket = param->value.str;
+                        break;
+                case 'M':
+                        cmlparams.monitors = param->value.str;
+                        break;
+                case 'T':
+                        cmlparams.stats_name = param->value.str;
+                        break;
+                case 'a':
+                        cmlparams.autotune = param->value.str;
+                        break;
+                case 'b':
+                        cmlparams.boards = param->value.str;
+                        break;
+                case 'y':
+                        cmlparams.sync_bit = param->value.i;
+                        break;
+                case 'z':
+                        cmlparams.twoscomp = param->value.i;
+                        break;
+                case 'P':
+                        cmlparams.packed = param->value.str;
+                        break;
+                case 'R':
+                        cmlparams.packed_raw = param->value.i;
+                        break;
+                case 'e':
+                        cmlparams.epochs = param->value.str;
+                        break;
+                case 'o':
+                        cmlparams.epoch_dir = param->value.str;
+                        break;
+                case 'k':
+                        cmlparams.blank = param->value.str;
+                        break;
                 default:        // any other valid option refers to a port
                         parse_port_config(param->character, param->value.str, cmlparams);
                 }
@@ -23,7 +23,209 @@ Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 #ifndef __JACK_RHD2K_DRIVER_H
 #define __JACK_RHD2K_DRIVER_H
 
+#include <pthread.h>
+#include <semaphore.h>
+#include <map>
+#include <string>
+#include <vector>
 
-typedef
+#include "rhd2000eval.hpp"
+#include "rhd2000align.hpp"
+#include "rhd2k_log.h"
+#include "rhd2k_monitor.h"
+#include "rhd2k_packed.h"
+#include "rhd2k_stats.h"
+
+#include <jack/types.h>
+#include <jack/jslist.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+extern "C"
+{
+#include "driver.h"
+#include "internal.h"
+#include "engine.h"
+}
+
+/** number of cycles over which the capture latency is measured */
+static const size_t rhd2k_latency_window = 256;
+
+/** change in the measured latency (us) that causes it to be reported */
+static const double rhd2k_latency_drift_usecs = 500.0;
+
+/** a channel that needs to be converted in the current cycle */
+struct rhd2k_active_channel_t {
+        size_t channel;         // index in capture_ports
+        jack_port_t * port;     // capture port, or 0 if only monitored
+        size_t tap_begin;       // range in monitor_plan->active_taps
+        size_t tap_end;
+        char const * src;       // first sample, in its board's buffer
+        size_t stride;          // the board's frame size
+        float offset;
+        bool twoscomp;          // samples are signed (see convert_channel_signed)
+};
+
+/** a packed channel group (see rhd2k_packed.h) */
+struct rhd2k_packed_group_t {
+        std::string name;
+        std::string shm_name;
+        jack_port_t * port;
+        rhd2k_packed_t * block;
+        std::vector<size_t> channels;   // indices in the first board's adc table
+        std::vector<rhd2k_active_channel_t> sources;
+};
+
+struct rhd2k_board_t;
+struct rhd2k_epochs_t;
+struct rhd2k_blank_t;
+
+struct rhd2k_driver_t {
+        JACK_DRIVER_NT_DECL;
+
+        rhd2k::evalboard * dev;
+        void * buffer;
+        uint32_t last_frame;    // the timestamp in the RHD data stream
+
+	jack_nframes_t  period_size;
+        jack_nframes_t  fifo_latency; // extra fifo buffering, in frames
+
+	jack_client_t  * client;
+        std::vector<jack_port_t*> capture_ports;
+        long eval_adc_enabled;
+
+        // software monitors (see rhd2k_monitor.h). The configs are only
+        // touched outside the process thread; the plan belongs to the
+        // process thread once it has been received
+        std::vector<rhd2k_monitor_config_t> monitor_configs;
+        std::vector<jack_port_t*> monitor_ports;
+        rhd2k_monitor_plan_t * monitor_plan;
+        jack_ringbuffer_t * monitor_plans_in;
+        jack_ringbuffer_t * monitor_plans_out;
+        std::vector<float*> monitor_bufs;
+        std::vector<size_t> active_monitors;
+        float * monitor_scratch;
+
+        // packed channel groups (see rhd2k_packed.h), and the ones with a
+        // connected port, which the process thread fills
+        std::string packed_mode;
+        bool packed_raw;
+        std::vector<rhd2k_packed_group_t*> packed_groups;
+        std::vector<size_t> active_packed;
+
+        // TTL inputs as MIDI events (see rhd2k_ttl.h). The state is owned
+        // by the process thread, which only scans while the port is connected
+        jack_port_t * ttl_in_port;
+        bool ttl_in_active;
+        rhd2k::evalboard::data_type ttl_in_state;
+
+        // TTL outputs from MIDI events. The process thread merges each
+        // cycle's events into ttl_out_request (mask << 16 | value, or 0 if
+        // none), which the worker swaps out and applies. The other fields
+        // belong to the process thread and time one update at a time.
+        jack_port_t * ttl_out_port;
+        volatile uint32_t ttl_out_request;
+        rhd2k::evalboard::data_type ttl_out_waiting;    // mask being timed, or 0
+        rhd2k::evalboard::data_type ttl_out_expected;
+        uint32_t ttl_out_sent;                          // frame when it was sent
+
+        // triggered capture (see rhd2k_epochs.h), or 0
+        rhd2k_epochs_t * epochs;
+
+        // stimulation artifact blanking (see rhd2k_blank.h), or 0
+        rhd2k_blank_t * blank;
+
+        // connection state of the capture ports followed by the monitor,
+        // packed and ttl_in ports, maintained by the port connect callback. connection_serial
+        // is incremented after every change to port_connected.
+        std::map<jack_port_t const*, size_t> port_index;
+        std::vector<int> port_connections;
+        std::vector<char> port_connected;
+        volatile int connection_serial;
+
+        // the process thread's copy of the connection state. active_channels
+        // lists the connected or monitored channels and is only rebuilt when
+        // the serial or the monitor plan changes; capacity is reserved in
+        // attach so this doesn't allocate.
+        std::vector<rhd2k_active_channel_t> active_channels;
+        std::vector<char> rt_connected;
+        int rt_connection_serial;
+
+        // serializes access to the Opal Kelly device between threads. the
+        // process thread holds this while talking to the board; other
+        // threads only hold it for one transaction at a time.
+        pthread_mutex_t dev_lock;
+
+        // commands from the control socket, consumed by the worker thread
+        jack_ringbuffer_t * commands;
+
+        // worker thread for USB transactions outside the process thread
+        pthread_t worker_thread;
+        sem_t worker_wakeup;
+        volatile bool worker_running;
+
+        // hardware monitoring state (owned by the worker thread, except
+        // that any thread may set the dirty flags)
+        std::vector<long> dac_channel;  // channel on each dac, or -1
+        std::vector<char> monitor_wanted;       // by channel
+        std::vector<char> monitor_dirty_ports;  // channels to recheck
+        ulong dac_pinned;       // dacs assigned by the control socket
+        int monitor_dirty;      // set when any port's state may have changed
+
+        // logs for the process and reader threads, emitted by the worker
+        rhd2k_log_t * process_log;
+        rhd2k_log_t * reader_log;
+
+        // timing statistics and status counters (see rhd2k_stats.h),
+        // written by the process or reader thread only
+        rhd2k_stats_t * stats;
+        std::string stats_name;
+        bool stats_shared;
+
+        // capture latency. The realtime thread records the age of the
+        // oldest frame in each period in latency_window; the worker thread
+        // takes the range over the window, and if it has drifted from the
+        // reported range, updates it and asks the engine to recompute.
+        volatile uint32_t latency_window[rhd2k_latency_window];
+        volatile unsigned long latency_count;
+        volatile jack_nframes_t latency_min;    // reported to JACK
+        volatile jack_nframes_t latency_max;
+
+        // reader thread (see rhd2k_reader.h). Only used if transfer_size is
+        // nonzero; otherwise the process thread reads each period itself.
+        jack_nframes_t transfer_size;
+        pthread_t reader_thread;
+        volatile bool reader_running;
+        jack_ringbuffer_t * ring;       // frames waiting for the process thread
+        sem_t reader_ready;             // posted after each transfer
+        void * reader_buffer;
+        volatile int xrun_pending;      // set by reader, cleared by process thread
+        volatile int reader_error;
+        float xrun_usecs;
+
+        // additional boards (see rhd2k_boards.h). The phase of this board's
+        // clock is updated by whichever thread polls its FIFO. sync_bit is
+        // the TTL input with the sync signal, or -1.
+        std::vector<rhd2k_board_t*> boards;
+        rhd2k::clock_phase * phase;
+        int sync_bit;
+        bool sync_level;
+
+        // control socket
+        std::string control_path;
+        int control_fd;
+        int control_wakeup[2];
+        pthread_t control_thread;
+        bool control_running;
+};
+
+/*
+ * board-level helpers shared with the reader thread; caller holds dev_lock.
+ * Failures are logged to log if it's not 0, which realtime threads must
+ * pass, and otherwise reported with jack_error.
+ */
+int rhd2k_acquisition_start (rhd2k_driver_t *driver, void * buf, size_t nframes,
+                             rhd2k_log_t * log=0);
+int rhd2k_acquisition_stop (rhd2k_driver_t *driver, rhd2k_log_t * log=0);
 
 #endif
@@ -0,0 +1,258 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Stimulation artifact blanking.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <jack/midiport.h>
+
+#include "rhd2000frame.hpp"
+#include "rhd2k.hpp"
+#include "rhd2k_blank.h"
+#include "rhd2k_worker.h"
+
+using std::size_t;
+using std::string;
+using namespace rhd2k;
+
+static bool
+time_before(struct timespec const & a, struct timespec const & b)
+{
+        return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+rhd2k_blank_t *
+rhd2k_blank_new(char const * spec, evalboard & dev, string & err)
+{
+        int ttl_bit;
+        double msecs;
+        char ports[8] = "ABCD";
+        char extra;
+        const int n = sscanf(spec, "%d,%lf,%7[A-D]%c", &ttl_bit, &msecs, ports, &extra);
+        if (n != 2 && n != 3) {
+                err = "expected <ttl>,<ms>[,<ports>]";
+                return 0;
+        }
+        if (ttl_bit < -1 || ttl_bit > 15) {
+                err = "trigger input must be between 0 and 15, or -1";
+                return 0;
+        }
+        if (!(msecs > 0)) {
+                err = "hold must have a positive length";
+                return 0;
+        }
+
+        rhd2k_blank_t * b = new rhd2k_blank_t;
+        b->ttl_bit = ttl_bit;
+        b->msecs = msecs;
+        b->ports = 0;
+        for (char const * p = ports; *p; ++p) {
+                b->ports |= 1UL << (*p - 'A');
+        }
+        b->trigger_port = b->flag_port = 0;
+        b->ttl_edges = rising_edges(std::max(ttl_bit, 0));
+        b->requests = b->handled = 0;
+        b->holding = false;
+
+        // the enabled streams are packed into the frame in order
+        size_t count = 0;
+        for (size_t i = 0; i < evalboard::nmiso; ++i) {
+                const evalboard::miso_id stream = (evalboard::miso_id)i;
+                if (!dev.stream_enabled(stream)) continue;
+                const size_t n = count++;
+                // the aux results on a DDR stream are not replies to commands
+                if (dev.stream_ddr(stream)) continue;
+                if (!(b->ports & (1UL << (dev.stream_source(stream) / 2)))) continue;
+                rhd2k_blank_marker_t m = { stream, dev.aux_result_offset(evalboard::AuxCmd3, n),
+                                           dev.fast_settle_result(stream),
+                                           dev.fast_settle_aliases(stream), false, 0 };
+                b->markers.push_back(m);
+        }
+        if (b->markers.empty()) {
+                err = "no amplifiers on the blanked ports";
+                rhd2k_blank_free(b);
+                return 0;
+        }
+        dev.prepare_fast_settle();
+        return b;
+}
+
+void
+rhd2k_blank_free(rhd2k_blank_t * blank)
+{
+        delete blank;
+}
+
+int
+rhd2k_blank_attach(rhd2k_driver_t * driver)
+{
+        rhd2k_blank_t * b = driver->blank;
+        if (b == 0) return 0;
+        b->trigger_port = jack_port_register (driver->client, "blank", JACK_DEFAULT_MIDI_TYPE,
+                                              JackPortIsInput|JackPortIsTerminal, 0);
+        if (b->trigger_port == 0) {
+                jack_error ("RHD2K: cannot register port for blank");
+                return -1;
+        }
+        b->flag_port = jack_port_register (driver->client, "blanked", JACK_DEFAULT_AUDIO_TYPE,
+                                           JackPortIsOutput|JackPortIsTerminal, 0);
+        if (b->flag_port == 0) {
+                jack_error ("RHD2K: cannot register port for blanked");
+                return -1;
+        }
+        b->ttl_edges.reset();
+        std::vector<rhd2k_blank_marker_t>::iterator m;
+        for (m = b->markers.begin(); m != b->markers.end(); ++m) {
+                m->held = false;
+                m->pending = 0;
+        }
+        return 0;
+}
+
+void
+rhd2k_blank_detach(rhd2k_driver_t * driver)
+{
+        rhd2k_blank_t * b = driver->blank;
+        if (b == 0) return;
+        if (b->trigger_port) {
+                jack_port_unregister (driver->client, b->trigger_port);
+                b->trigger_port = 0;
+        }
+        if (b->flag_port) {
+                jack_port_unregister (driver->client, b->flag_port);
+                b->flag_port = 0;
+        }
+}
+
+static void
+blank_trigger(rhd2k_driver_t * driver)
+{
+        __sync_fetch_and_add(&driver->blank->requests, 1UL);
+        rhd2k_worker_wake(driver);
+}
+
+void
+rhd2k_blank_read(rhd2k_driver_t * driver, jack_nframes_t nframes)
+{
+        rhd2k_blank_t * b = driver->blank;
+        if (b == 0) return;
+        const size_t fs = driver->dev->frame_size();
+        char const * buf = static_cast<char const *>(driver->buffer);
+
+        // one hold per period is enough, but the level has to be tracked
+        if (b->ttl_bit >= 0 && b->ttl_edges.count(buf, nframes, fs) > 0)
+                blank_trigger(driver);
+
+        jack_default_audio_sample_t * out = reinterpret_cast<jack_default_audio_sample_t *>(
+                jack_port_get_buffer (b->flag_port, nframes));
+        memset(out, 0, nframes * sizeof(jack_default_audio_sample_t));
+        // the reply to a command arrives in the next frame (see
+        // rhd2000::update), and the sequences start with the timestamps
+        const size_t length = rhd2000::register_sequence_length;
+        const size_t first = (frame_timestamp(buf) + length - 1) % length;
+        std::vector<rhd2k_blank_marker_t>::iterator m;
+        for (m = b->markers.begin(); m != b->markers.end(); ++m) {
+                const uint64_t aliases = m->aliases;
+                char const * word = buf + m->offset;
+                size_t pos = first;
+                for (jack_nframes_t t = 0; t < nframes; ++t, word += fs) {
+                        const bool settle =
+                                *reinterpret_cast<evalboard::data_type const *>(word) == m->value;
+                        if (m->held) {
+                                // at this position, only the hold sequence
+                                // doesn't clear the fast settle bit
+                                if (pos == rhd2000::register_sequence_reg0 && !settle)
+                                        m->held = false;
+                        }
+                        else if (!settle) {
+                                m->pending = 0;
+                        }
+                        else if ((aliases >> pos) & 1) {
+                                m->pending += 1;
+                        }
+                        else {
+                                // the replies at aliased positions just
+                                // before were part of the hold
+                                for (size_t i = std::min<size_t>(m->pending, t); i > 0; --i)
+                                        out[t - i] = 1.0f;
+                                m->held = true;
+                                m->pending = 0;
+                        }
+                        if (m->held) out[t] = 1.0f;
+                        if (++pos == length) pos = 0;
+                }
+        }
+}
+
+void
+rhd2k_blank_write(rhd2k_driver_t * driver, jack_nframes_t nframes)
+{
+        rhd2k_blank_t * b = driver->blank;
+        if (b == 0) return;
+        void * port_buf = jack_port_get_buffer (b->trigger_port, nframes);
+        const uint32_t nevents = jack_midi_get_event_count(port_buf);
+        jack_midi_event_t ev;
+        for (uint32_t i = 0; i < nevents; ++i) {
+                if (jack_midi_event_get(&ev, port_buf, i) || ev.size < 3) continue;
+                if ((ev.buffer[0] & 0xf0) != 0x90 || ev.buffer[2] == 0) continue;
+                blank_trigger(driver);
+                break;
+        }
+}
+
+void
+rhd2k_blank_update(rhd2k_driver_t * driver, bool merge)
+{
+        rhd2k_blank_t * b = driver->blank;
+        if (b == 0) return;
+        std::vector<rhd2k_blank_marker_t>::iterator m;
+        for (m = b->markers.begin(); m != b->markers.end(); ++m) {
+                const uint64_t aliases = driver->dev->fast_settle_aliases(m->stream);
+                m->aliases = (merge) ? m->aliases | aliases : aliases;
+        }
+}
+
+static void
+blank_set(rhd2k_driver_t * driver, bool hold)
+{
+        rhd2k_blank_t * b = driver->blank;
+        for (size_t port = 0; port < evalboard::nmosi; ++port) {
+                if (!(b->ports & (1UL << port))) continue;
+                pthread_mutex_lock(&driver->dev_lock);
+                driver->dev->set_fast_settle((evalboard::mosi_id)port, hold);
+                pthread_mutex_unlock(&driver->dev_lock);
+        }
+        b->holding = hold;
+}
+
+void
+rhd2k_blank_apply(rhd2k_driver_t * driver, struct timespec * wake)
+{
+        rhd2k_blank_t * b = driver->blank;
+        if (b == 0) return;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        const unsigned long requests = b->requests;
+        if (requests != b->handled) {
+                b->handled = requests;
+                const long long nsecs = now.tv_nsec + (long long)(b->msecs * 1e6 + 0.5);
+                b->release.tv_sec = now.tv_sec + nsecs / 1000000000LL;
+                b->release.tv_nsec = nsecs % 1000000000LL;
+                if (!b->holding) blank_set(driver, true);
+        }
+        else if (b->holding && !time_before(now, b->release)) {
+                blank_set(driver, false);
+        }
+        if (b->holding && time_before(b->release, *wake))
+                *wake = b->release;
+}
@@ -0,0 +1,125 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Stimulation artifact blanking. A stimulus pulse can saturate the
+ *   amplifiers, which then take tens to hundreds of ms to recover through
+ *   their highpass filters. Holding them in fast settle while the pulse is
+ *   delivered clamps the outputs so that they recover within a millisecond
+ *   or so of being released.
+ *
+ *   Fast settle is bit 5 of register 0, which the chips only see through
+ *   the aux command sequences. At startup the driver loads a sequence that
+ *   writes register 0 with the bit set in every slot into a spare AuxCmd3
+ *   bank for each port (see evalboard::prepare_fast_settle). A trigger (a
+ *   rising edge on a TTL input, or a note on event on the blank MIDI port)
+ *   asks the worker thread to switch the chosen ports to that bank, and to
+ *   switch them back to their register sequence after the requested time;
+ *   another trigger in the meantime extends the hold. The firmware can't
+ *   switch banks on its own, so the hold starts a USB round trip after the
+ *   trigger, like the TTL outputs, and its length is only as exact as the
+ *   worker's timer.
+ *
+ *   The frames in which the amplifiers were held are found from the data.
+ *   Each frame carries the chip's reply to its AuxCmd3 command, which for
+ *   the hold sequence is a write of register 0 with the fast settle bit,
+ *   and the frame's timestamp gives the command's position in the
+ *   sequence. A write returns the value written, so the register
+ *   sequence returns the same reply wherever it writes another register
+ *   with that value (an amp power byte of 0xfe, for instance). Replies at
+ *   those positions only count as part of a hold that is confirmed
+ *   somewhere else, and the worker keeps track of them as the amp power
+ *   changes. Once the bank is switched back, the amplifiers stay in fast
+ *   settle until the register sequence writes register 0. The blanked
+ *   port is 1.0 from the first reply of a hold to that write, and 0.0
+ *   otherwise. The replies can't be told apart when the bank switch falls
+ *   next to one of those positions, so a frame just before a hold may be
+ *   flagged with it, and a hold that starts on them at the end of a period
+ *   is only flagged from the next one.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_BLANK_H
+#define __RHD2K_BLANK_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include "jack_rhd2k_driver.h"
+
+/** where to look for the fast settle reply of a stream */
+struct rhd2k_blank_marker_t {
+        rhd2k::evalboard::miso_id stream;
+        size_t offset;                  // of the AuxCmd3 result in the frame
+        rhd2k::evalboard::data_type value;
+        // positions in the register sequence with the same reply, set by
+        // the worker
+        volatile uint64_t aliases;
+
+        // process thread
+        bool held;                      // until register 0 is written
+        size_t pending;                 // replies at aliased positions
+};
+
+struct rhd2k_blank_t {
+        int ttl_bit;                    // or -1 for MIDI triggers only
+        double msecs;                   // length of the hold
+        unsigned long ports;            // bit mask of mosi_id
+        std::vector<rhd2k_blank_marker_t> markers;
+
+        // process thread
+        jack_port_t * trigger_port;     // MIDI
+        jack_port_t * flag_port;        // audio
+        rhd2k::rising_edges ttl_edges;
+        volatile unsigned long requests;        // triggers so far
+
+        // worker thread
+        unsigned long handled;
+        bool holding;
+        struct timespec release;        // CLOCK_MONOTONIC
+};
+
+/**
+ * Parse a blanking specification, "<ttl>,<ms>[,<ports>]", where ttl is the
+ * TTL input (0-15) that triggers a hold, or -1 for MIDI triggers only, and
+ * ports are the letters of the SPI ports to hold (default all). Loads the
+ * hold sequences, so the board must be configured and stopped.
+ *
+ * @return the new state, or 0 if the spec was bad (err contains the reason)
+ */
+rhd2k_blank_t * rhd2k_blank_new(char const * spec, rhd2k::evalboard & dev, std::string & err);
+
+void rhd2k_blank_free(rhd2k_blank_t * blank);
+
+/** register the trigger and flag ports */
+int rhd2k_blank_attach(rhd2k_driver_t * driver);
+
+void rhd2k_blank_detach(rhd2k_driver_t * driver);
+
+/** flag held frames and look for TTL triggers in the period */
+void rhd2k_blank_read(rhd2k_driver_t * driver, jack_nframes_t nframes);
+
+/** look for MIDI triggers in the period that was just read */
+void rhd2k_blank_write(rhd2k_driver_t * driver, jack_nframes_t nframes);
+
+/**
+ * Update the positions in the register sequences that return the same
+ * reply as the hold sequences. Call with dev_lock held, with merge true
+ * before a new register sequence is uploaded to a running board, as the
+ * old and new commands are mixed until it's done, and with merge false
+ * afterwards.
+ */
+void rhd2k_blank_update(rhd2k_driver_t * driver, bool merge);
+
+/**
+ * Start or release holds. Called by the worker, which must not hold
+ * dev_lock. If a hold is in progress, wake (on CLOCK_MONOTONIC) is moved
+ * up to its release time if that's earlier.
+ */
+void rhd2k_blank_apply(rhd2k_driver_t * driver, struct timespec * wake);
+
+#endif
@@ -0,0 +1,459 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Additional eval boards (see rhd2k_boards.h)
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <sstream>
+#include <jack/thread.h>
+
+#include "rhd2000cycle.hpp"
+#include "rhd2k_boards.h"
+#include "rhd2k_reader.h"
+
+using std::size_t;
+using std::string;
+using namespace rhd2k;
+
+/*
+ * like the first board's reader (see rhd2k_reader.cpp), but the board is
+ * only touched by this thread, so no lock is needed, and there's no extra
+ * FIFO latency.
+ */
+static void *
+board_reader_thread(void * arg)
+{
+        rhd2k_board_t * board = static_cast<rhd2k_board_t *>(arg);
+        const size_t transfer = board->transfer_size;
+        const size_t transfer_bytes = transfer * board->dev->frame_size();
+        uint32_t next_frame = 0;
+
+        while (board->reader_running) {
+                const size_t nframes = board->dev->nframes();
+                board->phase->observe(next_frame + nframes, rhd2k_stats_now());
+                if (nframes < transfer) {
+                        usleep(fifo_fill_usecs(nframes, transfer, board->dev->sampling_rate()));
+                }
+
+                const size_t got = board->dev->read (board->reader_buffer, transfer);
+                size_t bad_frame;
+                frame_fault fault;
+                const period_status status = check_period(*board->dev, board->reader_buffer,
+                                                          transfer, got, next_frame,
+                                                          &bad_frame, &fault);
+                if (status == PERIOD_STOPPED || (status == PERIOD_READ_ERROR && !board->dev->running())) {
+                        rhd2k_log(board->log,
+                                  (status == PERIOD_STOPPED) ? RHD2K_LOG_STOPPED : RHD2K_LOG_READ_ERROR,
+                                  next_frame, nframes);
+                        board->reader_error = 1;
+                        sem_post(&board->reader_ready);
+                        break;
+                }
+                if (status == PERIOD_OK && jack_ringbuffer_write_space(board->ring) >= transfer_bytes) {
+                        jack_ringbuffer_write(board->ring, (char const *)board->reader_buffer,
+                                              transfer_bytes);
+                        next_frame += transfer;
+                        sem_post(&board->reader_ready);
+                        continue;
+                }
+
+                if (status == PERIOD_OK)
+                        rhd2k_log(board->log, RHD2K_LOG_OVERFLOW, next_frame, nframes);
+                else if (status == PERIOD_READ_ERROR)
+                        rhd2k_log(board->log, RHD2K_LOG_READ_ERROR, next_frame, nframes);
+                else
+                        rhd2k_log(board->log, RHD2K_LOG_UNDERFULL, next_frame, nframes,
+                                  0.0f, bad_frame, fault);
+                board->dev->stop();
+                board->phase->reset();
+                __sync_lock_test_and_set(&board->xrun_pending, 1);
+                sem_post(&board->reader_ready);
+                while (board->xrun_pending && board->reader_running) {
+                        usleep(1000);
+                }
+                if (!board->reader_running) break;
+                if (!start_acquisition(*board->dev, board->reader_buffer, transfer, 0)) {
+                        rhd2k_log(board->log, RHD2K_LOG_STOPPED, 0, 0);
+                        board->reader_error = 1;
+                        sem_post(&board->reader_ready);
+                        break;
+                }
+                next_frame = 0;
+        }
+        return 0;
+}
+
+static void
+board_reader_stop(rhd2k_board_t * board)
+{
+        if (board->reader_running) {
+                board->reader_running = false;
+                pthread_join(board->reader_thread, 0);
+        }
+        if (board->ring) jack_ringbuffer_free(board->ring);
+        free(board->reader_buffer);
+        board->ring = 0;
+        board->reader_buffer = 0;
+}
+
+static int
+board_reader_start(rhd2k_board_t * board)
+{
+        rhd2k_driver_t * driver = board->driver;
+        board->transfer_size = (driver->transfer_size) ? driver->transfer_size : driver->period_size;
+        const size_t frames = rhd2k_ring_transfers * std::max<size_t>(board->transfer_size,
+                                                                       driver->period_size);
+        board->ring = jack_ringbuffer_create(frames * board->dev->frame_size() + 1);
+        jack_ringbuffer_mlock(board->ring);
+        board->reader_buffer = malloc(board->transfer_size * board->dev->frame_size());
+        if (board->ring == 0 || board->reader_buffer == 0) {
+                jack_error("RHD2K: unable to allocate frame ring for board %zu", board->number);
+                board_reader_stop(board);
+                return -1;
+        }
+        board->xrun_pending = 0;
+        board->reader_error = 0;
+        board->next_frame = 0;
+        board->phase->reset();
+        board->align->reset();
+        board->reader_running = true;
+
+        int priority = jack_client_real_time_priority(driver->client);
+        if (jack_client_create_thread(driver->client, &board->reader_thread, priority,
+                                      priority > 0, board_reader_thread, board) != 0) {
+                jack_error("RHD2K: unable to start reader thread for board %zu", board->number);
+                board->reader_running = false;
+                board_reader_stop(board);
+                return -1;
+        }
+        return 0;
+}
+
+rhd2k_board_t *
+rhd2k_board_new(rhd2k_driver_t * driver, evalboard * dev, char const * serial, size_t number)
+{
+        rhd2k_board_t * board = new rhd2k_board_t;
+        char prefix[16];
+        sprintf(prefix, "b%zu_", number);
+
+        board->driver = driver;
+        board->dev = dev;
+        board->serial = serial;
+        board->prefix = prefix;
+        board->number = number;
+        board->first_port = 0;
+        board->buffer = 0;
+        board->transfer_size = 0;
+        board->reader_running = false;
+        board->ring = 0;
+        board->reader_buffer = 0;
+        sem_init(&board->reader_ready, 0, 0);
+        board->xrun_pending = 0;
+        board->reader_error = 0;
+        board->log = rhd2k_log_new();
+        board->phase = new clock_phase(dev->sampling_rate());
+        board->align = new board_alignment(dev->sampling_rate());
+        board->next_frame = 0;
+        board->sync_level = false;
+        board->offset = 0;
+        board->dropped = board->repeated = board->late = board->xruns = 0;
+        if (board->log == 0) {
+                rhd2k_board_free(board);
+                return 0;
+        }
+        return board;
+}
+
+void
+rhd2k_board_free(rhd2k_board_t * board)
+{
+        if (board == 0) return;
+        board_reader_stop(board);
+        free(board->buffer);
+        rhd2k_log_free(board->log);
+        delete board->phase;
+        delete board->align;
+        delete board->dev;
+        sem_destroy(&board->reader_ready);
+        delete board;
+}
+
+int
+rhd2k_boards_attach(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                rhd2k_board_t * board = *b;
+                board->first_port = driver->capture_ports.size();
+                std::vector<evalboard::channel_info_t>::const_iterator it;
+                for (it = board->dev->adc_table().begin(); it != board->dev->adc_table().end(); ++it) {
+                        const string name = board->prefix + it->name;
+                        jack_port_t * port = jack_port_register (driver->client, name.c_str(),
+                                                                 JACK_DEFAULT_AUDIO_TYPE,
+                                                                 JackPortIsOutput|JackPortIsPhysical|JackPortIsTerminal,
+                                                                 0);
+                        if (port == 0) {
+                                jack_error ("RHD2K: cannot register port for %s", name.c_str());
+                                return -1;
+                        }
+                        driver->port_index[port] = driver->capture_ports.size();
+                        driver->capture_ports.push_back(port);
+                }
+        }
+        return rhd2k_boards_bufsize(driver);
+}
+
+void
+rhd2k_boards_detach(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                free((*b)->buffer);
+                (*b)->buffer = 0;
+        }
+}
+
+int
+rhd2k_boards_bufsize(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                rhd2k_board_t * board = *b;
+                free(board->buffer);
+                board->buffer = calloc(driver->period_size, board->dev->frame_size());
+                if (board->buffer == 0) {
+                        jack_error ("RHD2K: unable to allocate buffer for board %zu", board->number);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+int
+rhd2k_boards_start(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_board_t *>::iterator b;
+        // start the boards as close together as possible
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                if (!start_acquisition(*(*b)->dev, (*b)->buffer, driver->period_size, 0)) {
+                        jack_error("RHD2K: failed to start acquisition on board %zu", (*b)->number);
+                        return -1;
+                }
+        }
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                if (board_reader_start(*b)) return -1;
+        }
+        return 0;
+}
+
+void
+rhd2k_boards_stop(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                board_reader_stop(*b);
+                (*b)->dev->stop();
+        }
+}
+
+/*
+ * wait until nframes frames are in the board's ring, or until the deadline.
+ * returns the number of frames available
+ */
+static size_t
+board_wait(rhd2k_board_t * board, size_t nframes, struct timespec const * deadline)
+{
+        const size_t frame_size = board->dev->frame_size();
+        size_t avail;
+        while ((avail = jack_ringbuffer_read_space(board->ring) / frame_size) < nframes) {
+                if (board->reader_error || board->xrun_pending) break;
+                if (sem_timedwait(&board->reader_ready, deadline) != 0 && errno == ETIMEDOUT) break;
+        }
+        return avail;
+}
+
+/*
+ * the difference in clock phase between a board and the reference board,
+ * from snapshots published by their readers
+ */
+static bool
+board_phase_offset(rhd2k_driver_t const * driver, rhd2k_board_t const * board, double * out)
+{
+        double board_phase, ref_phase;
+        const bool board_valid = board->phase->snapshot(&board_phase);
+        const bool ref_valid = driver->phase->snapshot(&ref_phase);
+        *out = board_phase - ref_phase;
+        return board_valid && ref_valid;
+}
+
+static int
+board_read(rhd2k_driver_t * driver, rhd2k_board_t * board, uint32_t first_frame,
+           struct timespec const * deadline)
+{
+        const size_t period = driver->period_size;
+        const size_t frame_size = board->dev->frame_size();
+        char * buf = static_cast<char *>(board->buffer);
+
+        if (board->reader_error) {
+                return -1;
+        }
+        if (board->xrun_pending) {
+                jack_ringbuffer_read_advance(board->ring, jack_ringbuffer_read_space(board->ring));
+                board->next_frame = 0;
+                board->align->reset();
+                board->xruns += 1;
+                rhd2k_log(driver->process_log, RHD2K_LOG_BOARD_XRUN, first_frame, 0,
+                          0.0f, board->number);
+                __sync_lock_release(&board->xrun_pending);
+        }
+
+        // how far off is the board?
+        double phase_offset;
+        const bool phase_valid = board_phase_offset(driver, board, &phase_offset);
+        double offset = 0;
+        long step = 0;
+        if (board->align->offset(phase_offset, phase_valid, &offset)) {
+                board->offset = offset;
+                step = board->align->correction(offset, first_frame, board->next_frame, period);
+        }
+
+        size_t drop = 0, repeat = 0;
+        if (step > 0) {
+                drop = board_wait(board, step + period, deadline);
+                drop = std::min<size_t>(drop, step);
+                jack_ringbuffer_read_advance(board->ring, drop * frame_size);
+                board->next_frame += drop;
+        }
+        else if (step < 0) {
+                repeat = -step;
+        }
+
+        size_t avail = board_wait(board, period - repeat, deadline);
+        if (avail < period - repeat) {
+                // hold the last value rather than stall the cycle; the next
+                // cycles will catch up by dropping frames
+                rhd2k_log(driver->process_log, RHD2K_LOG_BOARD_LATE, first_frame, avail,
+                          0.0f, board->number, period - repeat - avail);
+                board->late += 1;
+                repeat = period - avail;
+        }
+        // repeat the last frame of the previous period
+        for (size_t t = 0; t < repeat; ++t) {
+                memmove(buf + t * frame_size, buf + (period - 1) * frame_size, frame_size);
+        }
+        jack_ringbuffer_read(board->ring, buf + repeat * frame_size, (period - repeat) * frame_size);
+        board->next_frame += period - repeat;
+        board->dropped += drop;
+        board->repeated += repeat;
+        if (drop > 1 || repeat > 1) {
+                rhd2k_log(driver->process_log, RHD2K_LOG_BOARD_ALIGN, first_frame, 0, offset,
+                          board->number, (drop) ? (long)drop : -(long)repeat);
+        }
+
+        if (driver->sync_bit >= 0) {
+                char const * fresh = buf + repeat * frame_size;
+                const size_t t = find_rising_edge(fresh, period - repeat, frame_size,
+                                                  driver->sync_bit, &board->sync_level);
+                if (t < period - repeat) {
+                        board->align->sync_edge(true, frame_timestamp(fresh + t * frame_size),
+                                                phase_offset, phase_valid);
+                }
+        }
+        return 0;
+}
+
+int
+rhd2k_boards_read(rhd2k_driver_t * driver, uint32_t first_frame)
+{
+        if (driver->boards.empty()) return 0;
+
+        if (driver->sync_bit >= 0) {
+                const size_t t = find_rising_edge(driver->buffer, driver->period_size,
+                                                  driver->dev->frame_size(), driver->sync_bit,
+                                                  &driver->sync_level);
+                if (t < driver->period_size) {
+                        std::vector<rhd2k_board_t *>::iterator b;
+                        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                                double phase_offset;
+                                const bool valid = board_phase_offset(driver, *b, &phase_offset);
+                                (*b)->align->sync_edge(false, first_frame + t, phase_offset, valid);
+                        }
+                }
+        }
+
+        // boards that are behind get a small part of the cycle to catch up
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(1e9 * rhd2k_board_wait_fraction * driver->period_size /
+                                   driver->dev->sampling_rate());
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                // the reason has been logged by the board's reader
+                if (board_read(driver, *b, first_frame, &deadline)) return -1;
+        }
+        return 0;
+}
+
+void
+rhd2k_boards_discard(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                const size_t frames = std::min<size_t>(
+                        driver->period_size,
+                        jack_ringbuffer_read_space((*b)->ring) / (*b)->dev->frame_size());
+                jack_ringbuffer_read_advance((*b)->ring, frames * (*b)->dev->frame_size());
+                (*b)->next_frame += frames;
+        }
+}
+
+void
+rhd2k_boards_reset(rhd2k_driver_t * driver)
+{
+        driver->sync_level = false;
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                (*b)->align->reset();
+        }
+}
+
+void
+rhd2k_boards_flush_logs(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_board_t *>::iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                char source[32];
+                sprintf(source, "board %zu", (*b)->number);
+                rhd2k_log_flush((*b)->log, source);
+        }
+}
+
+std::string
+rhd2k_boards_status(rhd2k_driver_t * driver)
+{
+        std::ostringstream o;
+        std::vector<rhd2k_board_t *>::const_iterator b;
+        for (b = driver->boards.begin(); b != driver->boards.end(); ++b) {
+                rhd2k_board_t const * board = *b;
+                o << "board " << board->number << " (" << board->serial << "): offset "
+                  << board->offset << " frames (" << ((board->align->synced()) ? "synced" : "estimated")
+                  << "), dropped " << board->dropped << ", repeated " << board->repeated
+                  << ", late " << board->late << ", xruns " << board->xruns << '\n';
+        }
+        return o.str();
+}
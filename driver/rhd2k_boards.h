@@ -0,0 +1,111 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Additional eval boards, for rigs with more channels than one board can
+ *   handle. The first board (driver->dev) drives the JACK cycle and handles
+ *   DACs, TTL outputs, and the control socket. Each additional board has
+ *   its own reader thread, which moves its data into a ring; after the
+ *   first board's period has been read, the process thread takes a period
+ *   from each ring, dropping or repeating frames to keep the boards aligned
+ *   (see rhd2000align.hpp for how the offsets are estimated and the policy
+ *   for correcting them). The channels of all the boards are exposed as one
+ *   set of capture ports; those of board n are prefixed with "b<n>_".
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_BOARDS_H
+#define __RHD2K_BOARDS_H
+
+#include <string>
+#include "jack_rhd2k_driver.h"
+
+/**
+ * How long the process thread waits for a late board, as a fraction of the
+ * period. It has already waited for the first board's period, so anything
+ * more eats into the clients' share of the cycle; frames that haven't
+ * arrived by then are filled by repeating the last one.
+ */
+static const double rhd2k_board_wait_fraction = 0.1;
+
+struct rhd2k_board_t {
+        rhd2k_driver_t * driver;
+        rhd2k::evalboard * dev;
+        std::string serial;
+        std::string prefix;             // for port names
+        size_t number;                  // the first board is 1
+        size_t first_port;              // index of its first capture port
+        void * buffer;                  // the current period
+
+        // reader thread
+        size_t transfer_size;
+        pthread_t reader_thread;
+        volatile bool reader_running;
+        jack_ringbuffer_t * ring;
+        void * reader_buffer;
+        sem_t reader_ready;
+        volatile int xrun_pending;      // set by reader, cleared by process thread
+        volatile int reader_error;
+        rhd2k_log_t * log;
+        rhd2k::clock_phase * phase;
+
+        // alignment, owned by the process thread
+        rhd2k::board_alignment * align;
+        uint32_t next_frame;            // timestamp of the next frame in the ring
+        bool sync_level;
+
+        // status, written by the process thread
+        volatile double offset;
+        volatile unsigned long dropped;
+        volatile unsigned long repeated;
+        volatile unsigned long late;    // cycles where the board had no data
+        volatile unsigned long xruns;
+};
+
+/** create the state for an additional board. returns 0 on failure */
+rhd2k_board_t * rhd2k_board_new(rhd2k_driver_t * driver, rhd2k::evalboard * dev,
+                                 char const * serial, size_t number);
+
+/** stop the reader thread if it's running, and free the board */
+void rhd2k_board_free(rhd2k_board_t * board);
+
+/** register ports and allocate buffers for all the boards */
+int rhd2k_boards_attach(rhd2k_driver_t * driver);
+
+void rhd2k_boards_detach(rhd2k_driver_t * driver);
+
+/** reallocate buffers after the period size changes */
+int rhd2k_boards_bufsize(rhd2k_driver_t * driver);
+
+/** start acquisition and the reader threads */
+int rhd2k_boards_start(rhd2k_driver_t * driver);
+
+/** stop the reader threads and acquisition */
+void rhd2k_boards_stop(rhd2k_driver_t * driver);
+
+/**
+ * Read one period from each board into its buffer, aligned with the first
+ * board's period in driver->buffer. Called from the process thread.
+ *
+ * @param first_frame  the timestamp of the first frame in driver->buffer
+ * @return 0 on success, -1 if a board has failed
+ */
+int rhd2k_boards_read(rhd2k_driver_t * driver, uint32_t first_frame);
+
+/** discard a period from each board */
+void rhd2k_boards_discard(rhd2k_driver_t * driver);
+
+/** forget the alignments, after the first board restarts */
+void rhd2k_boards_reset(rhd2k_driver_t * driver);
+
+/** emit messages logged by the reader threads */
+void rhd2k_boards_flush_logs(rhd2k_driver_t * driver);
+
+/** a line for each board, for the control socket's status command */
+std::string rhd2k_boards_status(rhd2k_driver_t * driver);
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Control socket for changing board settings while the engine is running.
+ *   Clients connect to a UNIX-domain socket and send one command per line;
+ *   each command is answered with zero or more lines of output followed by
+ *   "ok" or "error: <reason>". For example:
+ *
+ *     $ echo status | socat - UNIX-CONNECT:/tmp/rhd2000
+ *
+ *   Commands that change the board are passed to the worker thread through
+ *   a lock-free queue. Reprogramming amplifiers takes many USB transactions,
+ *   and the worker releases the device lock between them so that the
+ *   process thread never waits for more than one. Commands that only query
+ *   the board are run on the control thread.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sstream>
+
+#include "rhd2k_blank.h"
+#include "rhd2k_boards.h"
+#include "rhd2k_control.h"
+#include "rhd2k_worker.h"
+
+using std::size_t;
+using std::string;
+using namespace rhd2k;
+
+static const size_t max_line_length = 256;
+
+static void
+control_reply(int fd, string const & msg)
+{
+        size_t sent = 0;
+        while (sent < msg.size()) {
+                ssize_t ret = send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+                if (ret <= 0) return;
+                sent += ret;
+        }
+}
+
+static bool
+control_enqueue(rhd2k_driver_t * driver, int code, ulong arg1, ulong arg2=0)
+{
+        rhd2k_command_t cmd = { code, arg1, arg2 };
+        if (jack_ringbuffer_write_space(driver->commands) < sizeof(cmd)) {
+                return false;
+        }
+        jack_ringbuffer_write(driver->commands, (char const *)&cmd, sizeof(cmd));
+        rhd2k_worker_wake(driver);
+        return true;
+}
+
+/* look up a channel by its port name; returns -1 if not found */
+static long
+control_find_channel(rhd2k_driver_t * driver, char const * name)
+{
+        std::vector<evalboard::channel_info_t> const & table = driver->dev->adc_table();
+        for (size_t i = 0; i < table.size(); ++i) {
+                if (table[i].name == name) return i;
+        }
+        return -1;
+}
+
+static string
+control_status(rhd2k_driver_t * driver)
+{
+        std::ostringstream o;
+        rhd2k_stats_t const * stats = driver->stats;
+        o << "fifo: " << stats->fifo_frames << " frames (max " << stats->fifo_max << ")"
+          << "\nperiod: " << driver->period_size << " frames"
+          << "\nfifo latency: " << driver->fifo_latency << " frames"
+          << "\ncapture latency: " << driver->latency_min << "--" << driver->latency_max << " frames"
+          << "\nsampling rate: " << driver->dev->sampling_rate() << " Hz"
+          << "\nchannels: " << driver->dev->adc_channels()
+          << "\ncycles: " << stats->cycles
+          << "\ndelayed cycles: " << stats->delayed_cycles
+          << "\nxruns: " << stats->xruns << '\n'
+          << rhd2k_boards_status(driver);
+        return o.str();
+}
+
+static string
+control_info(rhd2k_driver_t * driver)
+{
+        std::ostringstream o;
+        pthread_mutex_lock(&driver->dev_lock);
+        o << *driver->dev << '\n';
+        pthread_mutex_unlock(&driver->dev_lock);
+        return o.str();
+}
+
+static char const * control_help =
+        "status                  counters and fifo state\n"
+        "info                    board and amplifier information\n"
+        "leds <hex>              set the eval board LEDs\n"
+        "ttl <hex> [mask]        set the TTL outputs\n"
+        "dac <0-7> <channel>     monitor a channel (e.g. A1_5) on a DAC\n"
+        "dac <0-7> off           disable a DAC\n"
+        "dac <0-7> auto          return a DAC to hardware monitoring\n"
+        "dac-gain <0-7> [clip]   set DAC gain (2**n V/V) and noise clip\n"
+        "power <A-D> <hex>       power down amplifiers on a port (channels and ports stay)\n"
+        "monitor <n> <mix>       set software monitor n (e.g. A1_0+0.5*A1_3@300:6000)\n"
+        "monitor <n> off         clear software monitor n\n";
+
+/* parse and execute one command. returns the reply to send */
+static string
+control_execute(rhd2k_driver_t * driver, char const * line)
+{
+        char cmd[32] = "", arg[64] = "";
+        ulong a1 = 0, a2 = 0;
+        int n = sscanf(line, "%31s", cmd);
+        if (n < 1) return "";
+
+        if (strcmp(cmd, "help") == 0) {
+                return string(control_help) + "ok\n";
+        }
+        else if (strcmp(cmd, "status") == 0) {
+                return control_status(driver) + "ok\n";
+        }
+        else if (strcmp(cmd, "info") == 0) {
+                return control_info(driver) + "ok\n";
+        }
+        else if (strcmp(cmd, "leds") == 0) {
+                if (sscanf(line, "%*s %lx", &a1) != 1 || a1 > 0xff)
+                        return "error: usage: leds <hex>\n";
+                if (!control_enqueue(driver, RHD2K_CMD_LEDS, a1))
+                        return "error: command queue full\n";
+        }
+        else if (strcmp(cmd, "ttl") == 0) {
+                a2 = 0xffff;
+                if (sscanf(line, "%*s %lx %lx", &a1, &a2) < 1 || a1 > 0xffff)
+                        return "error: usage: ttl <hex> [mask]\n";
+                if (!control_enqueue(driver, RHD2K_CMD_TTL_OUT, a1, a2))
+                        return "error: command queue full\n";
+        }
+        else if (strcmp(cmd, "dac") == 0) {
+                if (sscanf(line, "%*s %lu %63s", &a1, arg) != 2 || a1 >= evalboard::naux_dacs)
+                        return "error: usage: dac <0-7> <channel>|off|auto\n";
+                if (strcmp(arg, "off") == 0) {
+                        n = control_enqueue(driver, RHD2K_CMD_DAC_DISABLE, a1);
+                }
+                else if (strcmp(arg, "auto") == 0) {
+                        n = control_enqueue(driver, RHD2K_CMD_DAC_RELEASE, a1);
+                }
+                else {
+                        long chan = control_find_channel(driver, arg);
+                        if (chan < 0)
+                                return "error: no such channel\n";
+                        if (driver->dev->adc_table()[chan].stream == evalboard::EvalADC)
+                                return "error: eval board ADCs can't be monitored\n";
+                        if (driver->dev->twoscomp())
+                                return "error: DACs can't monitor two's complement samples\n";
+                        n = control_enqueue(driver, RHD2K_CMD_DAC_MONITOR, a1, chan);
+                }
+                if (!n) return "error: command queue full\n";
+        }
+        else if (strcmp(cmd, "dac-gain") == 0) {
+                if (sscanf(line, "%*s %lu %lu", &a1, &a2) < 1 || a1 > 7 || a2 > 127)
+                        return "error: usage: dac-gain <0-7> [clip]\n";
+                if (!control_enqueue(driver, RHD2K_CMD_DAC_CONFIGURE, a1, a2))
+                        return "error: command queue full\n";
+        }
+        else if (strcmp(cmd, "monitor") == 0) {
+                char spec[max_line_length];
+                string err;
+                if (sscanf(line, "%*s %lu %255s", &a1, spec) != 2 || a1 < 1)
+                        return "error: usage: monitor <n> <mix>|off\n";
+                if (a1 > driver->monitor_configs.size())
+                        return "error: no such monitor\n";
+                rhd2k_monitor_config_t config;
+                if (strcmp(spec, "off") == 0) {
+                        config.lowcut = config.highcut = 0;
+                }
+                else if (!rhd2k_monitor_parse_one(spec, *driver->dev, config, err)) {
+                        return "error: " + err + "\n";
+                }
+                driver->monitor_configs[a1 - 1] = config;
+                rhd2k_monitor_plan_t * plan =
+                        rhd2k_monitor_plan_new(driver->monitor_configs,
+                                               driver->capture_ports.size(),
+                                               driver->dev->sampling_rate());
+                if (!rhd2k_monitor_publish(driver, plan))
+                        return "error: monitor queue full\n";
+        }
+        else if (strcmp(cmd, "power") == 0) {
+                char port;
+                if (sscanf(line, "%*s %c %lx", &port, &a1) != 2 || port < 'A' || port > 'D')
+                        return "error: usage: power <A-D> <hex>\n";
+                // the streams and the channel table are fixed while running,
+                // so amplifiers that are off have no ports to power up
+                pthread_mutex_lock(&driver->dev_lock);
+                a2 = driver->dev->amp_power((evalboard::mosi_id)(port - 'A'));
+                pthread_mutex_unlock(&driver->dev_lock);
+                if (a1 & ~a2)
+                        return "error: amplifiers can only be powered down while running\n";
+                if (!control_enqueue(driver, RHD2K_CMD_AMP_POWER, port - 'A', a1))
+                        return "error: command queue full\n";
+        }
+        else {
+                return "error: unknown command (try 'help')\n";
+        }
+        return "ok\n";
+}
+
+/* serve a single client until it disconnects or the thread is stopped */
+static void
+control_serve(rhd2k_driver_t * driver, int fd)
+{
+        char buf[max_line_length];
+        size_t len = 0;
+        struct pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = driver->control_wakeup[0];
+        fds[1].events = POLLIN;
+
+        while (driver->control_running) {
+                if (poll(fds, 2, -1) < 0) {
+                        if (errno == EINTR) continue;
+                        break;
+                }
+                if (fds[1].revents) break;
+                ssize_t ret = recv(fd, buf + len, sizeof(buf) - len - 1, 0);
+                if (ret <= 0) break;
+                len += ret;
+                buf[len] = '\0';
+
+                char * start = buf;
+                char * eol;
+                while ((eol = strchr(start, '\n')) != 0) {
+                        *eol = '\0';
+                        control_reply(fd, control_execute(driver, start));
+                        start = eol + 1;
+                }
+                len -= (start - buf);
+                memmove(buf, start, len);
+                if (len == sizeof(buf) - 1) {
+                        control_reply(fd, "error: line too long\n");
+                        len = 0;
+                }
+        }
+}
+
+static void *
+control_thread(void * arg)
+{
+        rhd2k_driver_t * driver = static_cast<rhd2k_driver_t *>(arg);
+        struct pollfd fds[2];
+        fds[0].fd = driver->control_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = driver->control_wakeup[0];
+        fds[1].events = POLLIN;
+
+        while (driver->control_running) {
+                if (poll(fds, 2, -1) < 0) {
+                        if (errno == EINTR) continue;
+                        jack_error("RHD2K: control socket poll failed: %s", strerror(errno));
+                        break;
+                }
+                if (fds[1].revents) break;
+                int fd = accept(driver->control_fd, 0, 0);
+                if (fd < 0) continue;
+                control_serve(driver, fd);
+                close(fd);
+        }
+        return 0;
+}
+
+int
+rhd2k_control_start(rhd2k_driver_t * driver)
+{
+        struct sockaddr_un addr;
+
+        if (driver->control_path.empty()) return 0;
+        if (driver->control_path.size() >= sizeof(addr.sun_path)) {
+                jack_error("RHD2K: control socket path is too long");
+                return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, driver->control_path.c_str());
+
+        if ((driver->control_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+                jack_error("RHD2K: unable to create control socket: %s", strerror(errno));
+                return -1;
+        }
+        // remove stale socket from a previous instance
+        unlink(addr.sun_path);
+        if (bind(driver->control_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(driver->control_fd, 4) < 0) {
+                jack_error("RHD2K: unable to bind control socket %s: %s", addr.sun_path, strerror(errno));
+                close(driver->control_fd);
+                driver->control_fd = -1;
+                return -1;
+        }
+        if (pipe(driver->control_wakeup) < 0) {
+                jack_error("RHD2K: unable to create control pipe: %s", strerror(errno));
+                close(driver->control_fd);
+                driver->control_fd = -1;
+                return -1;
+        }
+
+        driver->control_running = true;
+        if (pthread_create(&driver->control_thread, 0, control_thread, driver) != 0) {
+                jack_error("RHD2K: unable to start control thread");
+                driver->control_running = false;
+                rhd2k_control_stop(driver);
+                return -1;
+        }
+        jack_info("RHD2K: listening for commands on %s", addr.sun_path);
+        return 0;
+}
+
+void
+rhd2k_control_stop(rhd2k_driver_t * driver)
+{
+        if (driver->control_fd < 0) return;
+        if (driver->control_running) {
+                driver->control_running = false;
+                if (write(driver->control_wakeup[1], "x", 1) < 0) {}
+                pthread_join(driver->control_thread, 0);
+        }
+        close(driver->control_wakeup[0]);
+        close(driver->control_wakeup[1]);
+        close(driver->control_fd);
+        unlink(driver->control_path.c_str());
+        driver->control_fd = -1;
+}
+
+/*
+ * reprogram the amplifiers on a port. The new register sequence is
+ * uploaded one command (two USB transactions) at a time, releasing the
+ * device lock in between.
+ */
+static void
+control_amp_power(rhd2k_driver_t * driver, evalboard::mosi_id port, ulong amp_power)
+{
+        std::vector<short> commands;
+        pthread_mutex_lock(&driver->dev_lock);
+        const bool changed = driver->dev->amp_power(port) != amp_power;
+        if (changed) driver->dev->command_amp_power(port, amp_power, commands);
+        rhd2k_blank_update(driver, true);
+        pthread_mutex_unlock(&driver->dev_lock);
+        for (size_t i = 0; i < commands.size(); ++i) {
+                pthread_mutex_lock(&driver->dev_lock);
+                driver->dev->set_auxcommand(evalboard::AuxCmd3, port, i, commands[i]);
+                pthread_mutex_unlock(&driver->dev_lock);
+        }
+        pthread_mutex_lock(&driver->dev_lock);
+        rhd2k_blank_update(driver, false);
+        pthread_mutex_unlock(&driver->dev_lock);
+        jack_info("RHD2K: port %c amplifier power set to 0x%lx", 'A' + port, amp_power);
+}
+
+void
+rhd2k_control_apply(rhd2k_driver_t * driver)
+{
+        rhd2k_command_t cmd;
+        while (jack_ringbuffer_read_space(driver->commands) >= sizeof(cmd)) {
+                jack_ringbuffer_read(driver->commands, (char *)&cmd, sizeof(cmd));
+                if (cmd.code == RHD2K_CMD_AMP_POWER) {
+                        control_amp_power(driver, (evalboard::mosi_id)cmd.arg1, cmd.arg2);
+                        continue;
+                }
+                pthread_mutex_lock(&driver->dev_lock);
+                switch (cmd.code) {
+                case RHD2K_CMD_LEDS:
+                        driver->dev->set_leds(cmd.arg1);
+                        break;
+                case RHD2K_CMD_TTL_OUT:
+                        driver->dev->ttl_out(cmd.arg1, cmd.arg2);
+                        break;
+                case RHD2K_CMD_DAC_MONITOR:
+                        driver->dev->dac_monitor(cmd.arg1, cmd.arg2);
+                        driver->dac_pinned |= 1UL << cmd.arg1;
+                        driver->dac_channel[cmd.arg1] = -1;
+                        break;
+                case RHD2K_CMD_DAC_DISABLE:
+                        driver->dev->dac_disable(cmd.arg1);
+                        driver->dac_pinned |= 1UL << cmd.arg1;
+                        driver->dac_channel[cmd.arg1] = -1;
+                        break;
+                case RHD2K_CMD_DAC_RELEASE:
+                        driver->dac_pinned &= ~(1UL << cmd.arg1);
+                        driver->monitor_dirty = 1;
+                        break;
+                case RHD2K_CMD_DAC_CONFIGURE:
+                        driver->dev->dac_configure(cmd.arg1, cmd.arg2);
+                        break;
+                }
+                pthread_mutex_unlock(&driver->dev_lock);
+        }
+}
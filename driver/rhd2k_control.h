@@ -0,0 +1,56 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Control socket for changing board settings while the engine is running.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_CONTROL_H
+#define __RHD2K_CONTROL_H
+
+#include "jack_rhd2k_driver.h"
+
+/** commands passed from the control thread to the worker thread */
+enum rhd2k_command_code {
+        RHD2K_CMD_LEDS = 1,     // arg1 = value
+        RHD2K_CMD_TTL_OUT,      // arg1 = value, arg2 = mask
+        RHD2K_CMD_DAC_MONITOR,  // arg1 = dac, arg2 = channel index
+        RHD2K_CMD_DAC_DISABLE,  // arg1 = dac
+        RHD2K_CMD_DAC_RELEASE,  // arg1 = dac; return to hardware monitoring
+        RHD2K_CMD_DAC_CONFIGURE, // arg1 = gain, arg2 = noise clip
+        RHD2K_CMD_AMP_POWER     // arg1 = port, arg2 = power mask
+};
+
+/** fixed-size record so that commands can be passed through a ringbuffer */
+struct rhd2k_command_t {
+        int code;
+        ulong arg1;
+        ulong arg2;
+};
+
+/** capacity of the command queue */
+static const size_t rhd2k_command_queue_size = 64;
+
+/**
+ * Open the control socket at driver->control_path and start the thread that
+ * serves it. Does nothing if control_path is empty.
+ *
+ * @return 0 on success, nonzero if the socket couldn't be created
+ */
+int rhd2k_control_start(rhd2k_driver_t * driver);
+
+/** Stop the control thread and remove the socket */
+void rhd2k_control_stop(rhd2k_driver_t * driver);
+
+/**
+ * Apply any queued commands to the device. Called from the worker thread,
+ * which must not hold dev_lock; it's taken for each USB transaction.
+ */
+void rhd2k_control_apply(rhd2k_driver_t * driver);
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Triggered capture.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <jack/midiport.h>
+
+#include "rhd2000frame.hpp"
+#include "rhd2k_epochs.h"
+
+using std::size_t;
+using std::string;
+using namespace rhd2k;
+
+static char const * const source_names[] = { "ttl", "midi" };
+
+rhd2k_epochs_t *
+rhd2k_epochs_new(char const * spec, char const * dir, evalboard const & dev, string & err)
+{
+        int ttl_bit;
+        double pre_ms, post_ms;
+        char extra;
+        if (sscanf(spec, "%d,%lf,%lf%c", &ttl_bit, &pre_ms, &post_ms, &extra) != 3) {
+                err = "expected <ttl>,<pre ms>,<post ms>";
+                return 0;
+        }
+        if (ttl_bit < -1 || ttl_bit > 15) {
+                err = "trigger input must be between 0 and 15, or -1";
+                return 0;
+        }
+        if (pre_ms < 0 || post_ms <= 0) {
+                err = "window must have a positive length";
+                return 0;
+        }
+
+        rhd2k_epochs_t * e = new rhd2k_epochs_t;
+        const size_t rate = dev.sampling_rate();
+        e->ttl_bit = ttl_bit;
+        e->pre = pre_ms * 1e-3 * rate;
+        e->post = std::max<size_t>(1, post_ms * 1e-3 * rate);
+        e->dir = dir;
+        e->frame_size = dev.frame_size();
+        e->sampling_rate = rate;
+        // a second of slack for the writer; grown to fit the period on attach
+        e->capacity = e->pre + e->post + rate;
+        e->ring = static_cast<char *>(malloc(e->capacity * e->frame_size));
+        e->write_pos = 0;
+        e->port = 0;
+        e->ttl_edges = rising_edges(std::max(ttl_bit, 0));
+        e->triggers = jack_ringbuffer_create(rhd2k_epochs_max_pending * sizeof(rhd2k_trigger_t));
+        e->running = false;
+        e->index = 0;
+        e->count = e->lost = e->dropped = 0;
+        sem_init(&e->wakeup, 0, 0);
+        if (e->ring == 0 || e->triggers == 0) {
+                err = "unable to allocate capture ring";
+                rhd2k_epochs_free(e);
+                return 0;
+        }
+        // the process thread writes the ring in every cycle
+        mlock(e->ring, e->capacity * e->frame_size);
+        jack_ringbuffer_mlock(e->triggers);
+
+        const string channels_path = e->dir + "/channels.txt";
+        FILE * channels = fopen(channels_path.c_str(), "w");
+        e->index = fopen((e->dir + "/epochs.txt").c_str(), "a");
+        if (channels == 0 || e->index == 0) {
+                err = "unable to create files in " + e->dir + ": " + strerror(errno);
+                if (channels) fclose(channels);
+                rhd2k_epochs_free(e);
+                return 0;
+        }
+        fprintf(channels, "# frame_size %zu sampling_rate %zu\n", e->frame_size, rate);
+        std::vector<evalboard::channel_info_t>::const_iterator it;
+        for (it = dev.adc_table().begin(); it != dev.adc_table().end(); ++it) {
+                fprintf(channels, "%s %zu\n", it->name.c_str(), it->byte_offset);
+        }
+        fclose(channels);
+        fprintf(e->index, "# epoch trigger_frame source first_frame nframes\n");
+        fflush(e->index);
+        return e;
+}
+
+void
+rhd2k_epochs_free(rhd2k_epochs_t * e)
+{
+        if (e == 0) return;
+        free(e->ring);
+        if (e->triggers) jack_ringbuffer_free(e->triggers);
+        if (e->index) fclose(e->index);
+        sem_destroy(&e->wakeup);
+        delete e;
+}
+
+/*
+ * true if the frames from start on can't have been overwritten, or be
+ * overwritten by the period the process thread is copying
+ */
+static bool
+epochs_intact(rhd2k_epochs_t const * e, uint64_t start, size_t period)
+{
+        return e->write_pos + period <= start + e->capacity;
+}
+
+/* save the window around a trigger. Called by the writer thread */
+static void
+epochs_save(rhd2k_epochs_t * e, rhd2k_trigger_t const & trigger, size_t period)
+{
+        const uint64_t start = (trigger.frame >= e->pre) ? trigger.frame - e->pre : 0;
+        const size_t nframes = trigger.frame + e->post - start;
+        const unsigned long number = e->count + e->lost;
+        char name[32];
+        sprintf(name, "/epoch_%06lu.dat", number);
+        const string path = e->dir + name;
+
+        if (!epochs_intact(e, start, period)) {
+                e->lost += 1;
+                jack_error("RHD2K: capture %lu was overwritten before it could be saved", number);
+                return;
+        }
+        const size_t slot = start % e->capacity;
+        const size_t n1 = std::min<size_t>(nframes, e->capacity - slot);
+        char const * first = e->ring + slot * e->frame_size;
+        const uint32_t first_frame = frame_timestamp(first);
+        FILE * fp = fopen(path.c_str(), "w");
+        bool ok = (fp != 0 &&
+                   fwrite(first, e->frame_size, n1, fp) == n1 &&
+                   fwrite(e->ring, e->frame_size, nframes - n1, fp) == nframes - n1);
+        if (fp && fclose(fp) != 0) ok = false;
+        if (!ok) {
+                e->lost += 1;
+                jack_error("RHD2K: unable to write %s: %s", path.c_str(), strerror(errno));
+                unlink(path.c_str());
+                return;
+        }
+        __sync_synchronize();
+        if (!epochs_intact(e, start, period)) {
+                e->lost += 1;
+                jack_error("RHD2K: capture %lu was overwritten while it was being saved", number);
+                unlink(path.c_str());
+                return;
+        }
+        e->count += 1;
+        fprintf(e->index, "%lu %u %s %u %zu\n", number, trigger.timestamp,
+                source_names[trigger.source], first_frame, nframes);
+        fflush(e->index);
+}
+
+static void *
+epochs_thread(void * arg)
+{
+        rhd2k_driver_t * driver = static_cast<rhd2k_driver_t *>(arg);
+        rhd2k_epochs_t * e = driver->epochs;
+        unsigned long dropped = 0;
+        while (e->running) {
+                sem_wait(&e->wakeup);
+                // one pass for all the periods since the last
+                while (sem_trywait(&e->wakeup) == 0) {}
+                if (!e->running) break;
+
+                rhd2k_trigger_t trigger;
+                while (jack_ringbuffer_read_space(e->triggers) >= sizeof(trigger)) {
+                        jack_ringbuffer_read(e->triggers, (char *)&trigger, sizeof(trigger));
+                        e->pending.push_back(trigger);
+                }
+                const uint64_t written = e->write_pos;
+                std::list<rhd2k_trigger_t>::iterator it = e->pending.begin();
+                while (it != e->pending.end()) {
+                        if (it->frame + e->post > written) {
+                                ++it;
+                                continue;
+                        }
+                        epochs_save(e, *it, driver->period_size);
+                        it = e->pending.erase(it);
+                }
+                if (e->dropped != dropped) {
+                        jack_error("RHD2K: %lu capture triggers dropped (queue full)",
+                                   e->dropped - dropped);
+                        dropped = e->dropped;
+                }
+        }
+        return 0;
+}
+
+static int
+epochs_start_writer(rhd2k_driver_t * driver)
+{
+        rhd2k_epochs_t * e = driver->epochs;
+        e->running = true;
+        if (pthread_create(&e->thread, 0, epochs_thread, driver) != 0) {
+                jack_error("RHD2K: unable to start capture writer thread");
+                e->running = false;
+                return -1;
+        }
+        return 0;
+}
+
+static void
+epochs_stop_writer(rhd2k_epochs_t * e)
+{
+        e->running = false;
+        sem_post(&e->wakeup);
+        pthread_join(e->thread, 0);
+}
+
+/* the window, the writer's slack, and the period being copied */
+static size_t
+epochs_capacity(rhd2k_epochs_t const * e, size_t period)
+{
+        return e->pre + e->post + e->sampling_rate + period;
+}
+
+/*
+ * grow the ring for a period, keeping the frames that are already in it at
+ * their positions. The process and writer threads must not be running.
+ */
+static int
+epochs_resize(rhd2k_epochs_t * e, size_t period)
+{
+        const size_t capacity = epochs_capacity(e, period);
+        if (capacity <= e->capacity) return 0;
+        const size_t fs = e->frame_size;
+        char * ring = static_cast<char *>(malloc(capacity * fs));
+        if (ring == 0) {
+                jack_error("RHD2K: unable to allocate capture ring for %zu frames", capacity);
+                return -1;
+        }
+        mlock(ring, capacity * fs);
+        const uint64_t end = e->write_pos;
+        for (uint64_t pos = end - std::min<uint64_t>(end, e->capacity); pos < end; ++pos) {
+                memcpy(ring + (pos % capacity) * fs, e->ring + (pos % e->capacity) * fs, fs);
+        }
+        munlock(e->ring, e->capacity * fs);
+        free(e->ring);
+        e->ring = ring;
+        e->capacity = capacity;
+        return 0;
+}
+
+int
+rhd2k_epochs_attach(rhd2k_driver_t * driver)
+{
+        rhd2k_epochs_t * e = driver->epochs;
+        if (e == 0) return 0;
+        e->port = jack_port_register (driver->client, "trigger", JACK_DEFAULT_MIDI_TYPE,
+                                      JackPortIsInput|JackPortIsTerminal, 0);
+        if (e->port == 0) {
+                jack_error ("RHD2K: cannot register port for trigger");
+                return -1;
+        }
+        if (epochs_resize(e, driver->period_size)) return -1;
+        return epochs_start_writer(driver);
+}
+
+void
+rhd2k_epochs_detach(rhd2k_driver_t * driver)
+{
+        rhd2k_epochs_t * e = driver->epochs;
+        if (e == 0) return;
+        if (e->running) {
+                epochs_stop_writer(e);
+                if (!e->pending.empty())
+                        jack_info("RHD2K: %zu captures were not complete", e->pending.size());
+                e->pending.clear();
+                jack_info("RHD2K: saved %lu captures in %s (%lu lost)", e->count,
+                          e->dir.c_str(), e->lost);
+        }
+        if (e->port) {
+                jack_port_unregister (driver->client, e->port);
+                e->port = 0;
+        }
+}
+
+int
+rhd2k_epochs_bufsize(rhd2k_driver_t * driver)
+{
+        rhd2k_epochs_t * e = driver->epochs;
+        if (e == 0) return 0;
+        if (epochs_capacity(e, driver->period_size) <= e->capacity) return 0;
+        // the writer may be saving from the old ring
+        const bool running = e->running;
+        if (running) epochs_stop_writer(e);
+        if (epochs_resize(e, driver->period_size)) return -1;
+        return running ? epochs_start_writer(driver) : 0;
+}
+
+/* queue a trigger for the writer. Called by the process thread */
+static void
+epochs_trigger(rhd2k_epochs_t * e, uint64_t frame, uint32_t timestamp, int source)
+{
+        rhd2k_trigger_t trigger = { frame, timestamp, source };
+        if (jack_ringbuffer_write_space(e->triggers) < sizeof(trigger)) {
+                __sync_fetch_and_add(&e->dropped, 1UL);
+                return;
+        }
+        jack_ringbuffer_write(e->triggers, (char const *)&trigger, sizeof(trigger));
+}
+
+/* queue a trigger for each rising edge on the TTL input */
+struct epochs_ttl_trigger {
+        rhd2k_epochs_t * e;
+        uint64_t pos;           // of the first frame in buf
+        char const * buf;
+        void operator()(size_t t) const {
+                epochs_trigger(e, pos + t, frame_timestamp(buf + t * e->frame_size),
+                               RHD2K_TRIGGER_TTL);
+        }
+};
+
+void
+rhd2k_epochs_read(rhd2k_driver_t * driver, jack_nframes_t nframes)
+{
+        rhd2k_epochs_t * e = driver->epochs;
+        if (e == 0) return;
+        const size_t fs = e->frame_size;
+        char const * buf = static_cast<char const *>(driver->buffer);
+        const uint64_t pos = e->write_pos;
+        // the ring is sized for the period, but only the end of a longer
+        // one would fit
+        const size_t skip = (nframes > e->capacity) ? nframes - e->capacity : 0;
+        const size_t count = nframes - skip;
+        const size_t slot = (pos + skip) % e->capacity;
+        const size_t n1 = std::min<size_t>(count, e->capacity - slot);
+        memcpy(e->ring + slot * fs, buf + skip * fs, n1 * fs);
+        memcpy(e->ring, buf + (skip + n1) * fs, (count - n1) * fs);
+
+        if (e->ttl_bit >= 0) {
+                const epochs_ttl_trigger trigger = { e, pos, buf };
+                e->ttl_edges.scan(buf, nframes, fs, trigger);
+        }
+        __sync_synchronize();
+        e->write_pos = pos + nframes;
+        sem_post(&e->wakeup);
+}
+
+void
+rhd2k_epochs_write(rhd2k_driver_t * driver, jack_nframes_t nframes)
+{
+        rhd2k_epochs_t * e = driver->epochs;
+        if (e == 0) return;
+        void * port_buf = jack_port_get_buffer (e->port, nframes);
+        const uint32_t nevents = jack_midi_get_event_count(port_buf);
+        if (nevents == 0) return;
+
+        // the events are timed relative to the period that was just read
+        const uint64_t period_start = e->write_pos - nframes;
+        char const * buf = static_cast<char const *>(driver->buffer);
+        jack_midi_event_t ev;
+        for (uint32_t i = 0; i < nevents; ++i) {
+                if (jack_midi_event_get(&ev, port_buf, i) || ev.size < 3) continue;
+                if ((ev.buffer[0] & 0xf0) != 0x90 || ev.buffer[2] == 0) continue;
+                const jack_nframes_t t = std::min<jack_nframes_t>(ev.time, nframes - 1);
+                epochs_trigger(e, period_start + t, frame_timestamp(buf + t * e->frame_size),
+                               RHD2K_TRIGGER_MIDI);
+        }
+        sem_post(&e->wakeup);
+}
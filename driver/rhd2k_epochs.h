@@ -0,0 +1,107 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Triggered capture. For experiments that only need a window around each
+ *   stimulus, the process thread copies every period of raw frames from
+ *   the first board into a preallocated ring, and a trigger (a rising edge
+ *   on a TTL input, or a note on event on the trigger MIDI port) marks a
+ *   frame. Once the frames after the trigger have arrived, a writer thread
+ *   saves the window around it straight from the ring to a file, so
+ *   overlapping windows share the ring rather than being copied. The ring
+ *   holds the window plus a second of slack for the writer and a period,
+ *   and is grown when the period changes. At most
+ *   rhd2k_epochs_max_pending triggers can wait to be written, so memory
+ *   use doesn't grow with the trigger rate; windows that are overwritten
+ *   before they can be saved, or triggers that arrive when the queue is
+ *   full, are counted and logged.
+ *
+ *   Each window is saved as raw frames in <dir>/epoch_NNNNNN.dat. The
+ *   channels (name and byte offset in the frame) are listed in
+ *   <dir>/channels.txt, and each window gets a line in <dir>/epochs.txt.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_EPOCHS_H
+#define __RHD2K_EPOCHS_H
+
+#include <stdio.h>
+#include <list>
+#include <string>
+#include "jack_rhd2k_driver.h"
+
+static const size_t rhd2k_epochs_max_pending = 256;
+
+enum rhd2k_trigger_source_t {
+        RHD2K_TRIGGER_TTL = 0,
+        RHD2K_TRIGGER_MIDI
+};
+
+/** a trigger, from the process thread to the writer */
+struct rhd2k_trigger_t {
+        uint64_t frame;         // index in the ring's frame count
+        uint32_t timestamp;     // of the triggering frame
+        int source;
+};
+
+struct rhd2k_epochs_t {
+        int ttl_bit;                    // or -1 for MIDI triggers only
+        size_t pre;                     // frames before the trigger
+        size_t post;                    // frames from the trigger on
+        std::string dir;
+
+        // ring of raw frames, written by the process thread. write_pos
+        // counts the frames written since the ring was created.
+        size_t frame_size;
+        size_t sampling_rate;
+        size_t capacity;
+        char * ring;
+        volatile uint64_t write_pos;
+
+        // process thread state
+        jack_port_t * port;             // MIDI trigger port
+        rhd2k::rising_edges ttl_edges;
+        jack_ringbuffer_t * triggers;
+
+        // writer thread
+        pthread_t thread;
+        sem_t wakeup;
+        volatile bool running;
+        std::list<rhd2k_trigger_t> pending;
+        FILE * index;
+        unsigned long count;            // windows saved
+        unsigned long lost;             // overwritten before they were saved
+        volatile unsigned long dropped; // trigger queue was full
+};
+
+/**
+ * Parse a capture specification, "<ttl>,<pre ms>,<post ms>", where ttl is
+ * the TTL input (0-15) that triggers a capture, or -1 for MIDI triggers
+ * only, and allocate the ring.
+ *
+ * @return the new state, or 0 if the spec was bad (err contains the reason)
+ */
+rhd2k_epochs_t * rhd2k_epochs_new(char const * spec, char const * dir,
+                                  rhd2k::evalboard const & dev, std::string & err);
+
+void rhd2k_epochs_free(rhd2k_epochs_t * epochs);
+
+/** register the trigger port and start the writer thread */
+int rhd2k_epochs_attach(rhd2k_driver_t * driver);
+
+void rhd2k_epochs_detach(rhd2k_driver_t * driver);
+
+/** grow the ring for a new period. The process thread must be stopped */
+int rhd2k_epochs_bufsize(rhd2k_driver_t * driver);
+
+/** copy the period into the ring and look for TTL triggers */
+void rhd2k_epochs_read(rhd2k_driver_t * driver, jack_nframes_t nframes);
+
+/** look for MIDI triggers in the period that was just read */
+void rhd2k_epochs_write(rhd2k_driver_t * driver, jack_nframes_t nframes);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Logging from realtime threads.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <stdlib.h>
+
+#include "rhd2000frame.hpp"
+#include "jack_rhd2k_driver.h"
+#include "rhd2k_log.h"
+
+rhd2k_log_t *
+rhd2k_log_new()
+{
+        rhd2k_log_t * log = new rhd2k_log_t;
+        log->dropped = 0;
+        log->ring = jack_ringbuffer_create(rhd2k_log_size * sizeof(rhd2k_log_record_t));
+        if (log->ring == 0) {
+                delete log;
+                return 0;
+        }
+        jack_ringbuffer_mlock(log->ring);
+        return log;
+}
+
+void
+rhd2k_log_free(rhd2k_log_t * log)
+{
+        if (log == 0) return;
+        jack_ringbuffer_free(log->ring);
+        delete log;
+}
+
+static void
+log_emit(rhd2k_log_record_t const & r, char const * source)
+{
+        switch (r.code) {
+        case RHD2K_LOG_FIFO:
+                jack_info("RHD2K: %s: frame %u: fifo = %u", source, r.frame, r.fifo);
+                break;
+        case RHD2K_LOG_DELAYED:
+                jack_info("RHD2K: %s: frame %u: delayed cycle (%ld frames)", source, r.frame, r.value);
+                break;
+        case RHD2K_LOG_UNDERFULL:
+                jack_info("RHD2K: %s: frame %u: underfull FIFO: first bad frame: %ld (%s)",
+                          source, r.frame, r.value,
+                          rhd2k::frame_fault_name(static_cast<rhd2k::frame_fault>(r.detail)));
+                break;
+        case RHD2K_LOG_OVERFLOW:
+                jack_info("RHD2K: %s: frame %u: frame ring full", source, r.frame);
+                break;
+        case RHD2K_LOG_XRUN:
+                jack_error("RHD2K: %s: frame %u: xrun of %.3f usec (fifo = %u)",
+                           source, r.frame, r.usecs, r.fifo);
+                break;
+        case RHD2K_LOG_READ_ERROR:
+                jack_error("RHD2K: %s: frame %u: error reading data from device",
+                           source, r.frame);
+                break;
+        case RHD2K_LOG_STOPPED:
+                jack_error("RHD2K: %s: frame %u: device is not running or was disconnected",
+                           source, r.frame);
+                break;
+        case RHD2K_LOG_TIMEOUT:
+                jack_error("RHD2K: %s: frame %u: timed out waiting for data", source, r.frame);
+                break;
+        case RHD2K_LOG_NULL_CYCLE:
+                jack_info("RHD2K: %s: frame %u: null cycle", source, r.frame);
+                break;
+        case RHD2K_LOG_BOARD_XRUN:
+                jack_error("RHD2K: %s: frame %u: board %ld restarted", source, r.frame, r.value);
+                break;
+        case RHD2K_LOG_BOARD_LATE:
+                jack_info("RHD2K: %s: frame %u: board %ld late; held %d frames",
+                          source, r.frame, r.value, r.detail);
+                break;
+        case RHD2K_LOG_BOARD_ALIGN:
+                jack_info("RHD2K: %s: frame %u: board %ld offset %.1f; %s %d frames",
+                          source, r.frame, r.value, r.usecs,
+                          (r.detail > 0) ? "dropped" : "repeated", abs(r.detail));
+                break;
+        case RHD2K_LOG_MIDI_FULL:
+                jack_error("RHD2K: %s: frame %u: MIDI buffer full; dropped %ld events",
+                           source, r.frame, r.value);
+                break;
+        case RHD2K_LOG_START_FAILED:
+                jack_error("RHD2K: %s: frame %u: failed to start acquisition", source, r.frame);
+                break;
+        case RHD2K_LOG_STOP_FAILED:
+                jack_error("RHD2K: %s: frame %u: failed to stop acquisition", source, r.frame);
+                break;
+        default:
+                jack_error("RHD2K: %s: unknown log record %d", source, r.code);
+        }
+}
+
+void
+rhd2k_log_flush(rhd2k_log_t * log, char const * source)
+{
+        rhd2k_log_record_t rec;
+        if (log == 0) return;
+        while (jack_ringbuffer_read_space(log->ring) >= sizeof(rec)) {
+                jack_ringbuffer_read(log->ring, (char *)&rec, sizeof(rec));
+                log_emit(rec, source);
+        }
+        const unsigned long dropped = __sync_fetch_and_and(&log->dropped, 0UL);
+        if (dropped) {
+                jack_error("RHD2K: %s: %lu log records dropped", source, dropped);
+        }
+}
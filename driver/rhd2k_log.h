@@ -0,0 +1,86 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Logging from realtime threads. jack_info and jack_error format strings
+ *   and may block, so realtime threads instead write fixed-size records into
+ *   a lock-free ring. The worker thread formats and emits them.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_LOG_H
+#define __RHD2K_LOG_H
+
+#include <stdint.h>
+#include <jack/ringbuffer.h>
+
+/** number of records each log can hold before records are dropped */
+static const size_t rhd2k_log_size = 256;
+
+enum rhd2k_log_code {
+        RHD2K_LOG_FIFO = 1,     // periodic FIFO fill report (debug)
+        RHD2K_LOG_DELAYED,      // cycle started late; value = excess frames
+        RHD2K_LOG_UNDERFULL,    // bad frame in FIFO; value = first bad frame,
+                                // detail = rhd2k::frame_fault
+        RHD2K_LOG_OVERFLOW,     // reader thread's frame ring is full
+        RHD2K_LOG_XRUN,         // acquisition restarted
+        RHD2K_LOG_READ_ERROR,   // USB read failed (fatal unless the reader restarts)
+        RHD2K_LOG_STOPPED,      // device is not running or was disconnected
+        RHD2K_LOG_TIMEOUT,      // no data from the reader thread
+        RHD2K_LOG_NULL_CYCLE,
+        RHD2K_LOG_BOARD_XRUN,   // an additional board restarted; value = board
+        RHD2K_LOG_BOARD_LATE,   // board had too few frames; value = board,
+                                // detail = frames held
+        RHD2K_LOG_BOARD_ALIGN,  // value = board, usecs = offset in frames,
+                                // detail = frames dropped
+                                // (positive) or repeated (negative)
+        RHD2K_LOG_MIDI_FULL,    // MIDI port buffer full; value = events dropped
+        RHD2K_LOG_START_FAILED, // acquisition could not be restarted
+        RHD2K_LOG_STOP_FAILED   // acquisition could not be stopped
+};
+
+/** a log entry. Which fields are meaningful depends on the code. */
+struct rhd2k_log_record_t {
+        int code;
+        uint32_t frame;         // frame counter at the time of the event
+        uint32_t fifo;          // FIFO fill, in frames
+        float usecs;            // duration
+        long value;
+        int detail;
+};
+
+/** a single-producer, single-consumer log */
+struct rhd2k_log_t {
+        jack_ringbuffer_t * ring;
+        volatile unsigned long dropped;
+};
+
+/** allocate a log. returns 0 if memory could not be allocated */
+rhd2k_log_t * rhd2k_log_new();
+
+void rhd2k_log_free(rhd2k_log_t * log);
+
+/**
+ * Format and emit all the records in a log. Called from one non-realtime
+ * thread. source identifies the producer in messages.
+ */
+void rhd2k_log_flush(rhd2k_log_t * log, char const * source);
+
+/** Add a record to the log. Safe to call from a realtime thread. */
+inline void
+rhd2k_log(rhd2k_log_t * log, int code, uint32_t frame, size_t fifo,
+          float usecs = 0.0f, long value = 0, int detail = 0)
+{
+        rhd2k_log_record_t rec = { code, frame, (uint32_t)fifo, usecs, value, detail };
+        if (jack_ringbuffer_write_space(log->ring) < sizeof(rec)) {
+                __sync_fetch_and_add(&log->dropped, 1UL);
+                return;
+        }
+        jack_ringbuffer_write(log->ring, (char const *)&rec, sizeof(rec));
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Software monitoring: output ports that carry a weighted, optionally
+ *   band-limited sum of amplifier channels. The eval board only has 8 DACs,
+ *   and changing their sources takes a USB round trip, so mixing in software
+ *   supports many more monitors and can be reconfigured without touching
+ *   the board.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "jack_rhd2k_driver.h"
+#include "rhd2k_monitor.h"
+
+using std::size_t;
+using std::string;
+using namespace rhd2k;
+
+static const double Pi = 2*acos(0.0);
+
+static long
+monitor_find_channel(evalboard const & dev, string const & name)
+{
+        std::vector<evalboard::channel_info_t> const & table = dev.adc_table();
+        for (size_t i = 0; i < table.size(); ++i) {
+                if (table[i].name == name) return i;
+        }
+        return -1;
+}
+
+bool
+rhd2k_monitor_parse_one(char const * spec, evalboard const & dev,
+                        rhd2k_monitor_config_t & out, string & err)
+{
+        string s(spec);
+        out.taps.clear();
+        out.lowcut = out.highcut = 0;
+
+        size_t at = s.find('@');
+        if (at != string::npos) {
+                char const * band = s.c_str() + at + 1;
+                char * end;
+                out.lowcut = strtod(band, &end);
+                if (*end != ':') {
+                        err = "passband should be <low>:<high>";
+                        return false;
+                }
+                out.highcut = strtod(end + 1, &end);
+                if (*end != '\0' || out.lowcut < 0 || out.highcut < 0 ||
+                    (out.highcut > 0 && out.lowcut >= out.highcut) ||
+                    out.highcut >= dev.sampling_rate() / 2.0) {
+                        err = "invalid passband";
+                        return false;
+                }
+                s.erase(at);
+        }
+
+        size_t pos = 0;
+        while (pos < s.size()) {
+                size_t plus = s.find('+', pos);
+                if (plus == string::npos) plus = s.size();
+                string term = s.substr(pos, plus - pos);
+                rhd2k_monitor_tap_t tap = { 0, 1.0f };
+
+                size_t star = term.find('*');
+                if (star != string::npos) {
+                        char * end;
+                        tap.gain = strtod(term.c_str(), &end);
+                        if (end != term.c_str() + star) {
+                                err = "invalid gain in '" + term + "'";
+                                return false;
+                        }
+                        term.erase(0, star + 1);
+                }
+                long chan = monitor_find_channel(dev, term);
+                if (chan < 0) {
+                        err = "no such channel '" + term + "'";
+                        return false;
+                }
+                tap.index = chan;
+                out.taps.push_back(tap);
+                pos = plus + 1;
+        }
+        return true;
+}
+
+bool
+rhd2k_monitor_parse(char const * spec, evalboard const & dev,
+                    std::vector<rhd2k_monitor_config_t> & out, string & err)
+{
+        char * end;
+        out.clear();
+        long n = strtol(spec, &end, 10);
+        if (*end == '\0') {
+                if (n < 0 || n > (long)rhd2k_max_monitors) {
+                        err = "too many monitors";
+                        return false;
+                }
+                rhd2k_monitor_config_t empty;
+                empty.lowcut = empty.highcut = 0;
+                out.assign(n, empty);
+                return true;
+        }
+
+        string s(spec);
+        size_t pos = 0;
+        while (pos < s.size()) {
+                size_t semi = s.find(';', pos);
+                if (semi == string::npos) semi = s.size();
+                rhd2k_monitor_config_t config;
+                if (!rhd2k_monitor_parse_one(s.substr(pos, semi - pos).c_str(), dev, config, err)) {
+                        return false;
+                }
+                out.push_back(config);
+                pos = semi + 1;
+        }
+        if (out.size() > rhd2k_max_monitors) {
+                err = "too many monitors";
+                return false;
+        }
+        return true;
+}
+
+/* second-order butterworth sections (see RBJ's audio EQ cookbook) */
+static rhd2k_biquad_t
+biquad_design(double cutoff, double sampling_rate, bool highpass)
+{
+        rhd2k_biquad_t f;
+        memset(&f, 0, sizeof(f));
+        if (cutoff <= 0) {
+                f.b0 = 1.0f;
+                return f;
+        }
+        const double w0 = 2 * Pi * cutoff / sampling_rate;
+        const double cosw = cos(w0);
+        const double alpha = sin(w0) / (2 * M_SQRT1_2);
+        const double a0 = 1 + alpha;
+        if (highpass) {
+                f.b0 = (1 + cosw) / 2 / a0;
+                f.b1 = -(1 + cosw) / a0;
+        }
+        else {
+                f.b0 = (1 - cosw) / 2 / a0;
+                f.b1 = (1 - cosw) / a0;
+        }
+        f.b2 = f.b0;
+        f.a1 = -2 * cosw / a0;
+        f.a2 = (1 - alpha) / a0;
+        return f;
+}
+
+rhd2k_monitor_plan_t *
+rhd2k_monitor_plan_new(std::vector<rhd2k_monitor_config_t> const & configs,
+                       size_t nchannels, double sampling_rate)
+{
+        rhd2k_monitor_plan_t * plan = new rhd2k_monitor_plan_t;
+        std::vector<std::vector<rhd2k_monitor_tap_t> > by_channel(nchannels);
+
+        for (size_t m = 0; m < configs.size(); ++m) {
+                rhd2k_monitor_config_t const & c = configs[m];
+                for (size_t i = 0; i < c.taps.size(); ++i) {
+                        rhd2k_monitor_tap_t tap = { m, c.taps[i].gain };
+                        by_channel[c.taps[i].index].push_back(tap);
+                }
+                plan->filtered.push_back(c.lowcut > 0 || c.highcut > 0);
+                plan->highpass.push_back(biquad_design(c.lowcut, sampling_rate, true));
+                plan->lowpass.push_back(biquad_design(c.highcut, sampling_rate, false));
+        }
+
+        plan->tap_offset.push_back(0);
+        for (size_t c = 0; c < nchannels; ++c) {
+                plan->taps.insert(plan->taps.end(), by_channel[c].begin(), by_channel[c].end());
+                plan->tap_offset.push_back(plan->taps.size());
+        }
+        plan->active_taps.reserve(plan->taps.size());
+        return plan;
+}
+
+bool
+rhd2k_monitor_publish(rhd2k_driver_t * driver, rhd2k_monitor_plan_t * plan)
+{
+        rhd2k_monitor_plan_t * old;
+        while (jack_ringbuffer_read_space(driver->monitor_plans_out) >= sizeof(old)) {
+                jack_ringbuffer_read(driver->monitor_plans_out, (char *)&old, sizeof(old));
+                delete old;
+        }
+        if (jack_ringbuffer_write_space(driver->monitor_plans_in) < sizeof(plan)) {
+                delete plan;
+                return false;
+        }
+        jack_ringbuffer_write(driver->monitor_plans_in, (char const *)&plan, sizeof(plan));
+        return true;
+}
+
+bool
+rhd2k_monitor_receive(rhd2k_driver_t * driver)
+{
+        rhd2k_monitor_plan_t * plan;
+        bool changed = false;
+        while (jack_ringbuffer_read_space(driver->monitor_plans_in) >= sizeof(plan)) {
+                jack_ringbuffer_read(driver->monitor_plans_in, (char *)&plan, sizeof(plan));
+                if (driver->monitor_plan) {
+                        // sized to hold every plan, so this can't fail
+                        jack_ringbuffer_write(driver->monitor_plans_out,
+                                              (char const *)&driver->monitor_plan,
+                                              sizeof(plan));
+                }
+                driver->monitor_plan = plan;
+                changed = true;
+        }
+        return changed;
+}
+
+void
+rhd2k_monitor_cleanup(rhd2k_driver_t * driver)
+{
+        rhd2k_monitor_plan_t * plan;
+        rhd2k_monitor_receive(driver);
+        while (jack_ringbuffer_read_space(driver->monitor_plans_out) >= sizeof(plan)) {
+                jack_ringbuffer_read(driver->monitor_plans_out, (char *)&plan, sizeof(plan));
+                delete plan;
+        }
+        delete driver->monitor_plan;
+        driver->monitor_plan = 0;
+}
@@ -0,0 +1,115 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Software monitoring: output ports that carry a weighted, optionally
+ *   band-limited sum of amplifier channels.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_MONITOR_H
+#define __RHD2K_MONITOR_H
+
+#include <string>
+#include <vector>
+#include "rhd2000eval.hpp"
+
+struct rhd2k_driver_t;
+
+/** maximum number of software monitors */
+static const size_t rhd2k_max_monitors = 64;
+
+/** a single input to a monitor mix */
+struct rhd2k_monitor_tap_t {
+        size_t index;           // channel (in configs) or monitor (in plans)
+        float gain;
+};
+
+/** the user's specification of a monitor mix */
+struct rhd2k_monitor_config_t {
+        std::vector<rhd2k_monitor_tap_t> taps;
+        double lowcut;          // Hz, or 0 for no highpass
+        double highcut;         // Hz, or 0 for no lowpass
+};
+
+/** second-order IIR section, direct form II transposed */
+struct rhd2k_biquad_t {
+        float b0, b1, b2, a1, a2;
+        float z1, z2;
+};
+
+/**
+ * The mixing plan used by the process thread. Plans are built outside the
+ * process thread and handed over through a ringbuffer, so that the process
+ * thread never allocates. Taps are sorted by channel so that each channel's
+ * contribution can be added while it is converted.
+ */
+struct rhd2k_monitor_plan_t {
+        std::vector<size_t> tap_offset;                 // nchannels + 1
+        std::vector<rhd2k_monitor_tap_t> taps;          // index = monitor
+        std::vector<rhd2k_monitor_tap_t> active_taps;   // scratch, taps.size() reserved
+        std::vector<char> filtered;                     // per monitor
+        std::vector<rhd2k_biquad_t> highpass;
+        std::vector<rhd2k_biquad_t> lowpass;
+};
+
+/**
+ * Parse a monitor specification. Monitors are separated by semicolons, and
+ * each is a list of channels separated by '+', optionally preceded by a
+ * gain and followed by a passband, e.g. "A1_0+0.5*A1_3@300:6000;B1_7". A
+ * plain number N creates N empty monitors that can be set later through the
+ * control socket.
+ *
+ * @return true on success. On failure, err contains the reason.
+ */
+bool rhd2k_monitor_parse(char const * spec, rhd2k::evalboard const & dev,
+                         std::vector<rhd2k_monitor_config_t> & out, std::string & err);
+
+/** Parse the specification of a single monitor (no semicolons) */
+bool rhd2k_monitor_parse_one(char const * spec, rhd2k::evalboard const & dev,
+                             rhd2k_monitor_config_t & out, std::string & err);
+
+/** Build a mixing plan from the driver's monitor configuration */
+rhd2k_monitor_plan_t * rhd2k_monitor_plan_new(std::vector<rhd2k_monitor_config_t> const & configs,
+                                              size_t nchannels, double sampling_rate);
+
+/**
+ * Hand a new plan to the process thread and free any plans it has retired.
+ * Must only be called from one non-realtime thread at a time.
+ *
+ * @return false if the queue is full (the plan is deleted)
+ */
+bool rhd2k_monitor_publish(rhd2k_driver_t * driver, rhd2k_monitor_plan_t * plan);
+
+/**
+ * Pick up a new plan in the process thread. The old plan is passed back
+ * for deletion.
+ *
+ * @return true if the plan changed
+ */
+bool rhd2k_monitor_receive(rhd2k_driver_t * driver);
+
+/** Free all plans, including the current one. Process must be stopped. */
+void rhd2k_monitor_cleanup(rhd2k_driver_t * driver);
+
+/** Filter a buffer in place */
+inline void
+rhd2k_biquad_process(rhd2k_biquad_t & f, float * buf, size_t nframes)
+{
+        float z1 = f.z1, z2 = f.z2;
+        for (size_t t = 0; t < nframes; ++t) {
+                const float x = buf[t];
+                const float y = f.b0 * x + z1;
+                z1 = f.b1 * x - f.a1 * y + z2;
+                z2 = f.b2 * x - f.a2 * y;
+                buf[t] = y;
+        }
+        f.z1 = z1;
+        f.z2 = z2;
+}
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Packed channel groups in shared memory.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sstream>
+
+#include <jack/metadata.h>
+
+#include "rhd2000frame.hpp"
+#include "jack_rhd2k_driver.h"
+#include "rhd2k_packed.h"
+
+using std::size_t;
+using std::string;
+using namespace rhd2k;
+
+static const float raw_scale = 1.0f / 32768.0f;
+
+/* the offset of a raw sample, and whether it's signed */
+static float
+raw_offset(evalboard const * dev, evalboard::channel_info_t const & info, bool * is_signed)
+{
+        *is_signed = (info.stream != evalboard::EvalADC) && dev->twoscomp();
+        return (info.stream != evalboard::EvalADC && !*is_signed) ? -1.0f : 0.0f;
+}
+
+static size_t
+sample_size(rhd2k_driver_t const * driver)
+{
+        return driver->packed_raw ? sizeof(evalboard::data_type) : sizeof(float);
+}
+
+/* create the segment for a group; returns 0 on failure */
+static rhd2k_packed_t *
+packed_create(rhd2k_driver_t * driver, rhd2k_packed_group_t const * group, size_t max_frames)
+{
+        const size_t nchannels = group->channels.size();
+        const size_t size = rhd2k_packed_size(nchannels, max_frames, sample_size(driver));
+        char const * name = group->shm_name.c_str();
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, size) < 0) {
+                jack_error("RHD2K: unable to create shared memory segment %s: %s",
+                           name, strerror(errno));
+                if (fd >= 0) close(fd);
+                return 0;
+        }
+        void * p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+                jack_error("RHD2K: unable to map shared memory segment %s: %s",
+                           name, strerror(errno));
+                shm_unlink(name);
+                return 0;
+        }
+        // keep the block out of the page fault path of the process thread
+        mlock(p, size);
+
+        rhd2k_packed_t * block = static_cast<rhd2k_packed_t *>(p);
+        std::vector<evalboard::channel_info_t> const & table = driver->dev->adc_table();
+        block->version = rhd2k_packed_version;
+        block->sample_rate = driver->dev->sampling_rate();
+        block->nchannels = nchannels;
+        block->max_frames = max_frames;
+        block->data_offset = rhd2k_packed_size(0, 0);
+        block->format = driver->packed_raw ? RHD2K_PACKED_RAW16 : RHD2K_PACKED_FLOAT32;
+        block->sample_size = sample_size(driver);
+        block->scale = raw_scale;
+        block->cycles = 0;
+        block->nframes = 0;
+        block->timestamp = 0;
+        for (size_t i = 0; i < nchannels; ++i) {
+                strncpy(block->names[i], table[group->channels[i]].name.c_str(),
+                        sizeof(block->names[i]) - 1);
+                bool is_signed;
+                block->offsets[i] = raw_offset(driver->dev, table[group->channels[i]], &is_signed);
+                block->is_signed[i] = is_signed;
+        }
+        __sync_synchronize();
+        block->magic = rhd2k_packed_magic;
+        return block;
+}
+
+static void
+packed_destroy(rhd2k_packed_group_t * group)
+{
+        if (group->block == 0) return;
+        const size_t size = rhd2k_packed_size(group->block->nchannels, group->block->max_frames,
+                                              group->block->sample_size);
+        group->block->magic = 0;
+        munmap(group->block, size);
+        shm_unlink(group->shm_name.c_str());
+        group->block = 0;
+}
+
+/* point the group's sources at the current scratch buffer */
+static void
+packed_update_sources(rhd2k_driver_t * driver, rhd2k_packed_group_t * group)
+{
+        evalboard const * dev = driver->dev;
+        std::vector<evalboard::channel_info_t> const & table = dev->adc_table();
+        group->sources.clear();
+        for (size_t i = 0; i < group->channels.size(); ++i) {
+                evalboard::channel_info_t const & info = table[group->channels[i]];
+                rhd2k_active_channel_t chan = { group->channels[i], 0, 0, 0, 0, 0, 0.0f, false };
+                chan.src = static_cast<char const *>(driver->buffer) + info.byte_offset;
+                chan.stride = dev->frame_size();
+                chan.offset = raw_offset(dev, info, &chan.twoscomp);
+                group->sources.push_back(chan);
+        }
+}
+
+static void
+packed_set_metadata(rhd2k_driver_t * driver, rhd2k_packed_group_t const * group)
+{
+        std::vector<evalboard::channel_info_t> const & table = driver->dev->adc_table();
+        std::ostringstream channels, offsets, is_signed, scale;
+        for (size_t i = 0; i < group->sources.size(); ++i) {
+                if (i) {
+                        channels << ',';
+                        offsets << ',';
+                        is_signed << ',';
+                }
+                channels << table[group->channels[i]].name;
+                offsets << group->sources[i].offset;
+                is_signed << group->sources[i].twoscomp;
+        }
+        scale << raw_scale;
+        const jack_uuid_t uuid = jack_port_uuid(group->port);
+        int err = jack_set_property(driver->client, uuid, RHD2K_PACKED_KEY_SHM,
+                                    group->shm_name.c_str(), "text/plain") ||
+                jack_set_property(driver->client, uuid, RHD2K_PACKED_KEY_FORMAT,
+                                  driver->packed_raw ? "raw16" : "float32", "text/plain") ||
+                jack_set_property(driver->client, uuid, RHD2K_PACKED_KEY_CHANNELS,
+                                  channels.str().c_str(), "text/plain");
+        if (!err && driver->packed_raw) {
+                err = jack_set_property(driver->client, uuid, RHD2K_PACKED_KEY_SCALE,
+                                        scale.str().c_str(), "text/plain") ||
+                        jack_set_property(driver->client, uuid, RHD2K_PACKED_KEY_OFFSETS,
+                                          offsets.str().c_str(), "text/plain") ||
+                        jack_set_property(driver->client, uuid, RHD2K_PACKED_KEY_SIGNED,
+                                          is_signed.str().c_str(), "text/plain");
+        }
+        if (err) {
+                jack_error("RHD2K: unable to set metadata for %s", jack_port_name(group->port));
+        }
+}
+
+/* the group a channel belongs to */
+static string
+packed_group_name(evalboard const * dev, evalboard::channel_info_t const & info, bool by_port)
+{
+        if (!by_port) return "all";
+        if (info.stream == evalboard::EvalADC) return "EV";
+        std::ostringstream name;
+        name << (evalboard::mosi_id)(dev->stream_source(info.stream) / 2);
+        return name.str();
+}
+
+int
+rhd2k_packed_attach(rhd2k_driver_t * driver, char const * mode)
+{
+        const bool by_port = (strcmp(mode, "port") == 0);
+        std::vector<evalboard::channel_info_t> const & table = driver->dev->adc_table();
+        for (size_t c = 0; c < table.size(); ++c) {
+                const string name = packed_group_name(driver->dev, table[c], by_port);
+                rhd2k_packed_group_t * group = 0;
+                for (size_t g = 0; g < driver->packed_groups.size(); ++g) {
+                        if (driver->packed_groups[g]->name == name) group = driver->packed_groups[g];
+                }
+                if (group == 0) {
+                        group = new rhd2k_packed_group_t;
+                        group->name = name;
+                        group->shm_name = RHD2K_PACKED_PREFIX + name;
+                        group->port = 0;
+                        group->block = 0;
+                        driver->packed_groups.push_back(group);
+                }
+                group->channels.push_back(c);
+        }
+
+        const size_t first_index = driver->capture_ports.size() + driver->monitor_ports.size();
+        for (size_t g = 0; g < driver->packed_groups.size(); ++g) {
+                rhd2k_packed_group_t * group = driver->packed_groups[g];
+                const string port_name = "packed_" + group->name;
+                group->port = jack_port_register (driver->client, port_name.c_str(),
+                                                  JACK_DEFAULT_AUDIO_TYPE,
+                                                  JackPortIsOutput|JackPortIsTerminal, 0);
+                if (group->port == 0) {
+                        jack_error ("RHD2K: cannot register port for %s", port_name.c_str());
+                        return -1;
+                }
+                driver->port_index[group->port] = first_index + g;
+                group->block = packed_create(driver, group, driver->period_size);
+                if (group->block == 0) return -1;
+                packed_update_sources(driver, group);
+                packed_set_metadata(driver, group);
+        }
+        driver->active_packed.reserve(driver->packed_groups.size());
+        return 0;
+}
+
+void
+rhd2k_packed_detach(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_packed_group_t*>::iterator g;
+        for (g = driver->packed_groups.begin(); g != driver->packed_groups.end(); ++g) {
+                rhd2k_packed_group_t * group = *g;
+                if (group->port) {
+                        const jack_uuid_t uuid = jack_port_uuid(group->port);
+                        jack_remove_property(driver->client, uuid, RHD2K_PACKED_KEY_SHM);
+                        jack_remove_property(driver->client, uuid, RHD2K_PACKED_KEY_FORMAT);
+                        jack_remove_property(driver->client, uuid, RHD2K_PACKED_KEY_CHANNELS);
+                        jack_remove_property(driver->client, uuid, RHD2K_PACKED_KEY_SCALE);
+                        jack_remove_property(driver->client, uuid, RHD2K_PACKED_KEY_OFFSETS);
+                        jack_remove_property(driver->client, uuid, RHD2K_PACKED_KEY_SIGNED);
+                        jack_port_unregister (driver->client, group->port);
+                }
+                packed_destroy(group);
+                delete group;
+        }
+        driver->packed_groups.clear();
+        driver->active_packed.clear();
+}
+
+int
+rhd2k_packed_bufsize(rhd2k_driver_t * driver)
+{
+        std::vector<rhd2k_packed_group_t*>::iterator g;
+        for (g = driver->packed_groups.begin(); g != driver->packed_groups.end(); ++g) {
+                packed_destroy(*g);
+                (*g)->block = packed_create(driver, *g, driver->period_size);
+                if ((*g)->block == 0) return -1;
+                packed_update_sources(driver, *g);
+        }
+        return 0;
+}
+
+void
+rhd2k_packed_write(rhd2k_driver_t * driver, size_t nframes)
+{
+        const uint32_t timestamp = frame_timestamp(static_cast<char const *>(driver->buffer));
+        std::vector<size_t>::const_iterator g;
+        for (g = driver->active_packed.begin(); g != driver->active_packed.end(); ++g) {
+                rhd2k_packed_group_t const * group = driver->packed_groups[*g];
+                rhd2k_packed_t * block = group->block;
+                if (block == 0 || nframes > block->max_frames) continue;
+                char * data = reinterpret_cast<char *>(block) + block->data_offset;
+                std::vector<rhd2k_active_channel_t>::const_iterator it;
+                if (block->format == RHD2K_PACKED_RAW16) {
+                        evalboard::data_type * out = reinterpret_cast<evalboard::data_type *>(data);
+                        for (it = group->sources.begin(); it != group->sources.end(); ++it, out += nframes) {
+                                gather_channel(it->src, it->stride, nframes, out);
+                        }
+                }
+                else {
+                        float * out = reinterpret_cast<float *>(data);
+                        for (it = group->sources.begin(); it != group->sources.end(); ++it, out += nframes) {
+                                if (it->twoscomp)
+                                        convert_channel_signed(it->src, it->stride, nframes, out);
+                                else
+                                        convert_channel(it->src, it->stride, nframes, it->offset, out);
+                        }
+                }
+                block->nframes = nframes;
+                block->timestamp = timestamp;
+                __sync_synchronize();
+                block->cycles += 1;
+        }
+}
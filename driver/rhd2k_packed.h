@@ -0,0 +1,127 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Packed channel groups. Each capture port carries one channel, so a
+ *   client that wants all of them pays for hundreds of buffer lookups and
+ *   graph edges. A packed group delivers a block of channels instead,
+ *   channel-major, through a POSIX shared memory segment.
+ *
+ *   JACK only has audio and MIDI port types, so the block can't be a port
+ *   buffer. Each group has an ordinary output port (packed_all, or
+ *   packed_A ... packed_D and packed_EV) whose buffer is silent, and whose
+ *   metadata give the name of the segment and the channels in the block.
+ *   While the port is connected, the driver fills the block in each cycle
+ *   before the graph runs, so a client connected to the port can use the
+ *   block for the current cycle in its process callback.
+ *
+ *   The block holds floats, with the same values as the capture ports, or
+ *   with -R the raw 16-bit samples, copied without conversion. A raw
+ *   sample x has the value x * scale + offset, where x is signed for
+ *   channels flagged as such (amplifiers in two's complement mode) and
+ *   unsigned otherwise. The scale, offsets and signedness are in the
+ *   header and the port metadata.
+ *
+ *   The segment is replaced when the period size changes; the old one has
+ *   its magic cleared, and readers should then reopen it.
+ *
+ *   This header is shared with client programs, so it should not depend on
+ *   JACK.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_PACKED_H
+#define __RHD2K_PACKED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** segment names are this prefix plus the group name */
+#define RHD2K_PACKED_PREFIX "/jack_rhd2000_packed_"
+
+/** port metadata keys */
+#define RHD2K_PACKED_KEY_SHM "urn:jack_rhd2000:packed:shm"
+#define RHD2K_PACKED_KEY_FORMAT "urn:jack_rhd2000:packed:format"
+#define RHD2K_PACKED_KEY_CHANNELS "urn:jack_rhd2000:packed:channels"
+#define RHD2K_PACKED_KEY_SCALE "urn:jack_rhd2000:packed:scale"
+#define RHD2K_PACKED_KEY_OFFSETS "urn:jack_rhd2000:packed:offsets"
+#define RHD2K_PACKED_KEY_SIGNED "urn:jack_rhd2000:packed:signed"
+
+static const uint32_t rhd2k_packed_magic = 0x50444852; // "RHDP"
+static const uint32_t rhd2k_packed_version = 2;
+static const size_t rhd2k_packed_max_channels = 1024;
+
+/** sample formats */
+enum rhd2k_packed_format_t {
+        RHD2K_PACKED_FLOAT32 = 0,
+        RHD2K_PACKED_RAW16 = 1
+};
+
+/** The layout of the segment. The block follows at data_offset. */
+struct rhd2k_packed_t {
+        volatile uint32_t magic;        // set last, cleared when replaced
+        uint32_t version;
+        uint32_t sample_rate;
+        uint32_t nchannels;
+        uint32_t max_frames;            // capacity of the block, per channel
+        uint32_t data_offset;           // bytes from the start of the segment
+        uint32_t format;                // rhd2k_packed_format_t
+        uint32_t sample_size;           // bytes per sample
+        float scale;                    // of raw samples
+
+        volatile uint64_t cycles;       // incremented after each block
+        volatile uint32_t nframes;      // frames per channel in the block
+        volatile uint32_t timestamp;    // of the first frame in the block
+
+        char names[rhd2k_packed_max_channels][16];
+        float offsets[rhd2k_packed_max_channels];       // of raw samples
+        uint8_t is_signed[rhd2k_packed_max_channels];   // raw samples are int16
+};
+
+/** the size of a segment */
+inline size_t
+rhd2k_packed_size(size_t nchannels, size_t max_frames, size_t sample_size = sizeof(float))
+{
+        const size_t header = (sizeof(rhd2k_packed_t) + 15) / 16 * 16;
+        return header + nchannels * max_frames * sample_size;
+}
+
+/** the samples of channel c in the current block (RHD2K_PACKED_FLOAT32) */
+inline float const *
+rhd2k_packed_channel(rhd2k_packed_t const * p, size_t c)
+{
+        char const * data = reinterpret_cast<char const *>(p) + p->data_offset;
+        return reinterpret_cast<float const *>(data) + c * p->nframes;
+}
+
+/** the samples of channel c in the current block (RHD2K_PACKED_RAW16) */
+inline uint16_t const *
+rhd2k_packed_channel_raw(rhd2k_packed_t const * p, size_t c)
+{
+        char const * data = reinterpret_cast<char const *>(p) + p->data_offset;
+        return reinterpret_cast<uint16_t const *>(data) + c * p->nframes;
+}
+
+struct rhd2k_driver_t;
+
+/**
+ * Register a port and create a segment for each packed group. mode is
+ * "all" for one group with all of the first board's channels, or "port"
+ * for a group per SPI port plus one for the eval board ADCs. Port indices
+ * follow the capture and monitor ports.
+ */
+int rhd2k_packed_attach(rhd2k_driver_t * driver, char const * mode);
+
+void rhd2k_packed_detach(rhd2k_driver_t * driver);
+
+/** replace the segments after the period size changes */
+int rhd2k_packed_bufsize(rhd2k_driver_t * driver);
+
+/** fill the blocks of the connected groups. Called by the process thread */
+void rhd2k_packed_write(rhd2k_driver_t * driver, size_t nframes);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Reader thread that pulls data off the USB bus in large transfers and
+ *   queues it for the process thread.
+ *
+ *   Small USB transfers are inefficient: each one pays a fixed cost of a
+ *   millisecond or more, so reading one short period at a time can't keep
+ *   up with the board. When a transfer size is given (-t), this thread
+ *   reads that many frames at a time into a ring of frames, and the process
+ *   thread takes one period at a time out of the ring. The process thread
+ *   then never touches the USB bus, and the JACK period can be much shorter
+ *   than the transfer.
+ *
+ *   If the FIFO underflows (or the ring overflows because the process
+ *   thread is not keeping up), the reader stops acquisition and waits for
+ *   the process thread to flush the ring before restarting, so that the
+ *   ring never holds data from both sides of a restart.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <jack/thread.h>
+
+#include "rhd2000cycle.hpp"
+#include "rhd2k_reader.h"
+
+using std::size_t;
+using namespace rhd2k;
+
+static void *
+reader_thread(void * arg)
+{
+        rhd2k_driver_t * driver = static_cast<rhd2k_driver_t *>(arg);
+        const size_t transfer = driver->transfer_size;
+        const size_t transfer_bytes = transfer * driver->dev->frame_size();
+        const size_t expected = transfer + driver->fifo_latency;
+        uint32_t next_frame = 0;
+
+        while (driver->reader_running) {
+                uint64_t t0 = rhd2k_stats_now();
+                pthread_mutex_lock(&driver->dev_lock);
+                const size_t nframes = driver->dev->nframes();
+                pthread_mutex_unlock(&driver->dev_lock);
+                rhd2k_stats_lap(driver->stats, RHD2K_STAGE_POLL, &t0);
+                rhd2k_stats_fifo(driver->stats, nframes);
+                driver->phase->observe(next_frame + nframes, t0);
+
+                // wait long enough to ensure enough data is in the FIFO
+                if (nframes < expected) {
+                        usleep(fifo_fill_usecs(nframes, expected, driver->dev->sampling_rate()));
+                }
+                else if (nframes > expected + transfer) {
+                        driver->stats->delayed_cycles += 1;
+                        rhd2k_log(driver->reader_log, RHD2K_LOG_DELAYED, next_frame, nframes,
+                                  0.0f, nframes - expected);
+                }
+                rhd2k_stats_lap(driver->stats, RHD2K_STAGE_SLEEP, &t0);
+
+                pthread_mutex_lock(&driver->dev_lock);
+                const size_t got = driver->dev->read (driver->reader_buffer, transfer);
+                rhd2k_stats_lap(driver->stats, RHD2K_STAGE_READ, &t0);
+                size_t bad_frame;
+                frame_fault fault;
+                const period_status status = check_period(*driver->dev, driver->reader_buffer,
+                                                          transfer, got, next_frame,
+                                                          &bad_frame, &fault);
+                const bool ok = (status == PERIOD_OK);
+                rhd2k_stats_lap(driver->stats, RHD2K_STAGE_VALIDATE, &t0);
+                if (status == PERIOD_STOPPED || (status == PERIOD_READ_ERROR && !driver->dev->running())) {
+                        pthread_mutex_unlock(&driver->dev_lock);
+                        rhd2k_log(driver->reader_log,
+                                  (status == PERIOD_STOPPED) ? RHD2K_LOG_STOPPED : RHD2K_LOG_READ_ERROR,
+                                  next_frame, nframes);
+                        driver->reader_error = 1;
+                        sem_post(&driver->reader_ready);
+                        break;
+                }
+                pthread_mutex_unlock(&driver->dev_lock);
+
+                if (ok && jack_ringbuffer_write_space(driver->ring) >= transfer_bytes) {
+                        jack_ringbuffer_write(driver->ring, (char const *)driver->reader_buffer,
+                                              transfer_bytes);
+                        next_frame += transfer;
+                        sem_post(&driver->reader_ready);
+                        continue;
+                }
+
+                // FIFO was underfull or ring is full. stop acquisition and
+                // wait for the process thread to discard the ring
+                if (ok) {
+                        rhd2k_log(driver->reader_log, RHD2K_LOG_OVERFLOW, next_frame, nframes);
+                }
+                else if (status == PERIOD_READ_ERROR) {
+                        rhd2k_log(driver->reader_log, RHD2K_LOG_READ_ERROR, next_frame, nframes);
+                }
+                else {
+                        driver->stats->frame_faults[fault] += 1;
+                        rhd2k_log(driver->reader_log, RHD2K_LOG_UNDERFULL, next_frame, nframes,
+                                  0.0f, bad_frame, fault);
+                }
+                pthread_mutex_lock(&driver->dev_lock);
+                rhd2k_acquisition_stop(driver, driver->reader_log);
+                pthread_mutex_unlock(&driver->dev_lock);
+                driver->phase->reset();
+                __sync_lock_test_and_set(&driver->xrun_pending, 1);
+                sem_post(&driver->reader_ready);
+                while (driver->xrun_pending && driver->reader_running) {
+                        usleep(1000);
+                }
+                if (!driver->reader_running) break;
+
+                pthread_mutex_lock(&driver->dev_lock);
+                rhd2k_acquisition_start(driver, driver->reader_buffer, transfer,
+                                        driver->reader_log);
+                pthread_mutex_unlock(&driver->dev_lock);
+                next_frame = 0;
+        }
+        return 0;
+}
+
+int
+rhd2k_reader_start(rhd2k_driver_t * driver)
+{
+        const size_t frames = rhd2k_ring_transfers * std::max(driver->transfer_size, driver->period_size);
+        driver->ring = jack_ringbuffer_create(frames * driver->dev->frame_size() + 1);
+        jack_ringbuffer_mlock(driver->ring);
+        driver->reader_buffer = malloc(driver->transfer_size * driver->dev->frame_size());
+        if (driver->ring == 0 || driver->reader_buffer == 0) {
+                jack_error("RHD2K: unable to allocate frame ring");
+                rhd2k_reader_stop(driver);
+                return -1;
+        }
+        driver->xrun_pending = 0;
+        driver->reader_error = 0;
+        driver->reader_running = true;
+
+        int priority = jack_client_real_time_priority(driver->client);
+        if (jack_client_create_thread(driver->client, &driver->reader_thread, priority,
+                                      priority > 0, reader_thread, driver) != 0) {
+                jack_error("RHD2K: unable to start reader thread");
+                driver->reader_running = false;
+                rhd2k_reader_stop(driver);
+                return -1;
+        }
+        return 0;
+}
+
+void
+rhd2k_reader_stop(rhd2k_driver_t * driver)
+{
+        if (driver->reader_running) {
+                driver->reader_running = false;
+                pthread_join(driver->reader_thread, 0);
+        }
+        if (driver->ring) jack_ringbuffer_free(driver->ring);
+        free(driver->reader_buffer);
+        driver->ring = 0;
+        driver->reader_buffer = 0;
+}
+
+int
+rhd2k_reader_wait(rhd2k_driver_t * driver)
+{
+        const size_t bytes = driver->period_size * driver->dev->frame_size();
+        struct timespec deadline;
+
+        // if nothing arrives for a second, something is badly wrong
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1 + (driver->transfer_size + driver->period_size) / driver->dev->sampling_rate();
+
+        while (jack_ringbuffer_read_space(driver->ring) < bytes && !driver->xrun_pending) {
+                if (driver->reader_error) return -1;
+                if (sem_timedwait(&driver->reader_ready, &deadline) != 0 && errno == ETIMEDOUT) {
+                        rhd2k_log(driver->process_log, RHD2K_LOG_TIMEOUT, driver->last_frame,
+                                  driver->stats->fifo_frames);
+                        return -1;
+                }
+        }
+        if (driver->xrun_pending) {
+                jack_ringbuffer_read_advance(driver->ring, jack_ringbuffer_read_space(driver->ring));
+                driver->xrun_usecs = driver->engine->get_microseconds() - driver->last_wait_ust;
+                __sync_lock_release(&driver->xrun_pending);
+                return 1;
+        }
+        jack_ringbuffer_read(driver->ring, (char *)driver->buffer, bytes);
+        return 0;
+}
+
+void
+rhd2k_reader_discard(rhd2k_driver_t * driver)
+{
+        const size_t bytes = driver->period_size * driver->dev->frame_size();
+        if (jack_ringbuffer_read_space(driver->ring) >= bytes) {
+                jack_ringbuffer_read_advance(driver->ring, bytes);
+        }
+}
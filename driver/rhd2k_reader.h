@@ -0,0 +1,46 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Reader thread that pulls data off the USB bus in large transfers and
+ *   queues it for the process thread.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_READER_H
+#define __RHD2K_READER_H
+
+#include "jack_rhd2k_driver.h"
+
+/** the frame ring holds this many transfers or periods, whichever is larger */
+static const size_t rhd2k_ring_transfers = 4;
+
+/**
+ * Allocate the frame ring and start the reader thread. The board should
+ * already be running.
+ *
+ * @return 0 on success
+ */
+int rhd2k_reader_start(rhd2k_driver_t * driver);
+
+/** Stop the reader thread and free the ring */
+void rhd2k_reader_stop(rhd2k_driver_t * driver);
+
+/**
+ * Wait until a period of data is available in the ring and copy it into
+ * driver->buffer. Called from the process thread.
+ *
+ * @return 0 if a period was read, 1 if the reader restarted acquisition
+ *         (the ring is flushed and driver->xrun_usecs is set), or -1 on
+ *         a fatal error
+ */
+int rhd2k_reader_wait(rhd2k_driver_t * driver);
+
+/** Discard a period of data from the ring */
+void rhd2k_reader_discard(rhd2k_driver_t * driver);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Driver settings, shared by the JACK1 driver and the JACK2 backend
+ *   (jack2/), which take the same parameters. This header should not
+ *   depend on either version of JACK.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_SETTINGS_H
+#define __RHD2K_SETTINGS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rhd2000eval.hpp"
+#include "rhd2000frame.hpp"
+#include "rhd2k_stats.h"
+
+struct rhd2k_amp_settings_t {
+        unsigned long amp_power;
+        double lowpass;
+        double highpass;
+        double dsp;
+        double cable_m;
+};
+
+struct rhd2k_jack_settings_t {
+        uint32_t period_size;
+        uint32_t sample_rate;
+
+        uint32_t capture_frame_latency;
+        uint32_t transfer_size;
+
+        rhd2k_amp_settings_t amplifiers[rhd2k::evalboard::nmosi];
+
+        char const * control_socket;
+        char const * monitors;
+        char const * stats_name;
+        char const * autotune;          // target xrun probability, or 0
+        char const * boards;            // serials of additional boards, or 0
+        int sync_bit;                   // TTL input with sync signal, or -1
+        int twoscomp;                   // amplifiers return signed samples
+        char const * packed;            // packed groups ("all" or "port"), or 0
+        int packed_raw;                 // packed groups carry raw samples
+        char const * epochs;            // triggered capture spec, or 0
+        char const * epoch_dir;         // where captures are saved
+        char const * blank;             // artifact blanking spec, or 0
+};
+
+static const rhd2k_amp_settings_t default_amp_config = {0xffffffff, 100, 3000, 1, 0};
+static const rhd2k_jack_settings_t default_settings = {1024U, 30000U, 0U, 0U,
+                                                       {default_amp_config,
+                                                        default_amp_config,
+                                                        default_amp_config,
+                                                        default_amp_config},
+                                                       0, 0, RHD2K_STATS_DEFAULT_NAME, 0,
+                                                       0, -1, 0, 0, 0, 0, "/tmp", 0};
+
+/** parse the argument to -A, -B, -C, or -D. Ignores any other option */
+inline void
+parse_port_config(char pchar, char const * arg, rhd2k_jack_settings_t & s)
+{
+        rhd2k_amp_settings_t * pptr;
+        rhd2k::evalboard::mosi_id port;
+
+        switch(pchar) {
+        case 'A':
+                port = rhd2k::evalboard::PortA;
+                break;
+        case 'B':
+                port = rhd2k::evalboard::PortB;
+                break;
+        case 'C':
+                port = rhd2k::evalboard::PortC;
+                break;
+        case 'D':
+                port = rhd2k::evalboard::PortD;
+                break;
+        default:
+                return;
+        }
+        pptr = &s.amplifiers[(size_t)port];
+        // should really do some more validation
+        sscanf(arg, "%lx,%lf,%lf,%lf,%lf", &pptr->amp_power, &pptr->lowpass,
+               &pptr->highpass, &pptr->dsp, &pptr->cable_m);
+}
+
+/**
+ * Configure the amplifiers on a board and scan its SPI ports. Ports with all
+ * amps powered off are left out of the USB stream routing.
+ *
+ * @return the USB bandwidth (bytes/s) saved relative to sending all streams
+ */
+inline size_t
+rhd2k_configure_board (rhd2k::evalboard * dev, rhd2k_jack_settings_t const & settings)
+{
+        using rhd2k::evalboard;
+        dev->set_twoscomp(settings.twoscomp);
+        for (size_t i = 0; i < evalboard::nmosi; ++i) {
+                rhd2k_amp_settings_t const * a = &settings.amplifiers[i];
+                dev->configure_port((evalboard::mosi_id)i, a->lowpass, a->highpass, a->dsp, a->amp_power);
+        }
+        dev->scan_ports();
+        for (size_t i = 0; i < evalboard::nmosi; ++i) {
+                rhd2k_amp_settings_t const * a = &settings.amplifiers[i];
+                // manually specified cable length
+                if (a->cable_m > 0) {
+                        dev->set_cable_meters((evalboard::mosi_id)i, a->cable_m);
+                }
+        }
+        return (rhd2k::frame_size(evalboard::nmiso) - dev->frame_size()) * dev->sampling_rate();
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Timing statistics in shared memory.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jack_rhd2k_driver.h"
+#include "rhd2k_stats.h"
+
+rhd2k_stats_t *
+rhd2k_stats_create(char const * name, bool * shared)
+{
+        rhd2k_stats_t * stats = 0;
+        *shared = false;
+        if (name) {
+                int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0 || ftruncate(fd, sizeof(rhd2k_stats_t)) < 0) {
+                        jack_error("RHD2K: unable to create shared memory segment %s: %s",
+                                   name, strerror(errno));
+                }
+                else {
+                        void * p = mmap(0, sizeof(rhd2k_stats_t), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED, fd, 0);
+                        if (p != MAP_FAILED) {
+                                stats = static_cast<rhd2k_stats_t *>(p);
+                                *shared = true;
+                        }
+                        else {
+                                shm_unlink(name);
+                        }
+                }
+                if (fd >= 0) close(fd);
+        }
+        if (stats == 0) {
+                stats = static_cast<rhd2k_stats_t *>(malloc(sizeof(rhd2k_stats_t)));
+                if (stats == 0) return 0;
+        }
+        // keep the histograms out of the page fault path of the process thread
+        memset(stats, 0, sizeof(rhd2k_stats_t));
+        mlock(stats, sizeof(rhd2k_stats_t));
+        stats->version = rhd2k_stats_version;
+        __sync_synchronize();
+        stats->magic = rhd2k_stats_magic;
+        return stats;
+}
+
+void
+rhd2k_stats_destroy(rhd2k_stats_t * stats, char const * name, bool shared)
+{
+        if (stats == 0) return;
+        if (shared) {
+                stats->magic = 0;
+                munmap(stats, sizeof(rhd2k_stats_t));
+                shm_unlink(name);
+        }
+        else {
+                free(stats);
+        }
+}
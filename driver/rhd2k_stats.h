@@ -0,0 +1,177 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Timing statistics. The driver times each stage of the process cycle and
+ *   accumulates the results in log-linear histograms (like HdrHistogram:
+ *   each power of two is split into 2^rhd2k_hist_sub_bits buckets, so the
+ *   relative error is at most 1/16). The histograms and the xrun counters
+ *   live in a POSIX shared memory segment so that they can be inspected
+ *   while the driver is running (see tools/rhd2k_stats.cpp).
+ *
+ *   Recording a value costs a clock read and a few increments, so the
+ *   statistics are always on.
+ *
+ *   This header is shared with the reader program, so it should not depend
+ *   on JACK.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_STATS_H
+#define __RHD2K_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/** default name of the shared memory segment */
+#define RHD2K_STATS_DEFAULT_NAME "/jack_rhd2000"
+
+static const uint32_t rhd2k_stats_magic = 0x53444852; // "RHDS"
+static const uint32_t rhd2k_stats_version = 3;
+
+/** the stages of the process cycle that are timed */
+enum rhd2k_stage_t {
+        RHD2K_STAGE_POLL = 0,   // querying the FIFO fill state
+        RHD2K_STAGE_SLEEP,      // waiting for the FIFO to fill
+        RHD2K_STAGE_READ,       // reading frames over USB
+        RHD2K_STAGE_VALIDATE,   // checking the frames
+        RHD2K_STAGE_WAIT,       // process thread waiting on the reader thread
+        RHD2K_STAGE_CONVERT,    // copying data to the port buffers
+        RHD2K_STAGE_CYCLE,      // whole process cycle, including clients
+        RHD2K_STAGE_TTL_OUT,    // from the end of the period in which a
+                                // client sent a ttl_out event to the first
+                                // frame with the new outputs (see rhd2k_ttl.h)
+        RHD2K_NSTAGES
+};
+
+static char const * const rhd2k_stage_names[RHD2K_NSTAGES] = {
+        "poll", "sleep", "read", "validate", "wait", "convert", "cycle", "ttl_out"
+};
+
+static const unsigned rhd2k_hist_sub_bits = 4;
+static const unsigned rhd2k_hist_octaves = 36; // values up to ~2^40 ns
+static const size_t rhd2k_hist_buckets = (rhd2k_hist_octaves + 1) << rhd2k_hist_sub_bits;
+
+/** histogram of durations, in ns */
+struct rhd2k_histogram_t {
+        uint64_t count;
+        uint64_t total_ns;
+        uint64_t max_ns;
+        uint64_t buckets[rhd2k_hist_buckets];
+};
+
+/**
+ * The layout of the shared memory segment. Each histogram and counter has
+ * only one writer. Readers may see a histogram in the middle of an update,
+ * which is harmless for statistics.
+ */
+struct rhd2k_stats_t {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t sample_rate;
+        uint32_t period_size;
+        uint32_t fifo_latency;
+        uint32_t transfer_size;
+
+        volatile uint64_t cycles;
+        volatile uint64_t delayed_cycles;
+        volatile uint64_t xruns;
+        volatile uint32_t fifo_frames;  // at the last poll
+        volatile uint32_t fifo_max;
+        // bad periods, by the first fault (indexed by rhd2k::frame_fault in
+        // rhd2000frame.hpp; 0 is unused)
+        volatile uint64_t frame_faults[4];
+
+        rhd2k_histogram_t stages[RHD2K_NSTAGES];
+};
+
+/** monotonic clock, in ns */
+inline uint64_t
+rhd2k_stats_now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** the bucket that holds a value */
+inline size_t
+rhd2k_hist_bucket(uint64_t ns)
+{
+        const uint64_t sub = 1ULL << rhd2k_hist_sub_bits;
+        if (ns < sub) return ns;
+        const unsigned shift = 63 - __builtin_clzll(ns) - rhd2k_hist_sub_bits;
+        const size_t idx = ((size_t)(shift + 1) << rhd2k_hist_sub_bits) + ((ns >> shift) & (sub - 1));
+        return (idx < rhd2k_hist_buckets) ? idx : rhd2k_hist_buckets - 1;
+}
+
+/** the smallest value that falls in a bucket */
+inline uint64_t
+rhd2k_hist_bucket_floor(size_t idx)
+{
+        const uint64_t sub = 1ULL << rhd2k_hist_sub_bits;
+        if (idx < sub) return idx;
+        const unsigned shift = (idx >> rhd2k_hist_sub_bits) - 1;
+        return (sub + (idx & (sub - 1))) << shift;
+}
+
+inline void
+rhd2k_hist_record(rhd2k_histogram_t & h, uint64_t ns)
+{
+        h.count += 1;
+        h.total_ns += ns;
+        if (ns > h.max_ns) h.max_ns = ns;
+        h.buckets[rhd2k_hist_bucket(ns)] += 1;
+}
+
+/** record the time since *t0 under stage, and set *t0 to now */
+inline void
+rhd2k_stats_lap(rhd2k_stats_t * stats, rhd2k_stage_t stage, uint64_t * t0)
+{
+        const uint64_t t1 = rhd2k_stats_now();
+        rhd2k_hist_record(stats->stages[stage], t1 - *t0);
+        *t0 = t1;
+}
+
+/** record the FIFO fill state */
+inline void
+rhd2k_stats_fifo(rhd2k_stats_t * stats, size_t nframes)
+{
+        stats->fifo_frames = nframes;
+        if (nframes > stats->fifo_max) stats->fifo_max = nframes;
+}
+
+/**
+ * Estimate the value at quantile q (0 to 1). Returns the lower bound of the
+ * bucket containing the quantile, or max_ns for q >= 1.
+ */
+inline uint64_t
+rhd2k_hist_quantile(rhd2k_histogram_t const & h, double q)
+{
+        if (h.count == 0) return 0;
+        if (q >= 1.0) return h.max_ns;
+        const uint64_t rank = (uint64_t)(q * h.count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < rhd2k_hist_buckets; ++i) {
+                seen += h.buckets[i];
+                if (seen > rank) return rhd2k_hist_bucket_floor(i);
+        }
+        return h.max_ns;
+}
+
+/**
+ * Create the shared memory segment. If name is 0 or the segment can't be
+ * created, the statistics are kept in private memory instead, so that the
+ * driver can always record, and *shared is set to false.
+ */
+rhd2k_stats_t * rhd2k_stats_create(char const * name, bool * shared);
+
+/** free the statistics, unlinking the segment if shared is true */
+void rhd2k_stats_destroy(rhd2k_stats_t * stats, char const * name, bool shared);
+
+#endif
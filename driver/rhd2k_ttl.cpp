@@ -0,0 +1,199 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   TTL inputs as MIDI events.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <algorithm>
+#include <jack/midiport.h>
+
+#include "rhd2000frame.hpp"
+#include "rhd2k_ttl.h"
+#include "rhd2k_worker.h"
+
+using std::size_t;
+using namespace rhd2k;
+
+static const jack_midi_data_t midi_note_on = 0x90;
+static const jack_midi_data_t midi_note_off = 0x80;
+
+// changes are found in chunks of at most this many
+static const size_t max_edges = 64;
+
+int
+rhd2k_ttl_attach(rhd2k_driver_t * driver)
+{
+        driver->ttl_in_port = jack_port_register (driver->client, "ttl_in",
+                                                  JACK_DEFAULT_MIDI_TYPE,
+                                                  JackPortIsOutput|JackPortIsTerminal, 0);
+        if (driver->ttl_in_port == 0) {
+                jack_error ("RHD2K: cannot register port for ttl_in");
+                return -1;
+        }
+        driver->port_index[driver->ttl_in_port] = driver->capture_ports.size() +
+                driver->monitor_ports.size() + driver->packed_groups.size();
+        driver->ttl_in_active = false;
+        driver->ttl_in_state = 0;
+
+        driver->ttl_out_port = jack_port_register (driver->client, "ttl_out",
+                                                   JACK_DEFAULT_MIDI_TYPE,
+                                                   JackPortIsInput|JackPortIsTerminal, 0);
+        if (driver->ttl_out_port == 0) {
+                jack_error ("RHD2K: cannot register port for ttl_out");
+                return -1;
+        }
+        driver->ttl_out_request = 0;
+        driver->ttl_out_waiting = 0;
+        return 0;
+}
+
+void
+rhd2k_ttl_detach(rhd2k_driver_t * driver)
+{
+        if (driver->ttl_in_port) {
+                jack_port_unregister (driver->client, driver->ttl_in_port);
+                driver->ttl_in_port = 0;
+        }
+        if (driver->ttl_out_port) {
+                jack_port_unregister (driver->client, driver->ttl_out_port);
+                driver->ttl_out_port = 0;
+        }
+        driver->ttl_in_active = false;
+}
+
+void
+rhd2k_ttl_connected(rhd2k_driver_t * driver, bool connected)
+{
+        if (connected && !driver->ttl_in_active) {
+                // no edges for the state the inputs were already in
+                char const * frame = static_cast<char const *>(driver->buffer);
+                driver->ttl_in_state = frame_ttl_in(frame, driver->dev->frame_size());
+        }
+        driver->ttl_in_active = connected;
+}
+
+/* time an output update, if one is waiting for the board */
+static void
+ttl_out_check(rhd2k_driver_t * driver, jack_nframes_t nframes)
+{
+        const evalboard::data_type mask = driver->ttl_out_waiting;
+        if (mask == 0) return;
+        const size_t frame_size = driver->dev->frame_size();
+        char const * frame = static_cast<char const *>(driver->buffer);
+        for (jack_nframes_t t = 0; t < nframes; ++t, frame += frame_size) {
+                if ((frame_ttl_out(frame, frame_size) & mask) != driver->ttl_out_expected)
+                        continue;
+                const uint32_t frames = frame_timestamp(frame) - driver->ttl_out_sent;
+                // timestamps restart after an xrun
+                if (frames < driver->dev->sampling_rate()) {
+                        const uint64_t ns = frames * 1000000000ULL / driver->dev->sampling_rate();
+                        rhd2k_hist_record(driver->stats->stages[RHD2K_STAGE_TTL_OUT], ns);
+                }
+                driver->ttl_out_waiting = 0;
+                return;
+        }
+}
+
+void
+rhd2k_ttl_read(rhd2k_driver_t * driver, jack_nframes_t nframes)
+{
+        ttl_out_check(driver, nframes);
+        if (!driver->ttl_in_active) return;
+        void * buf = jack_port_get_buffer (driver->ttl_in_port, nframes);
+        jack_midi_clear_buffer(buf);
+
+        // there can't be more changes than frames, so each chunk of frames
+        // fits in edges
+        const size_t frame_size = driver->dev->frame_size();
+        ttl_edge_t edges[max_edges];
+        long dropped = 0;
+        for (size_t t = 0; t < nframes; t += max_edges) {
+                const size_t n = std::min<size_t>(nframes - t, max_edges);
+                char const * frames = static_cast<char const *>(driver->buffer) + t * frame_size;
+                const size_t nedges = find_ttl_edges(frames, n, frame_size,
+                                                     &driver->ttl_in_state, edges, max_edges);
+                for (size_t i = 0; i < nedges; ++i) {
+                        const jack_nframes_t time = t + edges[i].frame;
+                        for (unsigned bit = 0; bit < 16; ++bit) {
+                                const evalboard::data_type mask = 1U << bit;
+                                if (!((edges[i].rising | edges[i].falling) & mask)) continue;
+                                jack_midi_data_t * ev = jack_midi_event_reserve(buf, time, 3);
+                                if (ev == 0) {
+                                        dropped += 1;
+                                        continue;
+                                }
+                                ev[0] = (edges[i].rising & mask) ? midi_note_on : midi_note_off;
+                                ev[1] = bit;
+                                ev[2] = (edges[i].rising & mask) ? 127 : 0;
+                        }
+                }
+        }
+        if (dropped) {
+                rhd2k_log(driver->process_log, RHD2K_LOG_MIDI_FULL, driver->last_frame, 0,
+                          0.0f, dropped);
+        }
+}
+
+void
+rhd2k_ttl_write(rhd2k_driver_t * driver, jack_nframes_t nframes)
+{
+        void * buf = jack_port_get_buffer (driver->ttl_out_port, nframes);
+        const uint32_t nevents = jack_midi_get_event_count(buf);
+        if (nevents == 0) return;
+
+        // later events for the same output win
+        evalboard::data_type value = 0, mask = 0;
+        jack_midi_event_t ev;
+        for (uint32_t i = 0; i < nevents; ++i) {
+                if (jack_midi_event_get(&ev, buf, i) || ev.size < 3) continue;
+                const jack_midi_data_t status = ev.buffer[0] & 0xf0;
+                const jack_midi_data_t note = ev.buffer[1];
+                if (note >= 16 || (status != midi_note_on && status != midi_note_off)) continue;
+                const evalboard::data_type bit = 1U << note;
+                mask |= bit;
+                if (status == midi_note_on && ev.buffer[2] > 0)
+                        value |= bit;
+                else
+                        value &= ~bit;
+        }
+        if (mask == 0) return;
+
+        // merge with any update the worker hasn't taken yet
+        uint32_t old, merged;
+        do {
+                old = driver->ttl_out_request;
+                const uint32_t old_value = old & 0xffff;
+                const uint32_t old_mask = old >> 16;
+                merged = ((old_mask | mask) << 16) | (old_value & ~mask) | value;
+        } while (!__sync_bool_compare_and_swap(&driver->ttl_out_request, old, merged));
+        rhd2k_worker_wake(driver);
+
+        // time the update if it changes anything and no other is being timed
+        if (driver->ttl_out_waiting == 0) {
+                const size_t frame_size = driver->dev->frame_size();
+                char const * last = static_cast<char const *>(driver->buffer) +
+                        (nframes - 1) * frame_size;
+                if ((frame_ttl_out(last, frame_size) & mask) != value) {
+                        driver->ttl_out_waiting = mask;
+                        driver->ttl_out_expected = value;
+                        driver->ttl_out_sent = frame_timestamp(last) + 1;
+                }
+        }
+}
+
+void
+rhd2k_ttl_apply(rhd2k_driver_t * driver)
+{
+        const uint32_t request = __sync_lock_test_and_set(&driver->ttl_out_request, 0);
+        if (request) {
+                pthread_mutex_lock(&driver->dev_lock);
+                driver->dev->ttl_out(request & 0xffff, request >> 16);
+                pthread_mutex_unlock(&driver->dev_lock);
+        }
+}
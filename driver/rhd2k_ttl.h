@@ -0,0 +1,59 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   TTL inputs as MIDI events. Every frame carries the state of the 16 TTL
+ *   inputs, so changes can be timed to the frame without polling the
+ *   board. While the ttl_in port is connected, the process thread scans
+ *   the period for changes and writes a note on (rising edge) or note off
+ *   (falling edge) event on MIDI channel 1 for each input that changed,
+ *   with the input number (0-15) as the note and the frame as the event
+ *   time. The state before the first frame after the port is connected is
+ *   taken from that frame, so no events are sent for inputs that were
+ *   already high.
+ *
+ *   The ttl_out port is a MIDI input. Note on events for notes 0-15 set the
+ *   corresponding TTL output high, and note off events (or note on with
+ *   velocity 0) set it low. Setting the outputs is a USB transaction, so
+ *   the process thread only merges each cycle's events into a pending
+ *   update, which the worker thread applies. Each frame carries the state
+ *   of the outputs, so the process thread can time how long an update
+ *   takes to reach the board: from the end of the period in which it was
+ *   sent to the first frame with the new outputs. The times are recorded
+ *   under the "ttl_out" stage of the timing statistics.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_TTL_H
+#define __RHD2K_TTL_H
+
+#include "jack_rhd2k_driver.h"
+
+/** register the ttl_in and ttl_out ports; ttl_in's index follows the packed ports */
+int rhd2k_ttl_attach(rhd2k_driver_t * driver);
+
+void rhd2k_ttl_detach(rhd2k_driver_t * driver);
+
+/** called by the process thread when the port is connected or disconnected */
+void rhd2k_ttl_connected(rhd2k_driver_t * driver, bool connected);
+
+/**
+ * write the period's TTL input changes to the port, if it's connected, and
+ * look for the outputs requested by the last update
+ */
+void rhd2k_ttl_read(rhd2k_driver_t * driver, jack_nframes_t nframes);
+
+/** merge the events on the ttl_out port into the pending update */
+void rhd2k_ttl_write(rhd2k_driver_t * driver, jack_nframes_t nframes);
+
+/**
+ * take the pending update, and if there is one set the outputs. Called by
+ * the worker thread, which must not hold dev_lock.
+ */
+void rhd2k_ttl_apply(rhd2k_driver_t * driver);
+
+#endif
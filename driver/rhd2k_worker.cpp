@@ -0,0 +1,248 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Non-realtime worker thread that performs USB transactions on behalf of
+ *   the process thread.
+ *
+ *   Every wire-in update costs a USB round trip of a millisecond or more, so
+ *   none of these are done in the process thread. Instead, commands are
+ *   queued and this thread applies them. The device lock is only held for
+ *   each USB transaction, not for the work of deciding what to send, so a
+ *   process cycle that needs the board waits for at most one transaction.
+ *   TTL output updates from the ttl_out port (see rhd2k_ttl.h) and
+ *   amplifier holds for artifact blanking (see rhd2k_blank.h) are applied
+ *   the same way.
+ *
+ *   Hardware monitoring is also handled here. JACK does not notify drivers
+ *   when a client requests monitoring on a port, so the worker rescans the
+ *   monitoring flags every rhd2k_monitor_scan_msecs. When a capture port's
+ *   connections change, only that port is rechecked. Only DACs whose
+ *   assignment changed are reprogrammed.
+ *
+ *   The worker also emits messages logged by the realtime threads (see
+ *   rhd2k_log.h) on each pass, and updates the capture latency reported to
+ *   JACK. The realtime threads measure how old the oldest frame of each
+ *   period is, which depends on the FIFO backlog and the USB transfer time
+ *   rather than just on the settings. When the range over the last
+ *   rhd2k_latency_window cycles drifts by more than
+ *   rhd2k_latency_drift_usecs, the worker asks the engine to recompute the
+ *   graph's latencies, which calls the driver's latency callback outside the
+ *   process thread.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <time.h>
+
+#include "rhd2k_worker.h"
+#include "rhd2k_blank.h"
+#include "rhd2k_boards.h"
+#include "rhd2k_control.h"
+#include "rhd2k_ttl.h"
+
+using std::size_t;
+using namespace rhd2k;
+
+/*
+ * compare the requested monitoring state of the ports to the current DAC
+ * assignments and update the DACs that need to change. If rescan is false,
+ * only the ports marked in monitor_dirty_ports are checked. Takes dev_lock
+ * around each DAC update.
+ */
+static void
+worker_update_monitors(rhd2k_driver_t * driver, bool rescan)
+{
+        const size_t available_dacs = driver->dev->dac_nchannels();
+        std::vector<evalboard::channel_info_t> const & table = driver->dev->adc_table();
+        std::vector<char> & wanted = driver->monitor_wanted;
+        std::vector<char> & dirty = driver->monitor_dirty_ports;
+        size_t chan, dac;
+
+        // only the first board's channels can be monitored on its DACs, and
+        // only if they're offset binary
+        if (wanted.size() != table.size()) {
+                wanted.assign(table.size(), 0);
+                rescan = true;
+        }
+        const bool twoscomp = driver->dev->twoscomp();
+        for (chan = 0; chan < table.size(); ++chan) {
+                if (!__sync_lock_test_and_set(&dirty[chan], 0) && !rescan) continue;
+                wanted[chan] = !twoscomp && table[chan].stream != evalboard::EvalADC &&
+                        jack_port_monitoring_input(driver->capture_ports[chan]) != 0;
+        }
+
+        // release DACs for channels that no longer want monitoring
+        std::vector<char> unassigned(wanted);
+        for (dac = 0; dac < available_dacs; ++dac) {
+                long c = driver->dac_channel[dac];
+                if (c < 0 || (driver->dac_pinned & (1UL << dac))) continue;
+                if (unassigned[c]) {
+                        unassigned[c] = 0;
+                }
+                else {
+                        pthread_mutex_lock(&driver->dev_lock);
+                        driver->dev->dac_disable(dac);
+                        pthread_mutex_unlock(&driver->dev_lock);
+                        driver->dac_channel[dac] = -1;
+                }
+        }
+
+        // assign remaining requests to free DACs
+        dac = 0;
+        for (chan = 0; chan < unassigned.size(); ++chan) {
+                if (!unassigned[chan]) continue;
+                while (dac < available_dacs &&
+                       (driver->dac_channel[dac] >= 0 || (driver->dac_pinned & (1UL << dac))))
+                        ++dac;
+                if (dac >= available_dacs) break;
+                pthread_mutex_lock(&driver->dev_lock);
+                driver->dev->dac_monitor(dac, chan);
+                pthread_mutex_unlock(&driver->dev_lock);
+                driver->dac_channel[dac] = chan;
+        }
+}
+
+/* report the measured capture latency if it has drifted */
+static void
+worker_update_latency(rhd2k_driver_t * driver)
+{
+        if (driver->latency_count < rhd2k_latency_window) return;
+        jack_nframes_t lo = driver->latency_window[0];
+        jack_nframes_t hi = lo;
+        for (size_t i = 1; i < rhd2k_latency_window; ++i) {
+                const jack_nframes_t v = driver->latency_window[i];
+                if (v < lo) lo = v;
+                if (v > hi) hi = v;
+        }
+        const jack_nframes_t drift = rhd2k_latency_drift_usecs * 1e-6 * driver->dev->sampling_rate();
+        const jack_nframes_t min = driver->latency_min;
+        const jack_nframes_t max = driver->latency_max;
+        if (lo + drift >= min && lo <= min + drift && hi + drift >= max && hi <= max + drift)
+                return;
+
+        driver->latency_min = lo;
+        driver->latency_max = hi;
+        jack_info("RHD2K: capture latency is now %u--%u frames", lo, hi);
+        jack_recompute_total_latencies(driver->client);
+}
+
+/* set ts to the current time (CLOCK_MONOTONIC) plus msecs */
+static void
+worker_deadline(struct timespec * ts, long msecs)
+{
+        clock_gettime(CLOCK_MONOTONIC, ts);
+        ts->tv_nsec += msecs * 1000000L;
+        ts->tv_sec += ts->tv_nsec / 1000000000L;
+        ts->tv_nsec %= 1000000000L;
+}
+
+static bool
+worker_passed(struct timespec const * ts)
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec > ts->tv_sec ||
+                (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec);
+}
+
+/*
+ * convert a CLOCK_MONOTONIC time to CLOCK_REALTIME for sem_timedwait. The
+ * deadlines are kept on the monotonic clock so that a step in the wall
+ * clock can't move them.
+ */
+static void
+worker_realtime(struct timespec const * ts, struct timespec * out)
+{
+        struct timespec mono;
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        clock_gettime(CLOCK_REALTIME, out);
+        long long nsecs = (ts->tv_sec - mono.tv_sec) * 1000000000LL + (ts->tv_nsec - mono.tv_nsec);
+        if (nsecs < 0) nsecs = 0;
+        nsecs += out->tv_nsec;
+        out->tv_sec += nsecs / 1000000000LL;
+        out->tv_nsec = nsecs % 1000000000LL;
+}
+
+static void *
+worker_thread(void * arg)
+{
+        rhd2k_driver_t * driver = static_cast<rhd2k_driver_t *>(arg);
+        struct timespec next_scan, wake, deadline;
+
+        worker_deadline(&next_scan, 0);
+        wake = next_scan;
+        while (driver->worker_running) {
+                worker_realtime(&wake, &deadline);
+                sem_timedwait(&driver->worker_wakeup, &deadline);
+                if (!driver->worker_running) break;
+
+                rhd2k_control_apply(driver);
+                rhd2k_ttl_apply(driver);
+                if (worker_passed(&next_scan)) {
+                        __sync_lock_test_and_set(&driver->monitor_dirty, 0);
+                        worker_update_monitors(driver, true);
+                        worker_deadline(&next_scan, rhd2k_monitor_scan_msecs);
+                }
+                else if (__sync_lock_test_and_set(&driver->monitor_dirty, 0)) {
+                        worker_update_monitors(driver, false);
+                }
+                // a hold being released may need an earlier pass
+                wake = next_scan;
+                rhd2k_blank_apply(driver, &wake);
+
+                rhd2k_log_flush(driver->process_log, "process");
+                rhd2k_log_flush(driver->reader_log, "reader");
+                rhd2k_boards_flush_logs(driver);
+                worker_update_latency(driver);
+        }
+        return 0;
+}
+
+int
+rhd2k_worker_start(rhd2k_driver_t * driver)
+{
+        driver->dac_channel.assign(driver->dev->dac_nchannels(), -1);
+        driver->monitor_wanted.clear();
+        driver->monitor_dirty_ports.assign(driver->dev->adc_table().size(), 1);
+        driver->monitor_dirty = 1;
+        driver->worker_running = true;
+        if (pthread_create(&driver->worker_thread, 0, worker_thread, driver) != 0) {
+                jack_error("RHD2K: unable to start worker thread");
+                driver->worker_running = false;
+                return -1;
+        }
+        return 0;
+}
+
+void
+rhd2k_worker_stop(rhd2k_driver_t * driver)
+{
+        if (!driver->worker_running) return;
+        driver->worker_running = false;
+        sem_post(&driver->worker_wakeup);
+        pthread_join(driver->worker_thread, 0);
+        // anything logged since the last pass, e.g. the cause of a shutdown
+        rhd2k_log_flush(driver->process_log, "process");
+        rhd2k_log_flush(driver->reader_log, "reader");
+        rhd2k_boards_flush_logs(driver);
+}
+
+void
+rhd2k_worker_wake(rhd2k_driver_t * driver)
+{
+        sem_post(&driver->worker_wakeup);
+}
+
+void
+rhd2k_worker_monitors_changed(rhd2k_driver_t * driver, long channel)
+{
+        if (channel >= 0 && (size_t)channel < driver->monitor_dirty_ports.size())
+                __sync_lock_test_and_set(&driver->monitor_dirty_ports[channel], 1);
+        __sync_lock_test_and_set(&driver->monitor_dirty, 1);
+        sem_post(&driver->worker_wakeup);
+}
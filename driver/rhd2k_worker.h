@@ -0,0 +1,41 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Non-realtime worker thread that performs USB transactions on behalf of
+ *   the process thread.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_WORKER_H
+#define __RHD2K_WORKER_H
+
+#include "jack_rhd2k_driver.h"
+
+/** how often to rescan ports for monitor requests (ms) */
+static const long rhd2k_monitor_scan_msecs = 100;
+
+/** start the worker thread. returns 0 on success */
+int rhd2k_worker_start(rhd2k_driver_t * driver);
+
+/** stop the worker thread */
+void rhd2k_worker_stop(rhd2k_driver_t * driver);
+
+/**
+ * Wake up the worker thread, e.g. after queuing a command. Safe to call from
+ * any thread, including the process thread.
+ */
+void rhd2k_worker_wake(rhd2k_driver_t * driver);
+
+/**
+ * Ask the worker to re-evaluate whether a channel's port needs hardware
+ * monitoring, or (channel < 0) just to reassign the DACs. Safe to call from
+ * any thread.
+ */
+void rhd2k_worker_monitors_changed(rhd2k_driver_t * driver, long channel=-1);
+
+#endif
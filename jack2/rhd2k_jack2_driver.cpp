@@ -0,0 +1,463 @@
+/*
+ *   Intan RHD2000 eval board Backend for JACK2
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+
+#include "JackCompilerDeps.h"
+#include "JackDriverLoader.h"
+#include "JackThreadedDriver.h"
+#include "JackError.h"
+#include "JackTime.h"
+
+#include "rhd2000cycle.hpp"
+#include "rhd2000calibrate.hpp"
+#include "rhd2000frame.hpp"
+#include "rhd2k_jack2_driver.h"
+
+using std::size_t;
+using namespace rhd2k;
+
+namespace Jack {
+
+JackRHD2KDriver::JackRHD2KDriver(char const * name, char const * alias, JackLockedEngine * engine,
+                                 JackSynchro * table)
+        : JackAudioDriver(name, alias, engine, table), _dev(0), _buffer(0), _last_frame(0),
+          _fifo_latency(0)
+{}
+
+JackRHD2KDriver::~JackRHD2KDriver()
+{
+        delete _dev;
+        free(_buffer);
+}
+
+int
+JackRHD2KDriver::Open(char const * serial, char const * firmware,
+                      rhd2k_jack_settings_t const & settings)
+{
+        jack_nframes_t period_size = settings.period_size;
+        try {
+                _dev = new evalboard(settings.sample_rate, serial, firmware, getenv("JACK_DRIVER_DIR"));
+                jack_info("RHD2K: scanning SPI ports");
+                const size_t saved = rhd2k_configure_board(_dev, settings);
+                jack_info("RHD2K: %zu USB streams in use (%zu bytes/s less than all %zu)",
+                          _dev->streams_enabled(), saved, evalboard::nmiso);
+                _fifo_latency = settings.capture_frame_latency;
+
+                if (settings.autotune) {
+                        calibration_options options;
+                        options.target = atof(settings.autotune);
+                        if (!(options.target > 0 && options.target < 1)) {
+                                throw daq_error("auto-tune target must be between 0 and 1");
+                        }
+                        jack_info("RHD2K: calibrating USB latency (target xrun probability %g)",
+                                  options.target);
+                        calibration_result cal = calibrate(*_dev, options);
+                        std::cout << cal << std::endl;
+                        if (cal.ok) {
+                                period_size = cal.read_size;
+                                _fifo_latency = cal.headroom;
+                        }
+                        else {
+                                jack_error("RHD2K: calibration didn't meet the target; keeping "
+                                           "the requested period and FIFO latency");
+                        }
+                }
+        }
+        catch (std::runtime_error const & e) {
+                jack_error("RHD2K: fatal error: %s", e.what());
+                return -1;
+        }
+
+        const size_t nchannels = _dev->adc_table().size();
+        if (nchannels > DRIVER_PORT_NUM) {
+                jack_error("RHD2K: %zu channels is more than JACK2 allows (%d)", nchannels,
+                           DRIVER_PORT_NUM);
+                return -1;
+        }
+        _buffer = malloc(_dev->frame_size() * period_size);
+        if (_buffer == 0) {
+                jack_error ("RHD2K: unable to allocate buffer");
+                return -1;
+        }
+        std::cout << *_dev
+                  << "\nperiod = " << period_size << " frames"
+                  << "\nFIFO buffering = " << _fifo_latency << " frames" << std::endl;
+
+        // the FIFO latency is reported as extra capture latency
+        return JackAudioDriver::Open(period_size, _dev->sampling_rate(), true, false,
+                                     nchannels, 0, false, "rhd2000", "", _fifo_latency, 0);
+}
+
+int
+JackRHD2KDriver::Close()
+{
+        int res = JackAudioDriver::Close();
+        delete _dev;
+        _dev = 0;
+        free(_buffer);
+        _buffer = 0;
+        return res;
+}
+
+/* register a port for each channel, named as in the JACK1 driver */
+int
+JackRHD2KDriver::Attach()
+{
+        JackPort * port;
+        jack_port_id_t port_index;
+        char name[REAL_JACK_PORT_NAME_SIZE + 1];
+        char alias[REAL_JACK_PORT_NAME_SIZE + 1];
+
+        std::vector<evalboard::channel_info_t> const & table = _dev->adc_table();
+        for (int i = 0; i < fCaptureChannels; ++i) {
+                snprintf(name, sizeof(name), "%s:%s", fClientControl.fName, table[i].name.c_str());
+                snprintf(alias, sizeof(alias), "%s:%s", fAliasName, table[i].name.c_str());
+                if (fEngine->PortRegister(fClientControl.fRefNum, name, JACK_DEFAULT_AUDIO_TYPE,
+                                          CaptureDriverFlags, fEngineControl->fBufferSize,
+                                          &port_index) < 0) {
+                        jack_error("RHD2K: cannot register port for %s", name);
+                        return -1;
+                }
+                port = fGraphManager->GetPort(port_index);
+                port->SetAlias(alias);
+                fCapturePortList[i] = port_index;
+        }
+        UpdateLatencies();
+        return 0;
+}
+
+int
+JackRHD2KDriver::Start()
+{
+        int res = JackAudioDriver::Start();
+        if (res < 0) return res;
+        if (!start_acquisition(*_dev, _buffer, fEngineControl->fBufferSize, _fifo_latency)) {
+                jack_error("RHD2K: failed to start acquisition");
+                JackAudioDriver::Stop();
+                return -1;
+        }
+        _last_frame = 0;
+        return 0;
+}
+
+int
+JackRHD2KDriver::Stop()
+{
+        _dev->stop();
+        if (_dev->running()) {
+                jack_error("RHD2K: failed to stop acquisition");
+        }
+        return JackAudioDriver::Stop();
+}
+
+/*
+ * wait for a period to be in the FIFO, read and validate it, and convert
+ * the channels that are connected. If the FIFO was underfull, acquisition
+ * is restarted and the period is read again.
+ */
+int
+JackRHD2KDriver::Read()
+{
+        const size_t period = fEngineControl->fBufferSize;
+        const size_t expected = period + _fifo_latency;
+        const double rate = _dev->sampling_rate();
+
+        for (;;) {
+                const size_t nframes = _dev->nframes();
+                if (nframes < expected) {
+                        usleep(fifo_fill_usecs(nframes, expected, rate));
+                }
+                JackDriver::CycleTakeBeginTime();
+
+                const size_t got = _dev->read (_buffer, period);
+                size_t bad_frame;
+                frame_fault fault;
+                const period_status status = check_period(*_dev, _buffer, period, got, _last_frame,
+                                                          &bad_frame, &fault);
+                if (status == PERIOD_OK) break;
+                if (status != PERIOD_UNDERFULL) {
+                        jack_error("RHD2K: frame %u: %s", _last_frame,
+                                   (status == PERIOD_STOPPED) ?
+                                   "device is not running or was disconnected" :
+                                   "error reading data from device");
+                        return -1;
+                }
+                // see rhd2k_driver_run_cycle in the JACK1 driver
+                jack_error("RHD2K: frame %u: underfull FIFO: first bad frame: %zu (%s)",
+                           _last_frame, bad_frame, frame_fault_name(fault));
+                const jack_time_t stopped = GetMicroSeconds();
+                _dev->stop();
+                if (!start_acquisition(*_dev, _buffer, period, _fifo_latency)) {
+                        jack_error("RHD2K: failed to restart acquisition");
+                        return -1;
+                }
+                _last_frame = 0;
+                NotifyXRun(stopped, GetMicroSeconds() - stopped);
+        }
+        _last_frame += period;
+
+        // only connected ports are converted
+        const size_t frame_size = _dev->frame_size();
+        std::vector<evalboard::channel_info_t> const & table = _dev->adc_table();
+        for (int i = 0; i < fCaptureChannels; ++i) {
+                if (fGraphManager->GetConnectionsNum(fCapturePortList[i]) == 0) continue;
+                evalboard::channel_info_t const & chan = table[i];
+                char const * src = (char const *)_buffer + chan.byte_offset;
+                if (chan.stream == evalboard::EvalADC) {
+                        convert_channel(src, frame_size, period, 0.0f, GetInputBuffer(i));
+                }
+                else if (_dev->twoscomp()) {
+                        convert_channel_signed(src, frame_size, period, GetInputBuffer(i));
+                }
+                else {
+                        // adjust offset of SPI adcs
+                        convert_channel(src, frame_size, period, -1.0f, GetInputBuffer(i));
+                }
+        }
+        return 0;
+}
+
+/* there are no playback ports */
+int
+JackRHD2KDriver::Write()
+{
+        return 0;
+}
+
+int
+JackRHD2KDriver::SetBufferSize(jack_nframes_t buffer_size)
+{
+        void * buffer = realloc(_buffer, _dev->frame_size() * buffer_size);
+        if (buffer == 0) {
+                jack_error ("RHD2K: unable to allocate buffer");
+                return -1;
+        }
+        _buffer = buffer;
+        return JackAudioDriver::SetBufferSize(buffer_size);
+}
+
+} // namespace Jack
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+SERVER_EXPORT jack_driver_desc_t *
+driver_get_descriptor()
+{
+        jack_driver_desc_t * desc;
+        jack_driver_desc_filler_t filler;
+        jack_driver_param_value_t value;
+        char name[32];
+        char short_desc[64];
+        char long_desc[128];
+
+        desc = jack_driver_descriptor_construct("rhd2000", JackDriverMaster,
+                                                "Intan RHD2000 eval board backend", &filler);
+
+        strcpy(value.str, "first connected device");
+        jack_driver_descriptor_add_parameter(desc, &filler, "device", 'd', JackDriverParamString,
+                                             &value, NULL, "serial number of RHD2000 Opal Kelly",
+                                             NULL);
+
+        value.str[0] = '\0';
+        jack_driver_descriptor_add_parameter(desc, &filler, "firmware", 'F', JackDriverParamString,
+                                             &value, NULL, "firmware file for RHD2000 eval board",
+                                             NULL);
+
+        value.ui = default_settings.sample_rate;
+        jack_driver_descriptor_add_parameter(desc, &filler, "rate", 'r', JackDriverParamUInt,
+                                             &value, NULL, "sampling rate (Hz) ", NULL);
+
+        value.ui = default_settings.period_size;
+        jack_driver_descriptor_add_parameter(desc, &filler, "period", 'p', JackDriverParamUInt,
+                                             &value, NULL, "frames per period", NULL);
+
+        for (size_t p = 0; p < evalboard::nmosi; ++p) {
+                const char c = 'A' + p;
+                sprintf(name, "port-%c", c);
+                sprintf(short_desc, "configure port %c", c);
+                sprintf(long_desc,
+                        "configure port %c: channels[,lopass[,hipass[,dsp-hipass[,cable-meters]]]]", c);
+                strcpy(value.str, "0xffffffff,100,3000,1,0");
+                jack_driver_descriptor_add_parameter(desc, &filler, name, c, JackDriverParamString,
+                                                     &value, NULL, short_desc, long_desc);
+        }
+
+        value.ui = default_settings.capture_frame_latency;
+        jack_driver_descriptor_add_parameter(desc, &filler, "input-latency", 'I', JackDriverParamUInt,
+                                             &value, NULL, "extra fifo latency (frames) ", NULL);
+
+        value.ui = default_settings.transfer_size;
+        jack_driver_descriptor_add_parameter(desc, &filler, "transfer", 't', JackDriverParamUInt,
+                                             &value, NULL,
+                                             "frames per USB transfer (not supported by JACK2 backend)",
+                                             NULL);
+
+        value.str[0] = '\0';
+        jack_driver_descriptor_add_parameter(desc, &filler, "control-socket", 'S',
+                                             JackDriverParamString, &value, NULL,
+                                             "path of control socket (not supported by JACK2 backend)",
+                                             NULL);
+        jack_driver_descriptor_add_parameter(desc, &filler, "monitors", 'M', JackDriverParamString,
+                                             &value, NULL,
+                                             "software monitor ports (not supported by JACK2 backend)",
+                                             NULL);
+
+        strcpy(value.str, RHD2K_STATS_DEFAULT_NAME);
+        jack_driver_descriptor_add_parameter(desc, &filler, "stats", 'T', JackDriverParamString,
+                                             &value, NULL,
+                                             "timing statistics (not supported by JACK2 backend)",
+                                             NULL);
+
+        value.str[0] = '\0';
+        jack_driver_descriptor_add_parameter(desc, &filler, "auto-tune", 'a', JackDriverParamString,
+                                             &value, NULL,
+                                             "choose period and FIFO latency (target xrun probability)",
+                                             "measure USB latency at startup and choose the smallest "
+                                             "period and FIFO latency that meet this xrun probability, "
+                                             "e.g. 0.001. Overrides -p and -I.");
+        jack_driver_descriptor_add_parameter(desc, &filler, "boards", 'b', JackDriverParamString,
+                                             &value, NULL,
+                                             "additional boards (not supported by JACK2 backend)",
+                                             NULL);
+
+        value.i = default_settings.sync_bit;
+        jack_driver_descriptor_add_parameter(desc, &filler, "sync", 'y', JackDriverParamInt,
+                                             &value, NULL,
+                                             "TTL sync input (not supported by JACK2 backend)",
+                                             NULL);
+
+        value.i = default_settings.twoscomp;
+        jack_driver_descriptor_add_parameter(desc, &filler, "twos-complement", 'z', JackDriverParamBool,
+                                             &value, NULL,
+                                             "read signed samples from the amplifiers",
+                                             NULL);
+
+        strcpy(value.str, "");
+        jack_driver_descriptor_add_parameter(desc, &filler, "packed", 'P', JackDriverParamString,
+                                             &value, NULL,
+                                             "packed ports (not supported by JACK2 backend)",
+                                             NULL);
+
+        value.i = default_settings.packed_raw;
+        jack_driver_descriptor_add_parameter(desc, &filler, "raw-packed", 'R', JackDriverParamBool,
+                                             &value, NULL,
+                                             "raw packed ports (not supported by JACK2 backend)",
+                                             NULL);
+
+        strcpy(value.str, "");
+        jack_driver_descriptor_add_parameter(desc, &filler, "epochs", 'e', JackDriverParamString,
+                                             &value, NULL,
+                                             "triggered capture (not supported by JACK2 backend)",
+                                             NULL);
+
+        strcpy(value.str, default_settings.epoch_dir);
+        jack_driver_descriptor_add_parameter(desc, &filler, "epoch-dir", 'o', JackDriverParamString,
+                                             &value, NULL,
+                                             "directory for triggered captures (not supported by JACK2 backend)",
+                                             NULL);
+
+        strcpy(value.str, "");
+        jack_driver_descriptor_add_parameter(desc, &filler, "blank", 'k', JackDriverParamString,
+                                             &value, NULL,
+                                             "artifact blanking (not supported by JACK2 backend)",
+                                             NULL);
+
+        value.ui = 0;
+        jack_driver_descriptor_add_parameter(desc, &filler, "version", 'V', JackDriverParamUInt,
+                                             &value, NULL, "driver version is 0.1.0 (option ignored) ",
+                                             NULL);
+        return desc;
+}
+
+SERVER_EXPORT Jack::JackDriverClientInterface *
+driver_initialize(Jack::JackLockedEngine * engine, Jack::JackSynchro * table, const JSList * params)
+{
+        const JSList * node;
+        const jack_driver_param_t * param;
+
+        rhd2k_jack_settings_t settings;
+        memcpy(&settings, &default_settings, sizeof(settings));
+
+        char const * dev_serial = 0;
+        char const * firmware = 0;
+
+        for (node = params; node; node = jack_slist_next (node)) {
+                param = (const jack_driver_param_t *) node->data;
+
+                switch (param->character) {
+                case 'd':
+                        dev_serial = param->value.str;
+                        break;
+                case 'F':
+                        firmware = param->value.str;
+                        break;
+                case 'r':
+                        settings.sample_rate = param->value.ui;
+                        break;
+                case 'p':
+                        settings.period_size = param->value.ui;
+                        break;
+                case 'I':
+                        settings.capture_frame_latency = param->value.ui;
+                        break;
+                case 'a':
+                        settings.autotune = param->value.str;
+                        break;
+                case 'z':
+                        settings.twoscomp = param->value.i;
+                        break;
+                case 't':
+                case 'S':
+                case 'M':
+                case 'T':
+                case 'b':
+                case 'y':
+                case 'P':
+                case 'R':
+                case 'e':
+                case 'o':
+                case 'k':
+                        jack_info("RHD2K: -%c is not supported by the JACK2 backend; ignored",
+                                  param->character);
+                        break;
+                case 'V':
+                        break;
+                default:        // any other valid option refers to a port
+                        parse_port_config(param->character, param->value.str, settings);
+                }
+        }
+
+        Jack::JackRHD2KDriver * rhd2k_driver = new Jack::JackRHD2KDriver("system", "rhd2000",
+                                                                         engine, table);
+        Jack::JackDriverClientInterface * driver = new Jack::JackThreadedDriver(rhd2k_driver);
+        if (rhd2k_driver->Open(dev_serial, firmware, settings) == 0) {
+                return driver;
+        }
+        delete driver;
+        return NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,67 @@
+/*
+ *   Intan RHD2000 eval board Backend for JACK2
+ *
+ *   The JACK1 driver (driver/) is built against the JACK1 engine internals.
+ *   This is the same backend for JACK2's driver model: the driver runs in
+ *   its own thread (JackThreadedDriver), and Read() polls the eval board's
+ *   FIFO, waits for a period to arrive, and reads it. In asynchronous mode
+ *   (the JACK2 default), clients process the previous period while the
+ *   driver waits on the USB bus, which hides most of the transfer time.
+ *
+ *   It takes the same parameters as the JACK1 driver, but only the options
+ *   that configure the board and the period (-d, -F, -r, -p, -I, -a, and
+ *   -A through -D) are supported for now. The others are accepted and
+ *   ignored with a warning.
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#ifndef __RHD2K_JACK2_DRIVER_H
+#define __RHD2K_JACK2_DRIVER_H
+
+#include <stdint.h>
+#include "JackAudioDriver.h"
+#include "rhd2000eval.hpp"
+#include "rhd2k_settings.h"
+
+namespace Jack {
+
+class JackRHD2KDriver : public JackAudioDriver {
+
+public:
+        JackRHD2KDriver(char const * name, char const * alias, JackLockedEngine * engine,
+                        JackSynchro * table);
+        virtual ~JackRHD2KDriver();
+
+        /**
+         * Connect to the eval board, configure the amplifiers, and open the
+         * driver with a capture channel for each entry in the ADC table.
+         *
+         * @return 0 on success
+         */
+        int Open(char const * serial, char const * firmware, rhd2k_jack_settings_t const & settings);
+        int Close();
+
+        int Attach();
+        int Start();
+        int Stop();
+
+        int Read();
+        int Write();
+
+        int SetBufferSize(jack_nframes_t buffer_size);
+
+private:
+        rhd2k::evalboard * _dev;
+        void * _buffer;
+        uint32_t _last_frame;           // the timestamp in the RHD data stream
+        jack_nframes_t _fifo_latency;   // extra fifo buffering, in frames
+};
+
+} // namespace Jack
+
+#endif
@@ -0,0 +1,179 @@
+#include <math.h>
+#include "rhd2000align.hpp"
+#include "rhd2000frame.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+
+rhd2k::clock_phase::clock_phase(double sampling_rate, double time_constant)
+        : _rate(sampling_rate), _tau(time_constant), _value(0), _count(0), _last_ns(0),
+          _seq(0), _pub_value(0), _pub_count(0)
+{}
+
+void
+rhd2k::clock_phase::reset()
+{
+        _count = 0;
+        publish();
+}
+
+void
+rhd2k::clock_phase::publish()
+{
+        _seq = _seq + 1;
+        __sync_synchronize();
+        _pub_value = _value;
+        _pub_count = _count;
+        __sync_synchronize();
+        _seq = _seq + 1;
+}
+
+bool
+rhd2k::clock_phase::snapshot(double * value) const
+{
+        unsigned long seq, count;
+        double v;
+        do {
+                seq = _seq;
+                __sync_synchronize();
+                v = _pub_value;
+                count = _pub_count;
+                __sync_synchronize();
+        } while ((seq & 1) || seq != _seq);
+        *value = v;
+        return count > 0;
+}
+
+void
+rhd2k::clock_phase::observe(uint32_t timestamp, uint64_t host_ns)
+{
+        const double phase = timestamp - _rate * (host_ns * 1e-9);
+        if (_count == 0) {
+                _value = phase;
+        }
+        else {
+                const double alpha = 1.0 - exp(-1e-9 * (host_ns - _last_ns) / _tau);
+                _value = _value + alpha * (phase - _value);
+        }
+        _last_ns = host_ns;
+        _count = _count + 1;
+        publish();
+}
+
+size_t
+rhd2k::find_rising_edge(void const * buf, size_t nframes, size_t frame_size, unsigned bit,
+                        bool * level)
+{
+        char const * frame = static_cast<char const *>(buf);
+        const evalboard::data_type mask = 1U << bit;
+        bool last = *level;
+        for (size_t t = 0; t < nframes; ++t, frame += frame_size) {
+                const bool high = (frame_ttl_in(frame, frame_size) & mask) != 0;
+                if (high && !last) {
+                        // level reflects the last frame even if we stop early
+                        char const * end = static_cast<char const *>(buf) + (nframes - 1) * frame_size;
+                        *level = (frame_ttl_in(end, frame_size) & mask) != 0;
+                        return t;
+                }
+                last = high;
+        }
+        *level = last;
+        return nframes;
+}
+
+size_t
+rhd2k::rising_edges::next(void const * buf, size_t nframes, size_t frame_size, size_t from)
+{
+        if (from >= nframes) return nframes;
+        char const * frame = static_cast<char const *>(buf) + from * frame_size;
+        if (!_started) {
+                _level = (frame_ttl_in(frame, frame_size) >> _bit) & 1;
+                _started = true;
+        }
+        const size_t i = find_rising_edge(frame, nframes - from, frame_size, _bit, &_level);
+        if (i == nframes - from) return nframes;
+        // the frame with the edge is high
+        _level = true;
+        return from + i;
+}
+
+struct ignore_edge {
+        void operator()(size_t) const {}
+};
+
+size_t
+rhd2k::rising_edges::count(void const * buf, size_t nframes, size_t frame_size)
+{
+        return scan(buf, nframes, frame_size, ignore_edge());
+}
+
+const double rhd2k::board_alignment::synced_deadband = 0.5;
+const double rhd2k::board_alignment::estimated_deadband = 4.0;
+
+rhd2k::board_alignment::board_alignment(double sampling_rate)
+        : _max_mismatch(0.25 * sampling_rate)
+{
+        reset();
+}
+
+void
+rhd2k::board_alignment::reset()
+{
+        _synced = false;
+        _sync_offset = _sync_phase = 0;
+        _pending[0] = _pending[1] = false;
+        _edge[0] = _edge[1] = 0;
+}
+
+void
+rhd2k::board_alignment::sync_edge(bool secondary, uint32_t timestamp, double phase_offset,
+                                  bool phase_valid)
+{
+        _edge[secondary] = timestamp;
+        _pending[secondary] = true;
+        if (!(_pending[0] && _pending[1])) return;
+
+        const double measured = (int32_t)(_edge[1] - _edge[0]);
+        double predicted;
+        if (offset(phase_offset, phase_valid, &predicted) &&
+            fabs(measured - predicted) > _max_mismatch) {
+                // not the same pulse. discard the edge that happened first
+                // (in reference time); its partner has already gone by
+                const double secondary_in_ref = _edge[1] - predicted;
+                if (secondary_in_ref < (double)_edge[0]) _pending[1] = false;
+                else _pending[0] = false;
+                return;
+        }
+        _synced = true;
+        _sync_offset = measured;
+        _sync_phase = (phase_valid) ? phase_offset : 0;
+        _pending[0] = _pending[1] = false;
+}
+
+bool
+rhd2k::board_alignment::offset(double phase_offset, bool phase_valid, double * out) const
+{
+        if (_synced) {
+                // follow drift since the last edges
+                *out = _sync_offset + ((phase_valid) ? phase_offset - _sync_phase : 0.0);
+                return true;
+        }
+        if (phase_valid) {
+                *out = phase_offset;
+                return true;
+        }
+        return false;
+}
+
+long
+rhd2k::board_alignment::correction(double offset, uint32_t ref_next, uint32_t board_next,
+                                   long max_step) const
+{
+        const double error = offset - (int32_t)(board_next - ref_next);
+        const double deadband = (_synced) ? synced_deadband : estimated_deadband;
+        if (fabs(error) <= deadband) return 0;
+        long step = lround(error);
+        if (step > max_step) step = max_step;
+        if (step < -max_step) step = -max_step;
+        return step;
+}
@@ -0,0 +1,187 @@
+#ifndef _RHD2000ALIGN_H
+#define _RHD2000ALIGN_H
+
+#include <stdint.h>
+#include <cstddef>
+
+/*
+ * Aligning the data from several eval boards. Each board runs off its own
+ * crystal and is started by a separate USB command, so the timestamps of
+ * frames acquired at the same moment differ by an offset, which drifts by a
+ * few frames a minute. One board (the reference) drives the JACK cycle, and
+ * the others are brought into line with it by dropping or repeating frames.
+ *
+ * The offset is estimated in one of two ways:
+ *
+ * - from the host clock. Each board's reader notes when each transfer
+ *   arrives. The difference between two boards' clock phases (timestamp
+ *   minus nominal rate times host time) is the offset, plus the difference
+ *   in their USB latencies, which averages out. This is accurate to a few
+ *   frames.
+ *
+ * - from a TTL sync signal wired to the same digital input on every board.
+ *   Matching rising edges give the offset exactly; the host clock is only
+ *   used to follow the drift between edges. Edges on the two boards are
+ *   matched if they are within a quarter of a second of where they are
+ *   expected to be, so the sync pulses need to be more than half a second
+ *   apart.
+ *
+ * Frames are dropped from or repeated on a secondary board only when the
+ * estimated error exceeds a deadband (half a frame when synced, 4 frames
+ * otherwise), and by at most one period per cycle.
+ */
+namespace rhd2k {
+
+/**
+ * The phase of a board's sample clock relative to the host clock, smoothed
+ * with an exponential filter. Written by one thread (observe() and reset());
+ * other threads read the published value with snapshot(), which is guarded
+ * by a sequence counter so that they never see a value and count from
+ * different updates.
+ */
+class clock_phase {
+
+public:
+        /** @param time_constant  of the filter, in seconds */
+        clock_phase(double sampling_rate, double time_constant=5.0);
+
+        /** forget all observations, e.g. after the board restarts */
+        void reset();
+
+        /**
+         * Record that the board had acquired timestamp frames (i.e., one past
+         * the last frame read) at host time host_ns (CLOCK_MONOTONIC).
+         */
+        void observe(uint32_t timestamp, uint64_t host_ns);
+
+        /**
+         * Read the phase (timestamp - sampling_rate * host time, in frames).
+         * Safe to call from any thread.
+         *
+         * @return false if there are no observations since the last reset
+         */
+        bool snapshot(double * value) const;
+
+private:
+        void publish();
+
+        const double _rate;
+        const double _tau;
+        // the writer's state
+        double _value;
+        unsigned long _count;
+        uint64_t _last_ns;
+        // published copy; _seq is odd while it's being updated
+        volatile unsigned long _seq;
+        volatile double _pub_value;
+        volatile unsigned long _pub_count;
+};
+
+/**
+ * Find the first rising edge of a TTL input in a buffer of frames.
+ *
+ * @param bit    the TTL input (0-15)
+ * @param level  the level of the input before the first frame; set to the
+ *               level in the last frame
+ * @return the index of the first frame where the input is high after being
+ *         low, or nframes if there is none
+ */
+std::size_t find_rising_edge(void const * buf, std::size_t nframes, std::size_t frame_size,
+                             unsigned bit, bool * level);
+
+/**
+ * The rising edges of a TTL input over a series of buffers. An input that
+ * is already high in the first frame seen doesn't count as an edge, and
+ * the search continues from the frame after each edge.
+ */
+class rising_edges {
+
+public:
+        explicit rising_edges(unsigned bit=0) : _bit(bit), _level(false), _started(false) {}
+
+        /** start over, e.g. when acquisition restarts */
+        void reset() { _started = false; }
+
+        /**
+         * Find the next rising edge in a buffer, starting at frame from.
+         * Call with from 0 for each new buffer, and with one past the last
+         * edge to continue.
+         *
+         * @return the index of the edge, or nframes if there is none
+         */
+        std::size_t next(void const * buf, std::size_t nframes, std::size_t frame_size,
+                         std::size_t from);
+
+        /** call f(index) for each rising edge in a buffer; returns their number */
+        template <typename F>
+        std::size_t scan(void const * buf, std::size_t nframes, std::size_t frame_size, F f) {
+                std::size_t count = 0;
+                for (std::size_t t = next(buf, nframes, frame_size, 0); t < nframes;
+                     t = next(buf, nframes, frame_size, t + 1), ++count)
+                        f(t);
+                return count;
+        }
+
+        /** the number of rising edges in a buffer */
+        std::size_t count(void const * buf, std::size_t nframes, std::size_t frame_size);
+
+private:
+        unsigned _bit;
+        bool _level;            // in the last frame looked at
+        bool _started;
+};
+
+/** The alignment of one secondary board with the reference board */
+class board_alignment {
+
+public:
+        static const double synced_deadband;
+        static const double estimated_deadband;
+
+        board_alignment(double sampling_rate);
+
+        /** forget the offset, e.g. after either board restarts */
+        void reset();
+
+        /**
+         * Record a rising edge of the sync input.
+         *
+         * @param secondary     true if the edge is on the secondary board
+         * @param timestamp     the timestamp of the frame with the edge
+         * @param phase_offset  the current difference in clock phases
+         *                      (secondary - reference)
+         * @param phase_valid   false if either phase has no observations yet
+         */
+        void sync_edge(bool secondary, uint32_t timestamp, double phase_offset, bool phase_valid);
+
+        /**
+         * Estimate the offset (secondary timestamp - reference timestamp for
+         * frames acquired at the same time).
+         *
+         * @return false if there isn't enough information yet
+         */
+        bool offset(double phase_offset, bool phase_valid, double * out) const;
+
+        bool synced() const { return _synced; }
+
+        /**
+         * The number of frames to drop (positive) or repeat (negative) from
+         * the secondary board, whose next frame is board_next, so that it
+         * lines up with the reference board's next frame ref_next.
+         *
+         * @param max_step  the most frames to drop or repeat at once
+         */
+        long correction(double offset, uint32_t ref_next, uint32_t board_next, long max_step) const;
+
+private:
+        const double _max_mismatch;     // frames
+        bool _synced;
+        double _sync_offset;            // from the last matched edges
+        double _sync_phase;             // phase offset when they were matched
+        bool _pending[2];               // unmatched edges on reference, secondary
+        uint32_t _edge[2];
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include "rhd2000calibrate.hpp"
+#include "rhd2000cycle.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+using std::vector;
+
+static double
+now_usecs()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+rhd2k::calibration_options::calibration_options()
+        : seconds(60.0), target(1e-3), max_load(0.5)
+{
+        for (size_t n = 32; n <= 4096; n *= 2) read_sizes.push_back(n);
+        headrooms.push_back(0);
+        headrooms.push_back(32);
+        headrooms.push_back(64);
+        headrooms.push_back(128);
+        headrooms.push_back(256);
+}
+
+double
+rhd2k::calibration_trial::quantile(vector<double> const & sorted, double q)
+{
+        if (sorted.empty()) return 0;
+        size_t idx = q * sorted.size();
+        return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+double
+rhd2k::calibration_trial::upper_bound(size_t k)
+{
+        return k + 3.0 + 2.0 * sqrt((double)k);
+}
+
+/*
+ * stream at one read size and headroom, as the driver does in direct mode,
+ * for the given number of cycles, or until there have been too many
+ * underfull reads or cycles over budget to pass, or until the deadline
+ */
+static void
+run_trial(daq_interface & dev, vector<char> & buf, calibration_options const & options,
+          double budget, double deadline, calibration_trial & trial)
+{
+        const size_t expected = trial.read_size + trial.headroom;
+        const double needed = ceil(calibration_trial::upper_bound(0) / options.target);
+        const double allowed = options.target * needed;
+        size_t over = 0;
+        if (!start_acquisition(dev, &buf[0], trial.read_size, trial.headroom))
+                throw daq_error("unable to start acquisition for calibration");
+
+        uint32_t next_frame = 0;
+        while (now_usecs() < deadline && trial.cycles < needed &&
+               calibration_trial::upper_bound(trial.underfull) <= allowed && over <= allowed) {
+                const double t0 = now_usecs();
+                const size_t nframes = dev.nframes();
+                const double t1 = now_usecs();
+                usleep(fifo_fill_usecs(nframes, expected, dev.sampling_rate()));
+                const double t2 = now_usecs();
+                const size_t got = dev.read(&buf[0], trial.read_size);
+                const double t3 = now_usecs();
+
+                trial.poll_usecs.push_back(t1 - t0);
+                trial.read_usecs.push_back(t3 - t2);
+                trial.busy_usecs.push_back((t1 - t0) + (t3 - t2));
+                trial.cycles += 1;
+                if ((t1 - t0) + (t3 - t2) > budget) over += 1;
+
+                const period_status status = check_period(dev, &buf[0], trial.read_size, got,
+                                                          next_frame);
+                if (status == PERIOD_OK) {
+                        next_frame += trial.read_size;
+                }
+                else if (status == PERIOD_UNDERFULL) {
+                        trial.underfull += 1;
+                        dev.stop();
+                        if (!start_acquisition(dev, &buf[0], trial.read_size, trial.headroom))
+                                throw daq_error("unable to restart acquisition for calibration");
+                        next_frame = 0;
+                }
+                else {
+                        dev.stop();
+                        throw daq_error("lost the device during calibration");
+                }
+        }
+        dev.stop();
+        trial.bound = std::min(1.0, calibration_trial::upper_bound(trial.underfull) /
+                               std::max<size_t>(trial.cycles, 1));
+        std::sort(trial.poll_usecs.begin(), trial.poll_usecs.end());
+        std::sort(trial.read_usecs.begin(), trial.read_usecs.end());
+        std::sort(trial.busy_usecs.begin(), trial.busy_usecs.end());
+}
+
+calibration_result
+rhd2k::calibrate(daq_interface & dev, calibration_options const & options)
+{
+        calibration_result result;
+        result.ok = false;
+        result.read_size = result.headroom = 0;
+
+        const size_t max_read = *std::max_element(options.read_sizes.begin(),
+                                                  options.read_sizes.end());
+        vector<char> buf(max_read * dev.frame_size());
+        const double q = 1.0 - options.target;
+        const double needed = ceil(calibration_trial::upper_bound(0) / options.target);
+        const double deadline = now_usecs() + options.seconds * 1e6;
+
+        for (size_t i = 0; i < options.read_sizes.size() && !result.ok; ++i) {
+                const size_t read_size = options.read_sizes[i];
+                // the time a passing trial takes
+                const double usecs = 1e6 * needed * read_size / dev.sampling_rate();
+                if (now_usecs() + usecs > deadline) {
+                        result.skipped.push_back(read_size);
+                        continue;
+                }
+                const double budget = options.max_load * 1e6 * read_size / dev.sampling_rate();
+                for (size_t j = 0; j < options.headrooms.size(); ++j) {
+                        if (j > 0 && now_usecs() + usecs > deadline) break;
+                        result.trials.push_back(calibration_trial());
+                        calibration_trial & trial = result.trials.back();
+                        trial.read_size = read_size;
+                        trial.headroom = options.headrooms[j];
+                        trial.cycles = trial.underfull = 0;
+                        run_trial(dev, buf, options, budget, deadline, trial);
+
+                        // headroom doesn't change the time spent on USB
+                        if (calibration_trial::quantile(trial.busy_usecs, q) > budget) break;
+                        if (trial.bound <= options.target) {
+                                result.ok = true;
+                                result.read_size = read_size;
+                                result.headroom = trial.headroom;
+                                break;
+                        }
+                }
+        }
+        return result;
+}
+
+std::ostream &
+rhd2k::operator<< (std::ostream & o, calibration_result const & r)
+{
+        const std::ios::fmtflags flags = o.flags();
+        o << std::setw(6) << "frames" << std::setw(6) << "fifo" << std::setw(8) << "cycles"
+          << std::setw(6) << "under" << std::setw(8) << "bound" << "  (us)  " << std::setw(8) << "p50"
+          << std::setw(8) << "p99" << std::setw(8) << "p99.9" << std::setw(8) << "max" << '\n';
+        o << std::fixed << std::setprecision(0);
+        for (size_t i = 0; i < r.trials.size(); ++i) {
+                calibration_trial const & t = r.trials[i];
+                char const * names[] = { "poll", "read", "total" };
+                vector<double> const * dists[] = { &t.poll_usecs, &t.read_usecs, &t.busy_usecs };
+                for (size_t k = 0; k < 3; ++k) {
+                        if (k == 0)
+                                o << std::setw(6) << t.read_size << std::setw(6) << t.headroom
+                                  << std::setw(8) << t.cycles << std::setw(6) << t.underfull
+                                  << std::setw(8) << std::setprecision(4) << t.bound
+                                  << std::setprecision(0);
+                        else
+                                o << std::setw(34) << "";
+                        o << "  " << std::left << std::setw(6) << names[k] << std::right
+                          << std::setw(8) << calibration_trial::quantile(*dists[k], 0.5)
+                          << std::setw(8) << calibration_trial::quantile(*dists[k], 0.99)
+                          << std::setw(8) << calibration_trial::quantile(*dists[k], 0.999)
+                          << std::setw(8) << calibration_trial::quantile(*dists[k], 1.0) << '\n';
+                }
+        }
+        o.flags(flags);
+        if (r.ok)
+                o << "chose " << r.read_size << " frames with " << r.headroom
+                  << " frames of FIFO headroom";
+        else
+                o << "no candidate was shown to meet the target";
+        if (!r.skipped.empty()) {
+                o << "\nnot tried (not enough time left to show the target):";
+                for (size_t i = 0; i < r.skipped.size(); ++i) o << ' ' << r.skipped[i];
+        }
+        o << "\n(bound: 95% upper bound on the probability of an underfull read, "
+          << "given the cycles measured)";
+        return o;
+}
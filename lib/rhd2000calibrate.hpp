@@ -0,0 +1,87 @@
+#ifndef _RHD2000CALIBRATE_H
+#define _RHD2000CALIBRATE_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+#include "daq_interface.hpp"
+
+/*
+ * Choosing the period (or USB transfer size) and FIFO headroom is trial and
+ * error, because the latency of USB transactions depends on the kernel, the
+ * bus, and the number of enabled streams. The calibration streams data for
+ * a few seconds at each candidate read size, using the same cycle as the
+ * driver (see rhd2000cycle.hpp), and measures how long it takes to poll the
+ * FIFO and to read.
+ *
+ * A read size is acceptable if the poll and read together take less than
+ * max_load of the time it covers with probability 1 - target, so that the
+ * driver can keep up and leave the rest of the cycle for clients. The FIFO
+ * headroom is the smallest candidate at which the probability of an
+ * underfull read is shown to be below target: the 95% upper bound on it,
+ * from the number of underfull reads in the cycles measured, has to be
+ * below target. Even with no underfull reads, that takes 3 / target
+ * cycles, so each trial runs for that many cycles, or until it can no
+ * longer pass, which takes longer the larger the read size. The whole
+ * calibration takes at most `seconds`: read sizes are tried from the
+ * smallest, and those that can't complete their cycles in the time left
+ * aren't tried. If no candidate passes, there is no result, and the caller
+ * should keep its settings. The bound achieved by each trial is reported.
+ */
+namespace rhd2k {
+
+struct calibration_options {
+        std::vector<std::size_t> read_sizes;    // candidates, in frames
+        std::vector<std::size_t> headrooms;     // candidates, in frames
+        double seconds;                         // maximum in total
+        double target;                          // acceptable miss probability
+        double max_load;                        // fraction of the read size's duration
+
+        /**
+         * powers of two from 32 to 4096 frames; 0 to 256 frames of
+         * headroom; a minute in total
+         */
+        calibration_options();
+};
+
+/** the measurements for one candidate */
+struct calibration_trial {
+        std::size_t read_size;
+        std::size_t headroom;
+        std::size_t cycles;
+        std::size_t underfull;
+        double bound;                           // on the underfull probability (95%)
+        std::vector<double> poll_usecs;
+        std::vector<double> read_usecs;
+        std::vector<double> busy_usecs;         // poll + read
+
+        /** the value of the q quantile (0 to 1) in a sorted vector */
+        static double quantile(std::vector<double> const & sorted, double q);
+        /**
+         * A conservative 95% upper bound on the expected number of events,
+         * given that k were observed (the exact Poisson bound is 3 for k = 0)
+         */
+        static double upper_bound(std::size_t k);
+};
+
+struct calibration_result {
+        bool ok;                // false if no candidate met the target
+        std::size_t read_size;  // the choice, if ok
+        std::size_t headroom;
+        std::vector<calibration_trial> trials;
+        std::vector<std::size_t> skipped;       // read sizes there wasn't time to test
+};
+
+/**
+ * Run the calibration. Acquisition is stopped when this returns.
+ *
+ * @throws daq_error if the device fails to start
+ */
+calibration_result calibrate(daq_interface & dev, calibration_options const & options);
+
+/** print the measured distributions and the decision */
+std::ostream & operator<< (std::ostream &, calibration_result const &);
+
+} // namespace
+
+#endif
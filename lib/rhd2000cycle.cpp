@@ -0,0 +1,18 @@
+#include <unistd.h>
+#include "rhd2000cycle.hpp"
+
+using std::size_t;
+
+bool
+rhd2k::start_acquisition(daq_interface & dev, void * buf, size_t bufframes, size_t fifo_latency)
+{
+        // flush FIFO
+        while (dev.nframes()) {
+                dev.read(buf, bufframes);
+        }
+        dev.start();
+        if (!dev.running()) return false;
+        // add any additional latency to the fifo
+        usleep(fifo_fill_usecs(0, fifo_latency, dev.sampling_rate()));
+        return true;
+}
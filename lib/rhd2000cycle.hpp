@@ -0,0 +1,72 @@
+#ifndef _RHD2000CYCLE_H
+#define _RHD2000CYCLE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include "daq_interface.hpp"
+#include "rhd2000frame.hpp"
+
+/*
+ * The steps of reading a period of data from the eval board's FIFO, shared
+ * by the JACK driver and the simulated-board test harness. The board can't
+ * notify the host when data arrive, so each cycle polls the FIFO, sleeps
+ * for as long as it should take the rest of the period to arrive, reads the
+ * period, and checks it. Reading an underfull FIFO corrupts it, so the only
+ * way to recover from a bad period is to restart acquisition.
+ */
+namespace rhd2k {
+
+/** the outcome of reading a period */
+enum period_status {
+        PERIOD_OK = 0,
+        PERIOD_READ_ERROR,      // the USB read failed
+        PERIOD_UNDERFULL,       // the data are bad but the device is running
+        PERIOD_STOPPED          // the device is not running or was disconnected
+};
+
+/**
+ * The time (in us) for the FIFO to fill from nframes to expected frames, or
+ * 0 if it already has enough.
+ */
+inline double
+fifo_fill_usecs(std::size_t nframes, std::size_t expected, std::size_t sampling_rate)
+{
+        return (nframes >= expected) ? 0.0 : 1e6 * (expected - nframes) / sampling_rate;
+}
+
+/**
+ * Check every frame of a period that has been read from the device.
+ *
+ * @param got          the return value of dev.read()
+ * @param first_frame  the expected timestamp of the first frame
+ * @param bad_frame    if not null, set to the index of the first bad frame
+ *                     (nframes if there is none)
+ * @param fault        if not null, set to the kind of the first fault
+ */
+inline period_status
+check_period(daq_interface const & dev, void const * buf, std::size_t nframes,
+             std::size_t got, uint32_t first_frame,
+             std::size_t * bad_frame = 0, frame_fault * fault = 0)
+{
+        if (bad_frame) *bad_frame = nframes;
+        if (fault) *fault = FRAME_OK;
+        if (got == 0) return PERIOD_READ_ERROR;
+        const std::size_t idx = check_frames(buf, nframes, dev.frame_size(), first_frame, fault);
+        if (bad_frame) *bad_frame = idx;
+        if (idx == nframes) return PERIOD_OK;
+        return (dev.running()) ? PERIOD_UNDERFULL : PERIOD_STOPPED;
+}
+
+/**
+ * Flush the FIFO, start acquisition, and wait until fifo_latency frames have
+ * been acquired.
+ *
+ * @param buf        scratch space for flushing, at least bufframes frames
+ * @return false if the device failed to start
+ */
+bool start_acquisition(daq_interface & dev, void * buf, std::size_t bufframes,
+                       std::size_t fifo_latency);
+
+} // namespace
+
+#endif
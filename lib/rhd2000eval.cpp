@@ -8,6 +8,7 @@
 #include <sstream>
 #include <bitset>
 #include "rhd2000eval.hpp"
+#include "rhd2000frame.hpp"
 #include "rhd2k.hpp"
 #include "debug.hpp"
 
@@ -99,7 +100,7 @@ ok_error::what() const throw()
 
 evalboard::evalboard(size_t sampling_rate, char const * serial, char const * firmware, char const * libdir)
         : _dev(0), _pll(okPLL22393_Construct()), _cable_lengths(nmosi,0.91), _sampling_rate(0),
-          _board_version(0), _enabled_streams(0), _nactive_streams(0), _dac_sources()
+          _board_version(0), _enabled_streams(0), _stream_sources(), _nactive_streams(0), _dac_sources()
 {
         ulong board_id;
         ok_ErrorCode ec;
@@ -245,6 +246,54 @@ evalboard::enable_stream(miso_id stream, bool enabled)
         update_adc_table();
 }
 
+void
+evalboard::set_stream_source(miso_id stream, miso_id miso, bool ddr)
+{
+        assert (stream >= PortA1 && stream <= PortD2);
+        const ulong source = miso + (ddr ? ddr_source : 0);
+        // four bits per stream, four streams per wire
+        const int wire = (stream < 4) ? WireInDataStreamSel1234 : WireInDataStreamSel5678;
+        const int shift = ((int)stream % 4) * 4;
+        _stream_sources[stream] = source;
+        okFrontPanel_SetWireInValue(_dev, wire, source << shift, 0x0f << shift);
+        okFrontPanel_UpdateWireIns(_dev);
+}
+
+evalboard::miso_id
+evalboard::stream_source(miso_id stream) const
+{
+        return (miso_id)(_stream_sources[stream] % ddr_source);
+}
+
+bool
+evalboard::stream_ddr(miso_id stream) const
+{
+        return _stream_sources[stream] >= ddr_source;
+}
+
+size_t
+evalboard::route_streams()
+{
+        if (running()) {
+                throw daq_error("can't route streams while system is running");
+        }
+        ulong sources[nmiso];
+        size_t n = 0;
+        for (size_t i = 0; i < nmiso; ++i) {
+                if (!stream_enabled((miso_id)i)) continue;
+                if (_miso[stream_source((miso_id)i)]->amp_power() == 0) continue;
+                sources[n++] = _stream_sources[i];
+        }
+        for (size_t i = 0; i < nmiso; ++i) {
+                // unused streams go back to their own lines
+                const ulong source = (i < n) ? sources[i] : i;
+                set_stream_source((miso_id)i, (miso_id)(source % ddr_source), source >= ddr_source);
+        }
+        enable_streams((1UL << n) - 1);
+        update_adc_table();
+        return n;
+}
+
 void
 evalboard::enable_streams(ulong arg)
 {
@@ -264,10 +313,7 @@ evalboard::nframes() const
 size_t
 evalboard::frame_size() const
 {
-        // 4 = magic number; 2 = time stamp;
-        // 36 = (32 amp channels + 3 aux commands + 1 filler word);
-        // 8 = ADCs; 2 = TTL in/out
-        return 2 * (4 + 2 + _nactive_streams * 36 + 8 + 2 );
+        return rhd2k::frame_size(_nactive_streams);
 }
 
 ulong
@@ -289,47 +335,64 @@ evalboard::read(void * arg, size_t nframes)
 
 void
 evalboard::update_adc_table()
+{
+        ulong amp_power[nmiso];
+        for (size_t i = 0; i < nmiso; ++i) {
+                // DDR streams share the power mask of the first half
+                amp_power[i] = _miso[stream_source((miso_id)i)]->amp_power();
+        }
+        make_adc_table(_adc_table, _enabled_streams, amp_power, _stream_sources);
+}
+
+void
+evalboard::make_adc_table(std::vector<channel_info_t> & table,
+                          ulong enabled_streams, ulong const amp_power[nmiso],
+                          ulong const sources[nmiso])
 {
         const size_t base_offset = 6; // first words in frame
-        _adc_table.resize(naux_adcs + _nactive_streams * rhd2000::max_amps);
+        const size_t nstreams = std::bitset<nmiso>(enabled_streams).count();
+        table.resize(naux_adcs + nstreams * rhd2000::max_amps);
 
         size_t chan_count = 0;
         size_t stream_count = 0;
         // miso lines
         for (size_t i = 0; i < evalboard::nmiso; ++i) {
-                if (!stream_enabled((miso_id)i)) continue;
-                rhd2000 const * chip = _miso[i];
+                if (!(enabled_streams & (1 << i))) continue;
+                const ulong source = (sources) ? sources[i] : i;
+                const miso_id line = (miso_id)(source % ddr_source);
+                // the falling-edge samples are amps 32-63
+                const size_t first = (source >= ddr_source) ? rhd2000::max_amps : 0;
                 for (size_t c = 0; c < rhd2000::max_amps; ++c) {
-                        if (!chip->amp_power(c)) continue;
+                        if (!(amp_power[i] & (1UL << c))) continue;
 
                         std::ostringstream name;
-                        channel_info_t & chan = _adc_table[chan_count++];
+                        channel_info_t & chan = table[chan_count++];
                         chan.stream  = (miso_id)stream_count;
                         chan.channel = c;
 
-                        name << chan.stream << '_' << c;
+                        name << line << '_' << first + c;
                         chan.name    = name.str();
 
                         // byte offset: base + (chan+3) * nstreams + stream (the
                         // 3-channel offset relates to the fact that the aux
                         // data from the previous time step comes first - see p
                         // 9 in manual)
-                        chan.byte_offset = sizeof(data_type) * (base_offset + ((c+3) * streams_enabled() + stream_count));
+                        chan.byte_offset = sizeof(data_type) * (base_offset + ((c+3) * nstreams + stream_count));
                 }
                 stream_count += 1;
         }
         // eval board adcs
         for (size_t c = 0; c < naux_adcs; ++c) {
                 std::ostringstream name;
-                channel_info_t & chan = _adc_table[chan_count++];
+                channel_info_t & chan = table[chan_count++];
                 chan.stream = EvalADC;
                 chan.channel = c;
 
                 name << chan.stream << '_' << c;
                 chan.name = name.str();
-                chan.byte_offset = sizeof(data_type) * (base_offset + (36 * streams_enabled()) + c);
+                chan.byte_offset = sizeof(data_type) * (base_offset + (36 * nstreams) + c);
         }
-        _adc_table.resize(chan_count);
+        table.resize(chan_count);
 }
 
 void
@@ -347,14 +410,9 @@ evalboard::reset_board()
         okFrontPanel_UpdateWireIns(_dev);
 
         // wire each amp to its own data stream
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel1234, PortA1 << 0, 0x0f << 0);
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel1234, PortA2 << 4, 0x0f << 4);
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel1234, PortB1 << 8, 0x0f << 8);
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel1234, PortB2 << 12, 0x0f << 12);
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel5678, PortC1 << 0, 0x0f << 0);
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel5678, PortC2 << 4, 0x0f << 4);
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel5678, PortD1 << 8, 0x0f << 8);
-        okFrontPanel_SetWireInValue(_dev, WireInDataStreamSel5678, PortD2 << 12, 0x0f << 12);
+        for (size_t i = 0; i < nmiso; ++i) {
+                set_stream_source((miso_id)i, (miso_id)i);
+        }
         // turn off LEDs
         okFrontPanel_SetWireInValue(_dev, WireInLedDisplay, 0, ulong_mask);
         okFrontPanel_UpdateWireIns(_dev);
@@ -544,6 +602,54 @@ evalboard::configure_port(mosi_id port, double lower, double upper,
 
 }
 
+void
+evalboard::set_amp_power(mosi_id port, ulong amp_power)
+{
+        if (_mosi[(size_t)port]->amp_power() == amp_power) return;
+        std::vector<short> commands;
+        command_amp_power(port, amp_power, commands);
+        upload_auxcommand(AuxCmd3, (size_t)port, commands.begin(), commands.end());
+}
+
+void
+evalboard::command_amp_power(mosi_id port, ulong amp_power, std::vector<short> & commands)
+{
+        rhd2000 * amp = _mosi[(size_t)port];
+        amp->set_amp_power(amp_power);
+        if (!running()) {
+                update_adc_table();
+        }
+        amp->command_regset(commands, false);
+}
+
+ulong
+evalboard::amp_power(mosi_id port) const
+{
+        return _mosi[(size_t)port]->amp_power();
+}
+
+void
+evalboard::set_twoscomp(bool enabled)
+{
+        if (running()) {
+                throw daq_error("can't change sample format while system is running");
+        }
+        for (size_t i = 0; i < nmiso; ++i) {
+                _miso[i]->set_twoscomp(enabled);
+        }
+        std::vector<short> commands;
+        for (size_t i = 0; i < nmosi; ++i) {
+                _mosi[i]->command_regset(commands, false);
+                upload_auxcommand(AuxCmd3, i, commands.begin(), commands.end());
+        }
+}
+
+bool
+evalboard::twoscomp() const
+{
+        return _mosi[0]->twoscomp();
+}
+
 void
 evalboard::calibrate_amplifiers()
 {
@@ -554,6 +660,10 @@ evalboard::calibrate_amplifiers()
         const size_t nframes = rhd2000::register_sequence_length;
         std::vector<short> commands(nframes);
         char * buffer = new char[frame_size() * nframes];
+        // the second chip on each port gets the same commands as the first
+        for (size_t i = 1; i < nmiso; i += 2) {
+                _miso[i]->copy_settings(*_mosi[i/2]);
+        }
         for (size_t i = 0; i < nmosi; ++i) {
                 _mosi[i]->command_regset(commands, true);
                 upload_auxcommand(AuxCmd3, (mosi_id)i, commands.begin(), commands.end());
@@ -567,10 +677,13 @@ evalboard::calibrate_amplifiers()
 
         size_t stream_count = 0;
         for (size_t i = 0; i < nmiso; ++i) {
-                // inspect a frame in gdb: p/x *(short*)(buffer+12)@(_enabled_streams*36+10)
-                size_t offset = 2 * (6 + 2 * _enabled_streams + stream_count);
+                // inspect a frame in gdb: p/x *(short*)(buffer+12)@(_nactive_streams*36+10)
+                size_t offset = 2 * (6 + 2 * _nactive_streams + stream_count);
                 if (!stream_enabled((miso_id)i)) continue;
-                _miso[stream_count++]->update(buffer, offset, frame_size());
+                stream_count += 1;
+                // the aux results on a DDR stream are not register reads
+                if (stream_ddr((miso_id)i)) continue;
+                _miso[stream_source((miso_id)i)]->update(buffer, offset, frame_size());
         }
         delete[] buffer;
 
@@ -583,6 +696,161 @@ evalboard::calibrate_amplifiers()
 
 
 
+void
+evalboard::prepare_fast_settle()
+{
+        std::vector<short> commands;
+        for (size_t i = 0; i < nmosi; ++i) {
+                _mosi[i]->command_fast_settle(commands);
+                upload_auxcommand(AuxCmd3, fast_settle_bank + i, commands.begin(), commands.end());
+        }
+}
+
+void
+evalboard::set_fast_settle(mosi_id port, bool settle)
+{
+        set_port_auxcommand(port, AuxCmd3, (settle ? fast_settle_bank : 0) + port);
+}
+
+evalboard::data_type
+evalboard::fast_settle_result(miso_id stream) const
+{
+        return _mosi[stream_source(stream) / 2]->fast_settle_result();
+}
+
+uint64_t
+evalboard::fast_settle_aliases(miso_id stream) const
+{
+        return _mosi[stream_source(stream) / 2]->fast_settle_aliases();
+}
+
+double
+evalboard::measure_impedance(double frequency, std::vector<impedance_t> & out)
+{
+        if (running()) {
+                throw daq_error("can't measure impedance while system is running");
+        }
+        // the DAC sequence loops, so it has to be a whole number of cycles
+        const size_t period = floor(_sampling_rate / frequency + 0.5);
+        if (period < 4 || period > 1023) {
+                throw daq_error("impedance test frequency is out of range for the sampling rate");
+        }
+        frequency = (double)_sampling_rate / period;
+        const double relative_freq = frequency / _sampling_rate;
+
+        // let the registers and the amplifier settle, then measure for at
+        // least 10 cycles and 20 ms
+        const size_t settle = (2 * rhd2000::register_sequence_length / period + 2) * period;
+        const size_t ncycles = std::max<size_t>(10, ceil(0.02 * frequency));
+        const size_t nmeasure = ncycles * period;
+        const size_t nframes = settle + nmeasure;
+        char * buffer = new char[frame_size() * nframes];
+
+        // slot 1, bank 1: one cycle of the test sine at nearly full scale
+        const double dac_amplitude = 127;
+        std::vector<double> sine(period);
+        for (size_t t = 0; t < period; ++t) {
+                sine[t] = dac_amplitude * sin(2 * M_PI * t / period);
+        }
+        std::vector<short> commands;
+        _mosi[0]->command_dac(commands, sine.begin(), sine.end());
+        upload_auxcommand(AuxCmd1, 1, commands.begin(), commands.end());
+        for (size_t i = 0; i < nmosi; ++i) {
+                set_port_auxcommand((mosi_id)i, AuxCmd1, 1);
+        }
+
+        // every chip tests the same input at the same time
+        size_t max_channel = rhd2000::max_amps;
+        for (size_t i = 0; i < nmiso; ++i) {
+                if (stream_enabled((miso_id)i) && stream_ddr((miso_id)i))
+                        max_channel = 2 * rhd2000::max_amps;
+        }
+
+        // the DAC's voltage steps are 1.225 V / 256, and the capacitors
+        // are measured with the largest first
+        const rhd2000::zcheck_scale scales[3] = { rhd2000::Zcheck10pF, rhd2000::Zcheck1pF,
+                                                  rhd2000::Zcheck100fF };
+        const double capacitance[3] = { 10e-12, 1e-12, 0.1e-12 };
+        const double dac_volts = dac_amplitude * 1.225 / 256;
+        const double uV_per_sample = 0.195;
+        // Intan's estimate of where the amplifier starts to saturate
+        const double upper = _mosi[0]->upper_cutoff();
+        const double saturation_uV = (frequency < 0.2 * upper) ? 5000.0 :
+                5000.0 * sqrt(1.0 / (1.0 + pow(3.3333 * frequency / upper, 4)));
+
+        out.assign(_adc_table.size(), impedance_t());
+        std::vector<char> done(_adc_table.size(), 0);
+        std::vector<size_t> selected, offsets;
+        std::vector<std::complex<double> > amplitudes;
+        for (size_t c = 0; c < _adc_table.size(); ++c) {
+                out[c].magnitude = out[c].phase = NAN;
+        }
+
+        for (size_t s = 0; s < 3; ++s) {
+                const double current = 2 * M_PI * frequency * capacitance[s] * dac_volts;
+                for (size_t sel = 0; sel < max_channel; ++sel) {
+                        for (size_t i = 0; i < nmosi; ++i) {
+                                _mosi[i]->set_zcheck(true, scales[s], sel);
+                                _mosi[i]->command_regset(commands, false);
+                                upload_auxcommand(AuxCmd3, (mosi_id)i, commands.begin(), commands.end());
+                        }
+                        start(nframes);
+                        while (running()) {
+                                usleep(100);
+                        }
+                        read(buffer, nframes);
+
+                        // demodulate all the channels under test in one pass
+                        selected.clear();
+                        offsets.clear();
+                        for (size_t c = 0; c < _adc_table.size(); ++c) {
+                                channel_info_t const & info = _adc_table[c];
+                                if (info.stream == EvalADC || done[c]) continue;
+                                const size_t channel = info.channel +
+                                        (stream_ddr(info.stream) ? rhd2000::max_amps : 0);
+                                if (channel != sel) continue;
+                                selected.push_back(c);
+                                offsets.push_back(info.byte_offset);
+                        }
+                        demodulate_channels(buffer + settle * frame_size(), frame_size(), nmeasure,
+                                            period, twoscomp(), offsets, amplitudes);
+
+                        for (size_t j = 0; j < selected.size(); ++j) {
+                                const size_t c = selected[j];
+                                const std::complex<double> & v = amplitudes[j];
+                                const double magnitude_uV = std::abs(v) * uV_per_sample;
+                                // the smallest capacitor is the last resort
+                                if (magnitude_uV >= saturation_uV && s < 2) continue;
+                                // the current leads the sine on the DAC by 90
+                                // degrees, so it's in phase with the
+                                // reference. The empirical corrections are
+                                // from Intan's software: the magnitude for
+                                // the anti-aliasing filter, and the phase for
+                                // the 3-command delay of the SPI pipeline
+                                out[c].magnitude = 1e-6 * (magnitude_uV / current) *
+                                        (18.0 * relative_freq * relative_freq + 1.0);
+                                out[c].phase = std::arg(v) * 180 / M_PI + 360.0 * 3 / period;
+                                if (out[c].phase > 180) out[c].phase -= 360;
+                                done[c] = 1;
+                        }
+                }
+        }
+        delete[] buffer;
+
+        // restore the normal sequences. The length of slot 1 was set for
+        // the sine, so the DAC zeros go back in too
+        std::vector<double> dac(60, 0.0);
+        _mosi[0]->command_dac(commands, dac.begin(), dac.end());
+        upload_auxcommand(AuxCmd1, 0, commands.begin(), commands.end());
+        for (size_t i = 0; i < nmosi; ++i) {
+                _mosi[i]->set_zcheck(false, rhd2000::Zcheck100fF, 0);
+                _mosi[i]->command_regset(commands, false);
+                upload_auxcommand(AuxCmd3, (mosi_id)i, commands.begin(), commands.end());
+                set_port_auxcommand((mosi_id)i, AuxCmd1, 0);
+        }
+        return frequency;
+}
+
 void
 evalboard::scan_ports()
 {
@@ -597,7 +865,10 @@ evalboard::scan_ports()
         set_sampling_rate(max_sampling_rate);
         // scratch register object used for parsing returned aux sequences
         rhd2000 port(sampling_rate());
-        // enable all data streams
+        // enable all data streams, each on its own line
+        for (size_t i = 0; i < nmiso; ++i) {
+                set_stream_source((miso_id)i, (miso_id)i);
+        }
         enable_streams(0x00ff);
         // frame size for all streams enabled
         const size_t frame_bytes = frame_size();
@@ -615,6 +886,7 @@ evalboard::scan_ports()
 
         // run calibration sequence at all delays
         std::vector<std::vector<size_t> > delays(nmiso);
+        std::vector<bool> ddr(nmiso), miso_b(nmiso);
         for (size_t delay = 0; delay < max_miso_delay; ++delay) {
 
                 for (size_t i = 0; i < nmosi; ++i) {
@@ -644,6 +916,8 @@ evalboard::scan_ports()
                         port.update(buffer, offset, frame_bytes);
                         if (port.connected()) {
                                 delays[i].push_back(delay);
+                                ddr[i] = port.ddr();
+                                miso_b[i] = port.miso_b();
                         }
                 }
         }
@@ -665,6 +939,20 @@ evalboard::scan_ports()
                 }
                 stream_enable |= 1 << i;
         }
+        // An RHD2164 returns all 64 channels on MISO A, so the stream for
+        // the other line on the port carries the falling-edge samples if
+        // it's not connected to a chip of its own
+        for (size_t i = 0; i < nmiso; ++i) {
+                const size_t other = i ^ 1;
+                if (!(stream_enable & (1 << i)) || !ddr[i] || miso_b[i]) continue;
+                if ((stream_enable & (1 << other)) && !miso_b[other]) continue;
+                set_stream_source((miso_id)other, (miso_id)i, true);
+                stream_enable |= 1 << other;
+        }
+        for (size_t i = 0; i < nmiso; ++i) {
+                if (miso_b[i] && !stream_ddr((miso_id)i))
+                        stream_enable &= ~(1 << i);
+        }
         for (size_t i = 0; i < nmosi; ++i) {
                 set_cable_delay((mosi_id)i, std::max(best_delays[i*2], best_delays[i*2+1]));
         }
@@ -674,6 +962,7 @@ evalboard::scan_ports()
         // return to original sampling rate; update registers at correct delays
         set_sampling_rate(old_sampling_rate);
         calibrate_amplifiers();
+        route_streams();
 }
 
 void
@@ -810,6 +1099,9 @@ evalboard::ttl_in() const
 void
 evalboard::dac_monitor(uint dac, uint channel)
 {
+        if (twoscomp()) {
+                throw daq_error("DACs can't monitor two's complement samples");
+        }
         channel_info_t & chan = _adc_table[channel];
         assert (chan.stream != EvalADC);
         assert (chan.channel < 32);
@@ -876,18 +1168,30 @@ operator<< (std::ostream & o, evalboard const & r)
           << "\n Analog inputs enabled: " << r.adc_channels()
           << "\n MISO lines: ";
         for (size_t i = 0; i < r.nmiso; ++i) {
-                // this assumes the mapping established in reset_board
                 evalboard::miso_id miso = (evalboard::miso_id)i;
                 o << "\n" << miso << ": "
                   <<  *(r._miso[i]);
-                if (!r.stream_enabled(miso)) o << " (off) ";
+                bool streamed = false;
+                for (size_t s = 0; s < r.nmiso; ++s) {
+                        evalboard::miso_id stream = (evalboard::miso_id)s;
+                        if (r.stream_enabled(stream) && r.stream_source(stream) == miso)
+                                streamed = true;
+                }
+                if (!streamed) o << " (off) ";
 #if DEBUG == 2
                 else {
-                        sprintf(buf1, " (cable %.2f m)", r._cable_lengths[i]);
+                        sprintf(buf1, " (cable %.2f m)", r._cable_lengths[i / 2]);
                         o << buf1;
                 }
 #endif
         }
+        o << "\n USB streams:";
+        for (size_t s = 0; s < r.nmiso; ++s) {
+                evalboard::miso_id stream = (evalboard::miso_id)s;
+                if (!r.stream_enabled(stream)) continue;
+                o << ' ' << r.stream_source(stream);
+                if (r.stream_ddr(stream)) o << " (DDR)";
+        }
         return o;
 }
 
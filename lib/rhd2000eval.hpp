@@ -1,6 +1,7 @@
 #ifndef _RHD2000EVAL_H
 #define _RHD2000EVAL_H
 
+#include <stdint.h>
 #include <cassert>
 #include <iosfwd>
 #include <vector>
@@ -42,6 +43,8 @@ public:
         static const std::size_t naux_adcs = 8;
         /// number of auxiliary DACs on the board
         static const std::size_t naux_dacs = 8;
+        /// AuxCmd3 bank of the first port's fast settle sequence
+        static const std::size_t fast_settle_bank = 4;
         /// all returned frames should start with this value
         static const unsigned long long frame_header = 0xc691199927021942ULL;
 
@@ -70,6 +73,12 @@ public:
                 PortD2 = 7,
         };
 
+        /**
+         * Data sources for the USB streams are numbered like miso_id, plus
+         * this offset for the falling-edge (DDR) samples of a MISO line
+         */
+        static const ulong ddr_source = 8;
+
         struct channel_info_t {
                 miso_id stream;
                 uint channel;
@@ -77,6 +86,12 @@ public:
                 std::string name;
         };
 
+        /** the impedance of an electrode */
+        struct impedance_t {
+                double magnitude;       // ohms
+                double phase;           // degrees
+        };
+
         evalboard(std::size_t sampling_rate,
                   char const * serial=0,
                   char const * firmware=0,
@@ -99,6 +114,25 @@ public:
          */
         std::vector<channel_info_t> const & adc_table() const { return _adc_table; }
 
+        /**
+         * Generate the ADC table for a set of enabled streams. This is what
+         * adc_table() returns; it's exposed so that frame layouts can be
+         * generated without hardware.
+         *
+         * Channels are named after the MISO line they come from. Streams
+         * carrying DDR samples are named after the line of the first half,
+         * with channel numbers 32-63.
+         *
+         * @param enabled_streams  bit mask of enabled MISO streams
+         * @param amp_power        power mask of the amplifiers on each stream
+         * @param sources          the source of each stream (see
+         *                         set_stream_source()), or 0 if each stream
+         *                         carries its own MISO line
+         */
+        static void make_adc_table(std::vector<channel_info_t> & table,
+                                   ulong enabled_streams, ulong const amp_power[nmiso],
+                                   ulong const sources[nmiso]=0);
+
         /**
          * @overload daq_interface::read()
          *
@@ -133,24 +167,149 @@ public:
         void configure_port(mosi_id port, double lower, double upper,
                             double dsp, ulong amp_power=0xffffffff);
 
+        /**
+         * Change the power state of the amplifiers on a port. Unlike
+         * configure_port(), this can be called while the system is running:
+         * the new register values are uploaded to the port's command
+         * sequence and take effect within one pass through the sequence.
+         * The ADC table is only regenerated if the system is stopped, so
+         * channels that are powered down while running keep their entries.
+         *
+         * @note this requires about 120 USB transactions
+         */
+        void set_amp_power(mosi_id port, ulong amp_power);
+
+        /**
+         * The first half of set_amp_power(): updates the port's register
+         * values and generates its new command sequence without uploading
+         * it. Upload the commands to the port's AuxCmd3 bank with
+         * set_auxcommand(), which lets other threads use the board between
+         * transactions.
+         */
+        void command_amp_power(mosi_id port, ulong amp_power, std::vector<short> & commands);
+        /** the power mask of the amplifiers on a port */
+        ulong amp_power(mosi_id port) const;
+
+        /**
+         * Upload one command to an aux command bank. This does not change
+         * the slot's sequence length.
+         */
+        void set_auxcommand(auxcmd_slot slot, ulong bank, ulong index, ulong command) {
+                set_cmd_ram(slot, bank, index, command);
+        }
+
+        /**
+         * Select two's complement (signed) samples from the amplifiers on all
+         * ports, instead of offset binary. Convert them with
+         * convert_channel_signed(). The eval board ADCs are not affected,
+         * and the DACs can't monitor signed samples.
+         *
+         * @pre !running()
+         */
+        void set_twoscomp(bool enabled);
+        /** true if the amplifiers return two's complement samples */
+        bool twoscomp() const;
+
         /** Run the calibration sequence on all connected amplifiers */
         void calibrate_amplifiers();
 
+        /**
+         * Measure the impedance of the electrode on every amplifier channel
+         * in adc_table(). Each chip's test DAC drives a sine wave through a
+         * series capacitor into one of its inputs; all the chips are tested
+         * at once, so the time depends on the number of channels per chip
+         * rather than the total. The voltage is demodulated at the test
+         * frequency. Each channel is measured with the 0.1, 1, and 10 pF
+         * capacitors, and the result from the largest one that doesn't
+         * saturate the amplifier is used.
+         *
+         * @pre !running()
+         * @param frequency  the requested test frequency (Hz)
+         * @param out        set to the impedance of each channel in
+         *                   adc_table() (NaN for the eval board ADCs)
+         * @return the actual test frequency, which has a whole number of
+         *         samples per cycle
+         */
+        double measure_impedance(double frequency, std::vector<impedance_t> & out);
+
         /**
          * Scan ports for connected RHD2000 chips. The amplifiers will be
-         * calibrated and progammed with the values set in configure_port().
+         * calibrated and progammed with the values set in configure_port(),
+         * and the streams routed with route_streams().
          *
          * @pre !running()
          */
         void scan_ports();
 
+        /**
+         * Pack the enabled streams whose amplifiers are powered into the
+         * lowest-numbered USB streams, keeping their order, and disable the
+         * rest. Each frame then carries only the data in use, and the stream
+         * index of each channel in adc_table() is its USB stream.
+         *
+         * @pre !running()
+         * @return the number of streams in use
+         */
+        std::size_t route_streams();
+
+        /**
+         * Load the sequences that hold the amplifiers on each port in fast
+         * settle (AuxCmd3, banks 4-7). Call again after the amplifier
+         * settings change.
+         */
+        void prepare_fast_settle();
+        /**
+         * Hold the amplifiers on a port in fast settle, or release them, by
+         * switching the port's AuxCmd3 bank to the sequence loaded by
+         * prepare_fast_settle() or back to the register sequence. Can be
+         * called while running.
+         */
+        void set_fast_settle(mosi_id port, bool settle);
+        /**
+         * The AuxCmd3 result in frames where the amplifiers on a stream are
+         * being held in fast settle
+         */
+        data_type fast_settle_result(miso_id stream) const;
+        /**
+         * The commands in the register sequence of a stream that return the
+         * same result (see rhd2000::fast_settle_aliases)
+         */
+        uint64_t fast_settle_aliases(miso_id stream) const;
+        /**
+         * The byte offset in a frame of an aux command's result for the nth
+         * enabled stream
+         */
+        std::size_t aux_result_offset(auxcmd_slot slot, std::size_t n) const {
+                return sizeof(data_type) * (6 + slot * _nactive_streams + n);
+        }
+
         /** the number of streams that have been enabled */
         std::size_t streams_enabled() const;
-        /** true if a stream is enabled */
+        /**
+         * true if a USB stream is enabled. Streams are identified by the
+         * MISO line they carry by default, but not after route_streams()
+         */
         bool stream_enabled(miso_id stream) const;
-        /** enable or disable a stream for data collection */
+        /** enable or disable a USB stream for data collection */
         void enable_stream(miso_id stream, bool enabled=true);
 
+        /**
+         * Route a USB data stream to a MISO line. By default each stream
+         * carries its own line. scan_ports() routes the unused MISO B
+         * stream of an RHD2164 to the falling-edge samples of MISO A.
+         *
+         * @pre !running()
+         *
+         * @param stream  the stream to route
+         * @param miso    the MISO line to sample
+         * @param ddr     if true, sample on the falling edge
+         */
+        void set_stream_source(miso_id stream, miso_id miso, bool ddr=false);
+        /** the MISO line carried by a stream */
+        miso_id stream_source(miso_id stream) const;
+        /** true if a stream carries falling-edge (DDR) samples */
+        bool stream_ddr(miso_id stream) const;
+
         void set_leds(ulong value, ulong mask=0xffffffff);
         void ttl_out(ulong value, ulong mask=0xffffffff);
         ulong ttl_in() const;
@@ -161,6 +320,8 @@ public:
          * @param dac     the DAC to configure (values 0-8)
          * @param channel the channel to monitor (corresponding to the indices
          *                from adc_table() - however, on-board ADCs can't be monitored
+         * @throws daq_error in two's complement mode, because the DACs
+         *                expect offset binary samples
          */
         void dac_monitor(uint dac, uint channel);
 
@@ -227,6 +388,7 @@ private:
         uint _sampling_rate;
         ulong _board_version;
         ulong _enabled_streams;
+        ulong _stream_sources[nmiso];
         std::size_t _nactive_streams;
         std::vector<channel_info_t> _adc_table;
 
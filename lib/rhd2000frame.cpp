@@ -0,0 +1,165 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "rhd2000frame.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+
+void
+rhd2k::synthesize_frames(void * buf, size_t nframes, size_t nstreams, uint32_t first_frame)
+{
+        const size_t fsize = frame_size(nstreams);
+        const size_t nwords = fsize / sizeof(evalboard::data_type);
+        // first word after the header and timestamp, and the filler
+        const size_t data_start = 6;
+        const size_t filler_start = 6 + 35 * nstreams;
+        const size_t filler_end = filler_start + nstreams;
+
+        char * frame = static_cast<char *>(buf);
+        for (size_t t = 0; t < nframes; ++t, frame += fsize) {
+                const uint32_t ts = first_frame + t;
+                const uint64_t magic = evalboard::frame_header;
+                memcpy(frame, &magic, sizeof(magic));
+                memcpy(frame + sizeof(magic), &ts, sizeof(ts));
+                evalboard::data_type * words = reinterpret_cast<evalboard::data_type *>(frame);
+                for (size_t w = data_start; w < nwords; ++w) {
+                        words[w] = (w >= filler_start && w < filler_end) ? 0 : synthetic_sample(ts, w);
+                }
+        }
+}
+
+/* the first fault in a single frame */
+static frame_fault
+frame_fault_at(char const * frame, size_t frame_size, uint32_t timestamp)
+{
+        if (*reinterpret_cast<uint64_t const *>(frame) != evalboard::frame_header)
+                return FRAME_HEADER;
+        if (*reinterpret_cast<uint32_t const *>(frame + 8) != timestamp)
+                return FRAME_TIMESTAMP;
+        if (frame_size > 32 && *reinterpret_cast<uint16_t const *>(frame + frame_size - 22) != 0)
+                return FRAME_FILLER;
+        return FRAME_OK;
+}
+
+size_t
+rhd2k::check_frames(void const * buf, size_t nframes, size_t frame_size, uint32_t first_frame,
+                    frame_fault * fault)
+{
+        const size_t block = 16;
+        // filler is only present if a stream is enabled (see last_frame_valid)
+        const size_t filler_offset = frame_size - 22;
+        const uint64_t filler_mask = (frame_size > 32) ? 0xffff : 0;
+        char const * frames = static_cast<char const *>(buf);
+
+        size_t t = 0;
+        for (; t < nframes; t += block) {
+                const size_t end = std::min(t + block, nframes);
+                uint64_t bad = 0;
+                char const * frame = frames + t * frame_size;
+                for (size_t i = t; i < end; ++i, frame += frame_size) {
+                        bad |= *reinterpret_cast<uint64_t const *>(frame) ^ evalboard::frame_header;
+                        bad |= *reinterpret_cast<uint32_t const *>(frame + 8) ^ (uint32_t)(first_frame + i);
+                        bad |= *reinterpret_cast<uint16_t const *>(frame + filler_offset) & filler_mask;
+                }
+                if (bad) break;
+        }
+        for (; t < nframes; ++t) {
+                const frame_fault f = frame_fault_at(frames + t * frame_size, frame_size,
+                                                     first_frame + t);
+                if (f != FRAME_OK) {
+                        if (fault) *fault = f;
+                        return t;
+                }
+        }
+        if (fault) *fault = FRAME_OK;
+        return nframes;
+}
+
+size_t
+rhd2k::find_ttl_edges(void const * buf, size_t nframes, size_t frame_size,
+                      evalboard::data_type * state, ttl_edge_t * edges, size_t max_edges)
+{
+        const size_t block = 16;
+        char const * frames = static_cast<char const *>(buf) + frame_size - 4;
+        evalboard::data_type last = *state;
+        size_t count = 0;
+
+        for (size_t t = 0; t < nframes; t += block) {
+                const size_t end = std::min(t + block, nframes);
+                evalboard::data_type changed = 0;
+                char const * word = frames + t * frame_size;
+                for (size_t i = t; i < end; ++i, word += frame_size) {
+                        changed |= *reinterpret_cast<evalboard::data_type const *>(word) ^ last;
+                }
+                if (!changed) continue;
+                word = frames + t * frame_size;
+                for (size_t i = t; i < end; ++i, word += frame_size) {
+                        const evalboard::data_type value = *reinterpret_cast<evalboard::data_type const *>(word);
+                        const evalboard::data_type diff = value ^ last;
+                        if (diff && count < max_edges) {
+                                ttl_edge_t & e = edges[count++];
+                                e.frame = i;
+                                e.rising = diff & value;
+                                e.falling = diff & last;
+                        }
+                        last = value;
+                }
+        }
+        *state = last;
+        return count;
+}
+
+template <typename T>
+static void
+demodulate(char const * buf, size_t frame_size, size_t nframes, size_t period,
+           std::vector<size_t> const & offsets, double * sums)
+{
+        // one cycle of the reference, reused for every cycle of the data
+        std::vector<double> re(period), im(period);
+        for (size_t k = 0; k < period; ++k) {
+                const double phase = 2 * M_PI * k / period;
+                re[k] = cos(phase);
+                im[k] = -sin(phase);
+        }
+        // real and imaginary sums are interleaved by channel
+        const size_t nchannels = offsets.size();
+        size_t const * off = &offsets[0];
+        size_t k = 0;
+        for (size_t t = 0; t < nframes; ++t, buf += frame_size) {
+                const double c = re[k], s = im[k];
+                for (size_t j = 0; j < nchannels; ++j) {
+                        const double x = *reinterpret_cast<T const *>(buf + off[j]);
+                        sums[2*j] += x * c;
+                        sums[2*j+1] += x * s;
+                }
+                if (++k == period) k = 0;
+        }
+}
+
+void
+rhd2k::demodulate_channels(char const * buf, size_t frame_size, size_t nframes, size_t period,
+                           bool is_signed, std::vector<size_t> const & offsets,
+                           std::vector<std::complex<double> > & out)
+{
+        out.assign(offsets.size(), std::complex<double>());
+        if (offsets.empty()) return;
+        std::vector<double> sums(2 * offsets.size(), 0.0);
+        if (is_signed)
+                demodulate<int16_t>(buf, frame_size, nframes, period, offsets, &sums[0]);
+        else
+                demodulate<evalboard::data_type>(buf, frame_size, nframes, period, offsets, &sums[0]);
+        for (size_t j = 0; j < offsets.size(); ++j) {
+                out[j] = std::complex<double>(sums[2*j], sums[2*j+1]) * (2.0 / nframes);
+        }
+}
+
+std::complex<double>
+rhd2k::demodulate_channel(char const * src, size_t frame_size, size_t nframes, size_t period,
+                          bool is_signed)
+{
+        std::vector<std::complex<double> > out;
+        demodulate_channels(src, frame_size, nframes, period, is_signed,
+                            std::vector<size_t>(1, 0), out);
+        return out[0];
+}
@@ -0,0 +1,220 @@
+#ifndef _RHD2000FRAME_H
+#define _RHD2000FRAME_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <complex>
+#include <vector>
+#include "rhd2000eval.hpp"
+
+/*
+ * Helpers for the data frames returned by the Rhythm firmware. These don't
+ * need the hardware, so the driver, the tests, and the benchmarks all use
+ * the same code. Each frame has the following layout (in 16-bit words):
+ *
+ *   uint64_t header            (4)
+ *   uint32_t timestamp         (2)
+ *   aux[3][nstreams]
+ *   amp[32][nstreams]
+ *   filler[nstreams]           (always zero)
+ *   adc[8]
+ *   ttl_in
+ *   ttl_out
+ */
+namespace rhd2k {
+
+/** the size of a frame (in bytes) with nstreams enabled */
+inline std::size_t
+frame_size(std::size_t nstreams)
+{
+        return 2 * (4 + 2 + nstreams * 36 + 8 + 2);
+}
+
+/**
+ * Check the header, timestamp, and filler of the last frame in a buffer of
+ * nframes frames. Underfull reads repeat or corrupt the end of the buffer,
+ * so this catches most problems with the FIFO.
+ *
+ * @param first_frame  the expected timestamp of the first frame
+ */
+inline bool
+last_frame_valid(void const * buf, std::size_t nframes, std::size_t frame_size,
+                 uint32_t first_frame)
+{
+        char const * last = static_cast<char const *>(buf) + frame_size * (nframes - 1);
+        uint64_t const * magic = reinterpret_cast<uint64_t const *>(last);
+        uint32_t const * timestamp = reinterpret_cast<uint32_t const *>(magic + 1);
+        // back in 10 words for ADC results + TTL data; however, filler is only
+        // present if a stream is enabled and frame size is > 32)
+        uint16_t const * filler = reinterpret_cast<uint16_t const *>(last + frame_size - 22);
+
+        return (*magic == evalboard::frame_header &&
+                *timestamp == (first_frame + nframes - 1) &&
+                (*filler == 0 || frame_size == 32));
+}
+
+/** the first problem found in a frame by check_frames() */
+enum frame_fault {
+        FRAME_OK = 0,
+        FRAME_HEADER,           // magic number is wrong
+        FRAME_TIMESTAMP,        // timestamp is out of sequence
+        FRAME_FILLER            // filler word is not zero
+};
+
+inline char const *
+frame_fault_name(frame_fault fault)
+{
+        static char const * const names[] = { "ok", "bad header", "bad timestamp", "bad filler" };
+        return names[fault];
+}
+
+/**
+ * Check the header, timestamp, and filler of every frame in a buffer, and
+ * that the timestamps are contiguous. The scan accumulates mismatches over
+ * blocks of frames without branching, and only looks at individual frames
+ * in a block that has a fault, so it costs about as much as touching each
+ * header: 1.0-1.4 ns/frame in bench_readout with -O2, against 5-7 ns/frame
+ * unoptimized. rhd2000frame.cpp is always compiled with -O2 for this reason.
+ *
+ * @param first_frame  the expected timestamp of the first frame
+ * @param fault        if not null, set to the kind of the first fault
+ * @return the index of the first bad frame, or nframes if all are valid
+ */
+std::size_t check_frames(void const * buf, std::size_t nframes, std::size_t frame_size,
+                         uint32_t first_frame, frame_fault * fault = 0);
+
+/**
+ * Demodulate one channel at a frequency with a whole number of samples per
+ * cycle (a lock-in measurement). nframes should be a multiple of period,
+ * which cancels any offset.
+ *
+ * @param period     samples per cycle of the frequency
+ * @param is_signed  true for two's complement samples
+ * @return the complex amplitude (peak, in sample units) relative to a
+ *         cosine that starts at the first frame
+ */
+std::complex<double> demodulate_channel(char const * src, std::size_t frame_size,
+                                        std::size_t nframes, std::size_t period,
+                                        bool is_signed);
+
+/**
+ * Demodulate several channels at once, as demodulate_channel(). The
+ * reference is computed once, and the frames are read in a single pass.
+ *
+ * @param offsets  byte offsets of the channels in the frame
+ * @param out      the complex amplitude of each channel
+ */
+void demodulate_channels(char const * buf, std::size_t frame_size, std::size_t nframes,
+                         std::size_t period, bool is_signed,
+                         std::vector<std::size_t> const & offsets,
+                         std::vector<std::complex<double> > & out);
+
+/** A change in the TTL inputs */
+struct ttl_edge_t {
+        std::size_t frame;              // index in the buffer
+        evalboard::data_type rising;    // inputs that went high
+        evalboard::data_type falling;   // inputs that went low
+};
+
+/**
+ * Find the frames where any of the TTL inputs change. As with
+ * check_frames(), changes are accumulated over blocks of frames without
+ * branching, and only blocks with a change are looked at frame by frame.
+ *
+ * @param state  the inputs before the first frame; set to the inputs in the
+ *               last frame
+ * @param edges  filled with up to max_edges changes, in order
+ * @return the number of changes stored in edges
+ */
+std::size_t find_ttl_edges(void const * buf, std::size_t nframes, std::size_t frame_size,
+                           evalboard::data_type * state, ttl_edge_t * edges,
+                           std::size_t max_edges);
+
+/**
+ * Copy one channel out of a buffer of frames, converting to floating point
+ * (x / 32768 + offset).
+ *
+ * @param src     pointer to the channel's sample in the first frame
+ *                (buffer + channel_info_t::byte_offset)
+ * @param offset  -1.0 for amplifier channels, 0.0 for eval board ADCs
+ */
+inline void
+convert_channel(char const * src, std::size_t frame_size, std::size_t nframes,
+                float offset, float * out)
+{
+        const float data_scale = 1.0f / 32768.0f;
+        for (std::size_t t = 0; t < nframes; ++t, src += frame_size) {
+                out[t] = *reinterpret_cast<evalboard::data_type const *>(src) * data_scale + offset;
+        }
+}
+
+/**
+ * Copy one channel of two's complement samples (amplifiers in
+ * evalboard::set_twoscomp() mode) out of a buffer of frames, converting to
+ * floating point (x / 32768). The values are the same as convert_channel()
+ * gives for the offset binary samples with offset -1.0.
+ */
+inline void
+convert_channel_signed(char const * src, std::size_t frame_size, std::size_t nframes,
+                       float * out)
+{
+        const float data_scale = 1.0f / 32768.0f;
+        for (std::size_t t = 0; t < nframes; ++t, src += frame_size) {
+                out[t] = *reinterpret_cast<int16_t const *>(src) * data_scale;
+        }
+}
+
+/**
+ * Copy one channel out of a buffer of frames without converting it. The
+ * samples are offset binary, or two's complement for amplifiers in
+ * evalboard::set_twoscomp() mode.
+ */
+inline void
+gather_channel(char const * src, std::size_t frame_size, std::size_t nframes,
+               evalboard::data_type * out)
+{
+        for (std::size_t t = 0; t < nframes; ++t, src += frame_size) {
+                out[t] = *reinterpret_cast<evalboard::data_type const *>(src);
+        }
+}
+
+/** the timestamp of a frame */
+inline uint32_t
+frame_timestamp(char const * frame)
+{
+        return *reinterpret_cast<uint32_t const *>(frame + 8);
+}
+
+/** the TTL inputs of a frame (second-to-last word) */
+inline evalboard::data_type
+frame_ttl_in(char const * frame, std::size_t frame_size)
+{
+        return *reinterpret_cast<evalboard::data_type const *>(frame + frame_size - 4);
+}
+
+/** the TTL outputs of a frame (last word) */
+inline evalboard::data_type
+frame_ttl_out(char const * frame, std::size_t frame_size)
+{
+        return *reinterpret_cast<evalboard::data_type const *>(frame + frame_size - 2);
+}
+
+/**
+ * Fill a buffer with synthetic frames, for testing without hardware. Frames
+ * have correct headers, timestamps, and filler. Sample values are
+ * synthetic_sample(timestamp, word), where word is the index of the 16-bit
+ * word in the frame.
+ */
+void synthesize_frames(void * buf, std::size_t nframes, std::size_t nstreams,
+                       uint32_t first_frame);
+
+/** the value written by synthesize_frames() */
+inline evalboard::data_type
+synthetic_sample(uint32_t timestamp, std::size_t word)
+{
+        return static_cast<evalboard::data_type>(timestamp * 7 + word * 31);
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "rhd2000shm.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+
+/* the data start on a page boundary after the header */
+static size_t
+data_offset()
+{
+        const size_t page = sysconf(_SC_PAGESIZE);
+        return (sizeof(shm_header) + page - 1) / page * page;
+}
+
+shm_writer::shm_writer(char const * name, size_t frame_size, size_t sampling_rate,
+                       size_t capacity, std::vector<evalboard::channel_info_t> const & table,
+                       bool twoscomp)
+        : _name(name), _size(data_offset() + frame_size * capacity), _header(0), _data(0)
+{
+        if (table.size() > shm_max_channels)
+                throw daq_error("too many channels for shared memory ring");
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+                throw daq_error(std::string("unable to create shared memory segment: ") + strerror(errno));
+        if (ftruncate(fd, _size) < 0) {
+                close(fd);
+                shm_unlink(name);
+                throw daq_error(std::string("unable to size shared memory segment: ") + strerror(errno));
+        }
+        void * p = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+                shm_unlink(name);
+                throw daq_error(std::string("unable to map shared memory segment: ") + strerror(errno));
+        }
+        // keep the ring out of the page fault path
+        mlock(p, _size);
+
+        _header = static_cast<shm_header *>(p);
+        _data = static_cast<char *>(p) + data_offset();
+        _header->version = shm_version;
+        _header->frame_size = frame_size;
+        _header->sampling_rate = sampling_rate;
+        _header->capacity = capacity;
+        _header->data_offset = data_offset();
+        _header->nchannels = table.size();
+        _header->twoscomp = twoscomp;
+        for (size_t i = 0; i < table.size(); ++i) {
+                shm_channel & c = _header->channels[i];
+                strncpy(c.name, table[i].name.c_str(), sizeof(c.name) - 1);
+                c.byte_offset = table[i].byte_offset;
+                c.stream = table[i].stream;
+        }
+        _header->write_pos = _header->reserve_pos = _header->base = 0;
+        _header->restarts = 0;
+        _header->running = 1;
+        __sync_synchronize();
+        _header->magic = shm_magic;
+}
+
+shm_writer::~shm_writer()
+{
+        _header->running = 0;
+        munmap(_header, _size);
+        shm_unlink(_name.c_str());
+}
+
+void *
+shm_writer::reserve(size_t nframes)
+{
+        const uint64_t slot = _header->write_pos % _header->capacity;
+        if (slot + nframes > _header->capacity) return 0;
+        _header->reserve_pos = _header->write_pos + nframes;
+        // readers must see the reservation before any slot is overwritten
+        __sync_synchronize();
+        return _data + slot * _header->frame_size;
+}
+
+void
+shm_writer::commit(size_t nframes)
+{
+        __sync_synchronize();
+        _header->write_pos += nframes;
+}
+
+void
+shm_writer::restart()
+{
+        _header->base = _header->write_pos;
+        _header->restarts += 1;
+}
+
+shm_reader::shm_reader(char const * name)
+        : _size(0), _header(0), _data(0), _cursor(0), _overruns(0)
+{
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0)
+                throw daq_error(std::string("unable to open shared memory segment: ") + strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(shm_header)) {
+                close(fd);
+                throw daq_error("shared memory segment is not a frame ring");
+        }
+        _size = st.st_size;
+        void * p = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+                throw daq_error(std::string("unable to map shared memory segment: ") + strerror(errno));
+        _header = static_cast<shm_header const *>(p);
+        if (_header->magic != shm_magic || _header->version != shm_version ||
+            _header->data_offset + _header->capacity * _header->frame_size > _size) {
+                munmap(p, _size);
+                throw daq_error("shared memory segment is not a frame ring, or has the wrong version");
+        }
+        _data = static_cast<char const *>(p) + _header->data_offset;
+        seek_latest();
+}
+
+shm_reader::~shm_reader()
+{
+        munmap(const_cast<shm_header *>(_header), _size);
+}
+
+void
+shm_reader::seek_latest()
+{
+        _cursor = _header->write_pos;
+}
+
+char const *
+shm_reader::peek(size_t * nframes) const
+{
+        const uint64_t capacity = _header->capacity;
+        const uint64_t end = _header->write_pos;
+        __sync_synchronize();
+        const uint64_t slot = _cursor % capacity;
+        *nframes = std::min(end - _cursor, capacity - slot);
+        return _data + slot * _header->frame_size;
+}
+
+bool
+shm_reader::release(size_t nframes)
+{
+        __sync_synchronize();
+        if (_header->reserve_pos > _cursor + _header->capacity) {
+                _overruns += 1;
+                seek_latest();
+                return false;
+        }
+        _cursor += nframes;
+        return true;
+}
@@ -0,0 +1,171 @@
+#ifndef _RHD2000SHM_H
+#define _RHD2000SHM_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "rhd2000eval.hpp"
+
+/*
+ * A ring of raw eval board frames in POSIX shared memory, written by one
+ * process (the acquisition daemon) and read by any number of others, each
+ * with its own cursor. Readers get pointers into the ring, so the data are
+ * not copied or converted on the way.
+ *
+ * Frames are addressed by 64-bit sequence numbers taken from their
+ * timestamps: the frame with timestamp ts in the current run of the board
+ * has sequence number base + ts. When acquisition restarts, the timestamps
+ * start over at 0 and base moves to the end of the data, so sequence
+ * numbers keep increasing (and they also keep increasing when the 32-bit
+ * timestamps wrap). A frame's slot in the ring is its sequence number
+ * modulo the capacity.
+ *
+ * The writer doesn't wait for readers. Before it overwrites a block of
+ * slots it advances reserve_pos, and after the block has been written it
+ * advances write_pos. Frames older than reserve_pos - capacity may have
+ * been overwritten, so a reader checks after it has used a block that its
+ * cursor is still newer than that (see shm_reader::release).
+ */
+namespace rhd2k {
+
+static const uint32_t shm_magic = 0x4d534852;   // "RHSM"
+static const uint32_t shm_version = 2;
+static const std::size_t shm_max_channels = 1024;
+
+/** a channel in the frames, as in evalboard::adc_table() */
+struct shm_channel {
+        char name[16];
+        uint32_t byte_offset;
+        int32_t stream;         // evalboard::miso_id
+};
+
+struct shm_header {
+        volatile uint32_t magic;        // set last by the writer
+        uint32_t version;
+        uint32_t frame_size;
+        uint32_t sampling_rate;
+        uint64_t capacity;              // frames
+        uint64_t data_offset;           // bytes from the start of the segment
+        uint32_t nchannels;
+        uint32_t twoscomp;              // amplifier samples are signed
+        shm_channel channels[shm_max_channels];
+
+        volatile uint64_t write_pos;    // one past the last frame written
+        volatile uint64_t reserve_pos;  // one past the last frame being written
+        volatile uint64_t base;         // sequence number of timestamp 0
+        volatile uint32_t restarts;     // how many times acquisition restarted
+        volatile uint32_t running;      // cleared when the writer exits
+};
+
+/** The writing end of the ring. Only one process should create it. */
+class shm_writer {
+
+public:
+        /**
+         * Create (or replace) a shared memory segment.
+         *
+         * @param name      POSIX shm name, e.g. "/rhd2000"
+         * @param capacity  ring size, in frames
+         * @param table     the channels in the frames
+         * @param twoscomp  true if the amplifier samples are two's complement
+         * @throws daq_error if the segment can't be created
+         */
+        shm_writer(char const * name, std::size_t frame_size, std::size_t sampling_rate,
+                   std::size_t capacity, std::vector<evalboard::channel_info_t> const & table,
+                   bool twoscomp=false);
+        /** marks the ring as stopped and unlinks it */
+        ~shm_writer();
+
+        shm_header const & header() const { return *_header; }
+
+        /**
+         * Reserve the next nframes slots for writing. Readers will treat any
+         * frames in these slots as overwritten.
+         *
+         * @return pointer to the slots, or 0 if they would wrap around the
+         *         end of the ring (use a capacity that is a multiple of the
+         *         block size)
+         */
+        void * reserve(std::size_t nframes);
+
+        /** make the frames in the last reservation available to readers */
+        void commit(std::size_t nframes);
+
+        /**
+         * Note that acquisition has restarted, so that the next timestamp 0
+         * follows the last committed frame
+         */
+        void restart();
+
+        /** the timestamp expected for the next frame */
+        uint32_t next_timestamp() const { return _header->write_pos - _header->base; }
+
+private:
+        shm_writer(shm_writer const &);
+        shm_writer & operator=(shm_writer const &);
+
+        std::string _name;
+        std::size_t _size;
+        shm_header * _header;
+        char * _data;
+};
+
+/** A reader of the ring, with its own cursor */
+class shm_reader {
+
+public:
+        /**
+         * Attach to a ring. The cursor starts at the newest frame.
+         *
+         * @throws daq_error if the segment doesn't exist or isn't a ring
+         */
+        explicit shm_reader(char const * name);
+        ~shm_reader();
+
+        shm_header const & header() const { return *_header; }
+
+        /** false once the writer has exited */
+        bool running() const { return _header->running; }
+
+        /** the sequence number of the next frame to read */
+        uint64_t cursor() const { return _cursor; }
+
+        /** the number of times data were overwritten before they were read */
+        unsigned long overruns() const { return _overruns; }
+
+        /** skip to the newest frame */
+        void seek_latest();
+
+        /**
+         * Get the frames after the cursor, without copying.
+         *
+         * @param nframes  set to the number of frames available and
+         *                 contiguous in memory (0 if none)
+         * @return pointer to the frame at the cursor
+         */
+        char const * peek(std::size_t * nframes) const;
+
+        /**
+         * Advance the cursor past frames that have been used.
+         *
+         * @return false if the writer may have overwritten the frames before
+         *         they were used, in which case they should be discarded;
+         *         the cursor moves to the newest frame
+         */
+        bool release(std::size_t nframes);
+
+private:
+        shm_reader(shm_reader const &);
+        shm_reader & operator=(shm_reader const &);
+
+        std::size_t _size;
+        shm_header const * _header;
+        char const * _data;
+        uint64_t _cursor;
+        unsigned long _overruns;
+};
+
+} // namespace
+
+#endif
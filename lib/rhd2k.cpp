@@ -257,6 +257,34 @@ rhd2000::set_dsp_cutoff(double hz)
 
 }
 
+bool
+rhd2000::twoscomp() const
+{
+        return (_registers[4] & 0x40) > 0;
+}
+
+void
+rhd2000::set_twoscomp(bool enabled)
+{
+        if (enabled) _registers[4] |= 0x40;
+        else _registers[4] &= ~0x40;
+}
+
+void
+rhd2000::set_zcheck(bool enabled, zcheck_scale scale, size_t channel)
+{
+        assert (channel < 2 * max_amps);
+        // register 5: scale [4:3], enable [0]; register 7: channel select
+        _registers[5] = (_registers[5] & ~0x19) | (scale << 3) | (enabled ? 0x01 : 0x00);
+        _registers[7] = channel & 0x3f;
+}
+
+void
+rhd2000::copy_settings(rhd2000 const & other)
+{
+        memcpy(_registers, other._registers, ram_register_count * sizeof(data_type));
+}
+
 void
 rhd2000::set_amp_power(size_t channel, bool powered)
 {
@@ -289,7 +317,9 @@ rhd2000::amp_power(size_t channel) const
 size_t
 rhd2000::amps_powered() const
 {
-        return std::bitset<max_amps>(amp_power()).count();
+        // on the RHD2164 each bit of the mask controls amps n and n+32
+        const size_t n = std::bitset<max_amps>(amp_power()).count();
+        return ddr() ? 2 * n : n;
 }
 
 bool
@@ -316,6 +346,13 @@ rhd2000::chip_id() const
         return _registers[63];
 }
 
+bool
+rhd2000::miso_b() const
+{
+        // register 59 reads 53 on MISO A and 58 on MISO B
+        return ddr() && _registers[59] == 58;
+}
+
 void
 rhd2000::set_sampling_rate_registers()
 {
@@ -444,6 +481,36 @@ rhd2000::command_regset(std::vector<short> &out, bool do_calibrate) const
 
 }
 
+void
+rhd2000::command_fast_settle(std::vector<short> &out) const
+{
+        // register 0 bit 5 is amp fast settle
+        out.assign(register_sequence_length, reg_write(0, _registers[0] | 0x20));
+}
+
+unsigned short
+rhd2000::fast_settle_result() const
+{
+        // writes return 0xff followed by the value written
+        return 0xff00 | _registers[0] | 0x20;
+}
+
+uint64_t
+rhd2000::fast_settle_aliases() const
+{
+        std::vector<short> commands;
+        command_regset(commands, false);
+        const unsigned short result = fast_settle_result();
+        uint64_t aliases = 0;
+        for (size_t i = 0; i < commands.size(); ++i) {
+                const unsigned short cmd = commands[i];
+                // reads return 0 followed by the register
+                if ((cmd & 0xc000) == 0x8000 && (0xff00 | (cmd & 0xff)) == result)
+                        aliases |= (uint64_t)1 << i;
+        }
+        return aliases;
+}
+
 void
 rhd2000::command_auxsample(std::vector<short> &out) const
 {
@@ -494,7 +561,8 @@ std::ostream &
 operator<< (std::ostream &o, rhd2000 const &r)
 {
         if (r.connected()) {
-                if (r.chip_id() == 1) o << "RHD2132";
+                if (r.chip_id() == rhd2000::RHD2132) o << "RHD2132";
+                else if (r.chip_id() == rhd2000::RHD2164) o << "RHD2164";
                 else o << "RHD2116";
                 o << " (rev=" << r.revision() << ", amps=" << r.amps_powered() << '/' << r.amps() << "):"
                   << " bandw: " << r.lower_cutoff() << " - " << r.upper_cutoff() << " Hz"
@@ -36,13 +36,36 @@ public:
         typedef unsigned char data_type;
         /** the total number of registers on the chip */
         static const std::size_t register_count = 64;
-        /** the maximum number of available amps */
+        /**
+         * the maximum number of amps sampled on one edge of the MISO clock.
+         * The RHD2164 has twice as many, with the second half returned on the
+         * falling edge (see ddr())
+         */
         static const std::size_t max_amps = 32;
         /** the number of commands in the register programming sequence */
         static const std::size_t register_sequence_length = 60;
+        /**
+         * the command in the register sequence that writes register 0, which
+         * takes the amplifiers out of fast settle
+         */
+        static const std::size_t register_sequence_reg0 = 2;
         /** the data type for the amp power mask */
         typedef uint32_t power_mask_type;
 
+        /** series capacitors for the impedance test DAC */
+        enum zcheck_scale {
+                Zcheck100fF = 0,
+                Zcheck1pF = 1,
+                Zcheck10pF = 3
+        };
+
+        /** values returned by chip_id() */
+        enum chip_type {
+                RHD2132 = 1,
+                RHD2216 = 2,
+                RHD2164 = 4
+        };
+
         explicit rhd2000(std::size_t sampling_rate);
         ~rhd2000() {}
 
@@ -58,6 +81,24 @@ public:
         /** if arg is <= 0, turn off dsp */
         void set_dsp_cutoff(double);
 
+        /**
+         * Copy the settings (RAM registers) from another chip, e.g. the
+         * object that programs the MOSI line this chip listens on
+         */
+        void copy_settings(rhd2000 const & other);
+
+        /** true if the ADC returns two's complement (signed) samples */
+        bool twoscomp() const;
+        /** select two's complement (true) or offset binary (false) samples */
+        void set_twoscomp(bool);
+
+        /**
+         * Connect the impedance test DAC through a series capacitor to an
+         * amplifier input (0-63), or disconnect it. The DAC is driven by
+         * command_dac() sequences.
+         */
+        void set_zcheck(bool enabled, zcheck_scale scale=Zcheck1pF, std::size_t channel=0);
+
         void set_amp_power(std::size_t channel, bool powered);
         void set_amp_power(power_mask_type mask);
         bool amp_power(std::size_t chan) const;
@@ -89,9 +130,33 @@ public:
         int amps() const;
         /** The chip ID */
         int chip_id() const;
+        /**
+         * True if the chip returns a second sample (amps 32-63) on the falling
+         * edge of each MISO clock cycle (double data rate)
+         */
+        bool ddr() const { return chip_id() == RHD2164; }
+        /**
+         * True if this is the MISO B output of an RHD2164. The data on this
+         * line duplicate MISO A, which carries both halves.
+         */
+        bool miso_b() const;
 
         void command_regset(std::vector<short> &out, bool calibrate) const ;
         void command_auxsample(std::vector<short> &out) const;
+        /**
+         * A sequence as long as command_regset() that holds the amplifiers
+         * in fast settle, by writing register 0 with the fast settle bit set
+         */
+        void command_fast_settle(std::vector<short> &out) const;
+        /** the result the chip returns for the commands in command_fast_settle() */
+        unsigned short fast_settle_result() const;
+        /**
+         * The commands in command_regset() whose results are the same as
+         * fast_settle_result(), as a bit mask (bit i for command i). These
+         * are writes of other registers with the same value, such as an amp
+         * power byte of 0xfe.
+         */
+        uint64_t fast_settle_aliases() const;
         template <typename InputIterator>
         void command_dac(std::vector<short> & out, InputIterator first, InputIterator last) const;
 
@@ -124,7 +189,6 @@ private:
         data_type digout_hiz() const;
         data_type digout() const;
         data_type weak_miso() const;
-        data_type twoscomp() const;
         data_type absmode() const;
         data_type dsp_cutoff_enabled() const;
         data_type dsp_cutoff_freq() const;
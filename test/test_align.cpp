@@ -0,0 +1,140 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "rhd2000align.hpp"
+#include "rhd2000frame.hpp"
+
+using namespace rhd2k;
+using namespace std;
+
+static const double rate = 30000;
+
+/*
+ * two boards, the second 50 ppm fast and started 3 ms later, read in
+ * transfers with 0-2 ms of USB latency
+ */
+void
+test_clock_phase()
+{
+        clock_phase ref(rate), sec(rate);
+        const double ppm = 50e-6;
+        const double start_ns = 1e12;
+        const double skew_s = 0.003;
+        srand(1);
+        for (int i = 0; i < 3000; ++i) {
+                const double t = i * 1024 / rate;       // seconds since ref start
+                const double lat_r = 2e-3 * rand() / RAND_MAX;
+                const double lat_s = 2e-3 * rand() / RAND_MAX;
+                ref.observe((uint32_t)(t * rate), (uint64_t)(start_ns + (t + lat_r) * 1e9));
+                const uint32_t ts = (uint32_t)((t - skew_s) * rate * (1 + ppm));
+                sec.observe(ts, (uint64_t)(start_ns + (t + lat_s) * 1e9));
+        }
+        // after 100 s, the second board has made up about 150 of the 90
+        // frames it started behind
+        const double t = 2999 * 1024 / rate;
+        const double expected = (t - skew_s) * rate * (1 + ppm) - t * rate;
+        double sec_phase, ref_phase;
+        const bool valid = sec.snapshot(&sec_phase) && ref.snapshot(&ref_phase);
+        assert(valid);
+        const double measured = sec_phase - ref_phase;
+        cout << "phase offset: expected " << expected << ", measured " << measured << endl;
+        assert(fabs(measured - expected) < board_alignment::estimated_deadband);
+
+        ref.reset();
+        const bool reset_valid = ref.snapshot(&ref_phase);
+        assert(!reset_valid);
+}
+
+struct collect_edges {
+        collect_edges(vector<size_t> & out, size_t offset) : out(out), offset(offset) {}
+        void operator()(size_t t) const { out.push_back(offset + t); }
+        vector<size_t> & out;
+        size_t offset;
+};
+
+void
+test_rising_edge()
+{
+        const size_t nframes = 50, nstreams = 1, fsize = frame_size(nstreams);
+        vector<char> buf(nframes * fsize);
+        synthesize_frames(&buf[0], nframes, nstreams, 0);
+        for (size_t t = 0; t < nframes; ++t) {
+                evalboard::data_type ttl = (t >= 20 && t < 30) ? 0x0004 : 0x0001;
+                memcpy(&buf[t * fsize + fsize - 4], &ttl, sizeof(ttl));
+        }
+        bool level = false;
+        assert(find_rising_edge(&buf[0], nframes, fsize, 2, &level) == 20);
+        assert(!level);
+        // bit 0 is high throughout; an edge only if it was low before
+        level = true;
+        assert(find_rising_edge(&buf[0], nframes, fsize, 0, &level) == 30);
+        level = true;
+        assert(find_rising_edge(&buf[0], 20, fsize, 0, &level) == 20);
+        assert(level);
+        level = false;
+        assert(find_rising_edge(&buf[0], nframes, fsize, 0, &level) == 0);
+        assert(level);
+
+        // every edge, across buffers. Bit 3 is high at the start, in two
+        // pulses, in a pulse that spans the two halves, and at the end
+        for (size_t t = 0; t < nframes; ++t) {
+                evalboard::data_type ttl = (t < 5 || (t >= 10 && t < 12) ||
+                                            (t >= 24 && t < 26) || t >= 40) ? 0x0008 : 0;
+                memcpy(&buf[t * fsize + fsize - 4], &ttl, sizeof(ttl));
+        }
+        rising_edges edges(3);
+        vector<size_t> found;
+        edges.scan(&buf[0], 25, fsize, collect_edges(found, 0));
+        edges.scan(&buf[25 * fsize], 25, fsize, collect_edges(found, 25));
+        assert(found.size() == 3);
+        assert(found[0] == 10 && found[1] == 24 && found[2] == 40);
+        // still high from the end of the last buffer
+        assert(edges.count(&buf[0], nframes, fsize) == 3);
+        edges.reset();
+        assert(edges.count(&buf[0], nframes, fsize) == 3);
+        assert(edges.next(&buf[0], nframes, fsize, 0) == 10);
+        assert(edges.next(&buf[0], nframes, fsize, 11) == 24);
+}
+
+void
+test_alignment()
+{
+        board_alignment a(rate);
+        double offset;
+        assert(!a.offset(0, false, &offset));
+        assert(a.offset(-90.3, true, &offset) && offset == -90.3);
+
+        // deadband when estimated
+        assert(a.correction(-90.3, 1000, 910, 64) == 0);
+        assert(a.correction(-90.3, 1000, 900, 64) == 10);
+        assert(a.correction(-90.3, 1000, 1000, 64) == -64);
+
+        // edges that are too far apart don't match
+        a.sync_edge(false, 20000, -90.3, true);
+        a.sync_edge(true, 40000, -90.3, true);
+        assert(!a.synced());
+        // the reference edge is discarded, so this one matches
+        a.sync_edge(false, 40095, -90.3, true);
+        assert(a.synced());
+        assert(a.offset(-90.3, true, &offset) && offset == -95);
+        // drift is followed from the clock phase
+        assert(a.offset(-89.3, true, &offset) && offset == -94);
+        assert(a.correction(-94, 1000, 906, 64) == 0);
+        assert(a.correction(-94, 1000, 905, 64) == 1);
+        assert(a.correction(-94, 1000, 907, 64) == -1);
+
+        a.reset();
+        assert(!a.synced());
+        cout << "alignment: ok" << endl;
+}
+
+int
+main(int, char**)
+{
+        test_clock_phase();
+        test_rising_edge();
+        test_alignment();
+}
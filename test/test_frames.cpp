@@ -0,0 +1,283 @@
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <cstring>
+#include "rhd2000eval.hpp"
+#include "rhd2000frame.hpp"
+
+using namespace rhd2k;
+using namespace std;
+
+void
+test_adc_table()
+{
+        vector<evalboard::channel_info_t> table;
+        ulong powers[evalboard::nmiso] = { 0xffffffff, 0x0000ffff, 0, 0, 0x1, 0, 0, 0 };
+
+        // no streams: only the eval board ADCs
+        evalboard::make_adc_table(table, 0x00, powers);
+        assert(table.size() == evalboard::naux_adcs);
+        assert(table[0].stream == evalboard::EvalADC);
+        assert(table[0].byte_offset == 2 * 6);
+
+        // streams A1, A2, and C1
+        evalboard::make_adc_table(table, 0x13, powers);
+        assert(table.size() == 32 + 16 + 1 + evalboard::naux_adcs);
+        const size_t nstreams = 3;
+        assert(table[0].stream == evalboard::PortA1);
+        assert(table[0].byte_offset == 2 * (6 + 3 * nstreams));
+        assert(table[32].stream == evalboard::PortA2);
+        assert(table[32].byte_offset == 2 * (6 + 3 * nstreams + 1));
+        // stream index, not MISO line
+        assert(table[48].stream == evalboard::PortB1);
+        assert(table[48].byte_offset == 2 * (6 + 3 * nstreams + 2));
+        assert(table[49].stream == evalboard::EvalADC);
+        assert(table[49].byte_offset == 2 * (6 + 36 * nstreams));
+        cout << "adc table: " << table.size() << " channels" << endl;
+
+        // RHD2164 on A1, with its second half routed to the A2 stream
+        ulong sources[evalboard::nmiso] = { evalboard::PortA1, evalboard::PortA1 + evalboard::ddr_source,
+                                            2, 3, 4, 5, 6, 7 };
+        ulong ddr_powers[evalboard::nmiso] = { 0xffffffff, 0xffffffff, 0, 0, 0, 0, 0, 0 };
+        evalboard::make_adc_table(table, 0x03, ddr_powers, sources);
+        assert(table.size() == 64 + evalboard::naux_adcs);
+        assert(table[0].name == "A1_0");
+        assert(table[32].name == "A1_32");
+        assert(table[63].name == "A1_63");
+        assert(table[32].stream == evalboard::PortA2);
+        assert(table[32].channel == 0);
+        assert(table[32].byte_offset == 2 * (6 + 3 * 2 + 1));
+        cout << "adc table (ddr): " << table.size() << " channels" << endl;
+}
+
+void
+test_synthetic_frames()
+{
+        for (size_t nstreams = 0; nstreams <= evalboard::nmiso; ++nstreams) {
+                const size_t period = 64;
+                const size_t fsize = frame_size(nstreams);
+                vector<char> buf(fsize * period);
+                synthesize_frames(&buf[0], period, nstreams, 1000);
+                assert(last_frame_valid(&buf[0], period, fsize, 1000));
+                assert(!last_frame_valid(&buf[0], period, fsize, 0));
+
+                // conversion picks out the right words
+                vector<evalboard::channel_info_t> table;
+                ulong powers[evalboard::nmiso];
+                for (size_t i = 0; i < evalboard::nmiso; ++i) powers[i] = 0xffffffff;
+                evalboard::make_adc_table(table, (1UL << nstreams) - 1, powers);
+                vector<float> out(period);
+                for (size_t c = 0; c < table.size(); ++c) {
+                        const size_t word = table[c].byte_offset / 2;
+                        convert_channel(&buf[table[c].byte_offset], fsize, period, -1.0f, &out[0]);
+                        for (size_t t = 0; t < period; ++t) {
+                                float expected = synthetic_sample(1000 + t, word) / 32768.0f - 1.0f;
+                                assert(out[t] == expected);
+                        }
+                }
+
+                // a repeated last frame is detected
+                memcpy(&buf[fsize * (period - 1)], &buf[fsize * (period - 2)], fsize);
+                assert(!last_frame_valid(&buf[0], period, fsize, 1000));
+        }
+}
+
+void
+test_check_frames()
+{
+        const size_t period = 100;
+        for (size_t nstreams = 0; nstreams <= evalboard::nmiso; ++nstreams) {
+                const size_t fsize = frame_size(nstreams);
+                vector<char> buf(fsize * period);
+                frame_fault fault;
+                synthesize_frames(&buf[0], period, nstreams, 1000);
+                assert(check_frames(&buf[0], period, fsize, 1000, &fault) == period);
+                assert(fault == FRAME_OK);
+                assert(check_frames(&buf[0], period, fsize, 999, &fault) == 0);
+                assert(fault == FRAME_TIMESTAMP);
+
+                // faults in each position of a block, including the tail
+                const size_t positions[] = { 0, 1, 15, 16, 37, 95, 99 };
+                for (size_t i = 0; i < sizeof(positions) / sizeof(size_t); ++i) {
+                        const size_t t = positions[i];
+                        char * frame = &buf[fsize * t];
+
+                        frame[3] ^= 0x10;
+                        assert(check_frames(&buf[0], period, fsize, 1000, &fault) == t);
+                        assert(fault == FRAME_HEADER);
+                        frame[3] ^= 0x10;
+
+                        frame[8] ^= 0x01;
+                        assert(check_frames(&buf[0], period, fsize, 1000, &fault) == t);
+                        assert(fault == FRAME_TIMESTAMP);
+                        frame[8] ^= 0x01;
+
+                        frame[fsize - 22] = 1;
+                        const size_t idx = check_frames(&buf[0], period, fsize, 1000, &fault);
+                        if (nstreams) {
+                                assert(idx == t);
+                                assert(fault == FRAME_FILLER);
+                        }
+                        else {
+                                // no filler; this byte is part of the timestamp
+                                assert(idx == t);
+                                assert(fault == FRAME_TIMESTAMP);
+                        }
+                        frame[fsize - 22] = 0;
+                        // restore the timestamp if the filler overlapped it
+                        synthesize_frames(&buf[0], period, nstreams, 1000);
+                }
+
+                // a repeated frame in the middle is caught, and the earliest fault wins
+                memcpy(&buf[fsize * 50], &buf[fsize * 49], fsize);
+                memset(&buf[fsize * 80], 0, fsize);
+                assert(check_frames(&buf[0], period, fsize, 1000, &fault) == 50);
+                assert(fault == FRAME_TIMESTAMP);
+                assert(last_frame_valid(&buf[0], period, fsize, 1000));
+        }
+        cout << "check frames: ok" << endl;
+}
+
+void
+test_twoscomp()
+{
+        // the chip's two's complement samples are offset binary with the MSB
+        // flipped, and must convert to exactly the same values
+        const size_t period = 256;
+        const size_t nstreams = 1;
+        const size_t fsize = frame_size(nstreams);
+        vector<char> buf(fsize * period), flipped;
+        synthesize_frames(&buf[0], period, nstreams, 0);
+        flipped = buf;
+        const size_t offset = 2 * (6 + 3 * nstreams);
+        for (size_t t = 0; t < period; ++t) {
+                evalboard::data_type * x = reinterpret_cast<evalboard::data_type *>(&flipped[t * fsize + offset]);
+                *x ^= 0x8000;
+        }
+        vector<float> expected(period), out(period);
+        convert_channel(&buf[offset], fsize, period, -1.0f, &expected[0]);
+        convert_channel_signed(&flipped[offset], fsize, period, &out[0]);
+        for (size_t t = 0; t < period; ++t) {
+                assert(out[t] == expected[t]);
+        }
+        cout << "twos complement conversion: ok" << endl;
+}
+
+void
+test_gather()
+{
+        // raw samples, scaled as the packed port metadata describe, must
+        // match the float conversion
+        const size_t period = 256;
+        const size_t nstreams = 2;
+        const size_t fsize = frame_size(nstreams);
+        vector<char> buf(fsize * period);
+        synthesize_frames(&buf[0], period, nstreams, 0);
+        const size_t offset = 2 * (6 + 3 * nstreams + 1);
+        vector<evalboard::data_type> raw(period);
+        vector<float> expected(period);
+        gather_channel(&buf[offset], fsize, period, &raw[0]);
+        convert_channel(&buf[offset], fsize, period, -1.0f, &expected[0]);
+        for (size_t t = 0; t < period; ++t) {
+                assert(raw[t] == *reinterpret_cast<evalboard::data_type *>(&buf[t * fsize + offset]));
+                assert(raw[t] * (1.0f / 32768.0f) - 1.0f == expected[t]);
+        }
+        cout << "raw gather: ok" << endl;
+}
+
+void
+test_ttl_edges()
+{
+        const size_t period = 100;
+        const size_t nstreams = 1;
+        const size_t fsize = frame_size(nstreams);
+        vector<char> buf(fsize * period);
+        synthesize_frames(&buf[0], period, nstreams, 0);
+        // input 0 high from frame 10 to 39, input 3 high from 17 on
+        for (size_t t = 0; t < period; ++t) {
+                evalboard::data_type * ttl = reinterpret_cast<evalboard::data_type *>(&buf[(t + 1) * fsize - 4]);
+                *ttl = ((t >= 10 && t < 40) ? 0x1 : 0) | ((t >= 17) ? 0x8 : 0);
+        }
+        ttl_edge_t edges[8];
+        evalboard::data_type state = 0;
+        size_t n = find_ttl_edges(&buf[0], period, fsize, &state, edges, 8);
+        assert(n == 3);
+        assert(edges[0].frame == 10 && edges[0].rising == 0x1 && edges[0].falling == 0);
+        assert(edges[1].frame == 17 && edges[1].rising == 0x8 && edges[1].falling == 0);
+        assert(edges[2].frame == 40 && edges[2].rising == 0 && edges[2].falling == 0x1);
+        assert(state == 0x8);
+
+        // the state carries over, and the first frame is an edge if it differs
+        n = find_ttl_edges(&buf[0], period, fsize, &state, edges, 8);
+        assert(n == 4);
+        assert(edges[0].frame == 0 && edges[0].falling == 0x8);
+        assert(edges[1].frame == 10);
+        state = 0x1;
+        n = find_ttl_edges(&buf[0], period, fsize, &state, edges, 1);
+        assert(n == 1 && edges[0].frame == 0 && edges[0].falling == 0x1);
+        assert(state == 0x8);
+        cout << "ttl edges: ok" << endl;
+}
+
+void
+test_demodulate()
+{
+        const size_t period = 30;
+        const size_t ncycles = 20;
+        const size_t nframes = period * ncycles;
+        const size_t nstreams = 2;
+        const size_t fsize = frame_size(nstreams);
+        const size_t offset = 2 * (6 + 3 * nstreams + 1);
+        const double amplitude = 1000, phase = 0.6;
+        vector<char> buf(fsize * nframes);
+        synthesize_frames(&buf[0], nframes, nstreams, 0);
+        for (size_t t = 0; t < nframes; ++t) {
+                const double x = amplitude * cos(2 * M_PI * t / period + phase);
+                *reinterpret_cast<evalboard::data_type *>(&buf[t * fsize + offset]) =
+                        (evalboard::data_type)(32768 + floor(x + 0.5));
+        }
+        complex<double> v = demodulate_channel(&buf[offset], fsize, nframes, period, false);
+        assert(fabs(abs(v) - amplitude) < 1);
+        assert(fabs(arg(v) - phase) < 1e-3);
+
+        // the same samples in two's complement
+        for (size_t t = 0; t < nframes; ++t) {
+                *reinterpret_cast<evalboard::data_type *>(&buf[t * fsize + offset]) ^= 0x8000;
+        }
+        v = demodulate_channel(&buf[offset], fsize, nframes, period, true);
+        assert(fabs(abs(v) - amplitude) < 1);
+        assert(fabs(arg(v) - phase) < 1e-3);
+
+        // several channels in one pass, each with its own phase
+        vector<size_t> offsets;
+        for (size_t c = 0; c < 4; ++c) {
+                const size_t off = 2 * (6 + 3 * nstreams + 2 * c);
+                offsets.push_back(off);
+                for (size_t t = 0; t < nframes; ++t) {
+                        const double x = amplitude * cos(2 * M_PI * t / period + phase * c);
+                        *reinterpret_cast<int16_t *>(&buf[t * fsize + off]) = floor(x + 0.5);
+                }
+        }
+        vector<complex<double> > vs;
+        demodulate_channels(&buf[0], fsize, nframes, period, true, offsets, vs);
+        assert(vs.size() == offsets.size());
+        for (size_t c = 0; c < offsets.size(); ++c) {
+                assert(fabs(abs(vs[c]) - amplitude) < 1);
+                assert(fabs(arg(vs[c]) - phase * c) < 1e-3);
+                assert(vs[c] == demodulate_channel(&buf[offsets[c]], fsize, nframes, period, true));
+        }
+        cout << "demodulation: ok" << endl;
+}
+
+int
+main(int, char**)
+{
+        test_adc_table();
+        test_synthetic_frames();
+        test_check_frames();
+        test_twoscomp();
+        test_gather();
+        test_ttl_edges();
+        test_demodulate();
+}
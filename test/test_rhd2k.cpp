@@ -70,6 +70,45 @@ test_uppercutoff()
                      << ", got=" << amp->upper_cutoff() << endl;
         }
 }
+
+void
+test_fast_settle()
+{
+        std::vector<short> regset, commands;
+        amp->command_regset(regset, false);
+        amp->command_fast_settle(commands);
+        // swapped in for the register sequence, so it has to be as long
+        assert (commands.size() == regset.size());
+        for (size_t i = 1; i < commands.size(); ++i)
+                assert (commands[i] == commands[0]);
+        // a write of register 0 with fast settle set; the reply echoes it
+        assert ((unsigned short)commands[0] == (0x8000 | (amp->fast_settle_result() & 0xff)));
+        assert ((amp->fast_settle_result() & 0xff20) == 0xff20);
+
+        // the register sequence writes register 0 without the bit
+        const size_t reg0 = rhd2k::rhd2000::register_sequence_reg0;
+        assert ((unsigned short)regset[reg0] == (0x8000 | (regset[reg0] & 0xff)));
+        assert ((regset[reg0] & 0x7f00) == 0);
+        assert ((0xff00 | (regset[reg0] & 0xff)) != amp->fast_settle_result());
+
+        // an amp power byte can have the same value as the fast settle
+        // write, which is 0xfe with the default register 0
+        assert (amp->fast_settle_result() == 0xfffe);
+        amp->set_amp_power(0xffffffff);
+        assert (amp->fast_settle_aliases() == 0);
+        amp->set_amp_power(0xfffffffe);
+        const uint64_t aliases = amp->fast_settle_aliases();
+        assert (aliases != 0);
+        amp->command_regset(regset, false);
+        for (size_t i = 0; i < regset.size(); ++i) {
+                const bool alias = (regset[i] & 0xc000) == 0x8000 &&
+                        (0xff00 | (regset[i] & 0xff)) == amp->fast_settle_result();
+                assert (((aliases >> i) & 1) == alias);
+        }
+        assert (!((aliases >> reg0) & 1));
+        amp->set_amp_power(0xffffffff);
+}
+
 int
 main(int, char**)
 {
@@ -78,6 +117,7 @@ main(int, char**)
         test_dspcutoff();
         test_lowercutoff();
         test_uppercutoff();
+        test_fast_settle();
         std::cout << *amp << endl;
 
         std::vector<short> commands;
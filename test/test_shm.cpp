@@ -0,0 +1,94 @@
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include "rhd2000shm.hpp"
+#include "rhd2000frame.hpp"
+
+using namespace rhd2k;
+using namespace std;
+
+static const size_t nstreams = 2;
+static const size_t block = 64;
+static const size_t capacity = 4 * block;
+
+/* write a block of synthetic frames, as the daemon does */
+static void
+write_block(shm_writer & w)
+{
+        void * buf = w.reserve(block);
+        assert(buf);
+        synthesize_frames(buf, block, nstreams, w.next_timestamp());
+        w.commit(block);
+}
+
+void
+test_shm()
+{
+        ostringstream name;
+        name << "/rhd2k_test_" << getpid();
+        vector<evalboard::channel_info_t> table;
+        ulong powers[evalboard::nmiso];
+        for (size_t i = 0; i < evalboard::nmiso; ++i) powers[i] = 0xffffffff;
+        evalboard::make_adc_table(table, (1UL << nstreams) - 1, powers);
+        const size_t fsize = frame_size(nstreams);
+
+        shm_writer w(name.str().c_str(), fsize, 30000, capacity, table);
+        // blocks must not wrap
+        assert(w.reserve(capacity + 1) == 0);
+
+        write_block(w);
+        shm_reader r(name.str().c_str());
+        assert(r.header().nchannels == table.size());
+        assert(strcmp(r.header().channels[3].name, table[3].name.c_str()) == 0);
+        assert(r.running());
+
+        // the reader starts at the newest frame
+        size_t n;
+        r.peek(&n);
+        assert(n == 0 && r.cursor() == block);
+
+        // frames are where their timestamps say
+        write_block(w);
+        write_block(w);
+        char const * p = r.peek(&n);
+        assert(n == 2 * block);
+        assert(check_frames(p, n, fsize, block) == n);
+        assert(r.release(n));
+
+        // wrap around the end of the ring
+        write_block(w);
+        write_block(w);
+        p = r.peek(&n);
+        assert(n == block && r.cursor() % capacity == 3 * block);
+        assert(r.release(n));
+        p = r.peek(&n);
+        assert(n == block && check_frames(p, n, fsize, 4 * block) == n);
+        assert(r.release(n));
+
+        // a restart moves the base, and sequence numbers keep increasing
+        w.restart();
+        assert(w.next_timestamp() == 0);
+        write_block(w);
+        p = r.peek(&n);
+        assert(n == block && check_frames(p, n, fsize, 0) == n);
+        assert(r.header().base == r.cursor());
+        assert(r.release(n));
+
+        // the writer laps a slow reader while it's reading
+        write_block(w);
+        p = r.peek(&n);
+        for (size_t i = 0; i < capacity / block; ++i) write_block(w);
+        assert(!r.release(n));
+        assert(r.overruns() == 1 && r.cursor() == w.header().write_pos);
+
+        cout << "shared memory ring: ok" << endl;
+}
+
+int
+main(int argc, char ** argv)
+{
+        test_shm();
+        return 0;
+}
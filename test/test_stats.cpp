@@ -0,0 +1,78 @@
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include "rhd2k_stats.h"
+
+using namespace std;
+
+void
+test_buckets()
+{
+        // exact below the first octave
+        for (uint64_t v = 0; v < 16; ++v) {
+                assert(rhd2k_hist_bucket(v) == v);
+                assert(rhd2k_hist_bucket_floor(v) == v);
+        }
+        // buckets are monotonic, and each value is within 1/16 of its floor
+        size_t last = 0;
+        for (uint64_t v = 1; v < (1ULL << 36); v += 1 + v / 7) {
+                size_t idx = rhd2k_hist_bucket(v);
+                assert(idx >= last);
+                assert(idx < rhd2k_hist_buckets);
+                uint64_t lo = rhd2k_hist_bucket_floor(idx);
+                assert(lo <= v);
+                assert(v - lo <= lo / 16);
+                if (idx + 1 < rhd2k_hist_buckets)
+                        assert(rhd2k_hist_bucket_floor(idx + 1) > v);
+                last = idx;
+        }
+        // very large values go in the last bucket
+        assert(rhd2k_hist_bucket(~0ULL) == rhd2k_hist_buckets - 1);
+}
+
+void
+test_quantiles()
+{
+        rhd2k_histogram_t h;
+        memset(&h, 0, sizeof(h));
+        assert(rhd2k_hist_quantile(h, 0.5) == 0);
+
+        // 1000 values of 1 us, and 10 of 1 ms
+        for (int i = 0; i < 1000; ++i) rhd2k_hist_record(h, 1000);
+        for (int i = 0; i < 10; ++i) rhd2k_hist_record(h, 1000000);
+        assert(h.count == 1010);
+        assert(h.max_ns == 1000000);
+        assert(h.total_ns == 1000 * 1000 + 10 * 1000000);
+
+        uint64_t p50 = rhd2k_hist_quantile(h, 0.5);
+        assert(p50 <= 1000 && p50 > 1000 - 1000 / 16);
+        uint64_t p999 = rhd2k_hist_quantile(h, 0.999);
+        assert(p999 <= 1000000 && p999 > 1000000 - 1000000 / 16);
+        assert(rhd2k_hist_quantile(h, 1.0) == 1000000);
+}
+
+void
+test_timer()
+{
+        rhd2k_stats_t * stats = new rhd2k_stats_t;
+        memset(stats, 0, sizeof(rhd2k_stats_t));
+        uint64_t t0 = rhd2k_stats_now();
+        const uint64_t start = t0;
+        for (int i = 0; i < 100000; ++i) {
+                rhd2k_stats_lap(stats, RHD2K_STAGE_READ, &t0);
+        }
+        rhd2k_histogram_t const & h = stats->stages[RHD2K_STAGE_READ];
+        assert(h.count == 100000);
+        assert(t0 >= start);
+        cout << "clock read + record: " << double(t0 - start) / h.count << " ns"
+             << " (p99 = " << rhd2k_hist_quantile(h, 0.99) << " ns)" << endl;
+        delete stats;
+}
+
+int
+main(int, char**)
+{
+        test_buckets();
+        test_quantiles();
+        test_timer();
+}
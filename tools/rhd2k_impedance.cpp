@@ -0,0 +1,101 @@
+/*
+ *   Intan RHD2000 eval board impedance test
+ *
+ *   Measures the impedance of the electrodes on every connected amplifier
+ *   channel (see rhd2k::evalboard::measure_impedance) and prints a table.
+ *   The board can't be acquiring data at the same time, so stop the JACK
+ *   driver or acquisition daemon first.
+ *
+ *   usage: rhd2k_impedance [options]
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "rhd2000eval.hpp"
+#include "rhd2k_settings.h"
+
+using namespace rhd2k;
+using std::size_t;
+
+static void
+usage()
+{
+        fprintf(stderr,
+                "usage: rhd2k_impedance [options]\n\n"
+                "  -d serial    serial number of the Opal Kelly device (default first)\n"
+                "  -F path      firmware file (default rhythm_130302.bit in $RHD2K_LIBDIR)\n"
+                "  -r rate      sampling rate, in Hz (default 30000)\n"
+                "  -A..-D conf  configure an SPI port, as in the JACK driver\n"
+                "  -f freq      test frequency, in Hz (default 1000)\n");
+        exit(1);
+}
+
+int
+main(int argc, char ** argv)
+{
+        rhd2k_jack_settings_t settings;
+        memcpy(&settings, &default_settings, sizeof(settings));
+        char const * serial = 0;
+        char const * firmware = 0;
+        double frequency = 1000;
+        int c;
+
+        while ((c = getopt(argc, argv, "d:F:r:A:B:C:D:f:h")) != -1) {
+                switch (c) {
+                case 'd':
+                        serial = optarg;
+                        break;
+                case 'F':
+                        firmware = optarg;
+                        break;
+                case 'r':
+                        settings.sample_rate = atoi(optarg);
+                        break;
+                case 'A':
+                case 'B':
+                case 'C':
+                case 'D':
+                        parse_port_config(c, optarg, settings);
+                        break;
+                case 'f':
+                        frequency = atof(optarg);
+                        break;
+                default:
+                        usage();
+                }
+        }
+        if (!(frequency > 0)) usage();
+
+        try {
+                evalboard dev(settings.sample_rate, serial, firmware, getenv("RHD2K_LIBDIR"));
+                std::cerr << "scanning SPI ports" << std::endl;
+                rhd2k_configure_board(&dev, settings);
+                std::cerr << dev << std::endl;
+
+                std::vector<evalboard::impedance_t> z;
+                frequency = dev.measure_impedance(frequency, z);
+                printf("# test frequency: %.1f Hz\n", frequency);
+                printf("# channel  magnitude (kOhm)  phase (deg)\n");
+                std::vector<evalboard::channel_info_t> const & table = dev.adc_table();
+                for (size_t i = 0; i < table.size(); ++i) {
+                        if (table[i].stream == evalboard::EvalADC) continue;
+                        printf("%-9s %17.1f %12.1f\n", table[i].name.c_str(),
+                               z[i].magnitude * 1e-3, z[i].phase);
+                }
+        }
+        catch (std::runtime_error const & e) {
+                std::cerr << "fatal error: " << e.what() << std::endl;
+                return 1;
+        }
+        return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Copy channels from the acquisition daemon's shared memory ring to
+ *   stdout, as interleaved raw 16-bit samples. This is also an example of
+ *   how to read the ring.
+ *
+ *   usage: rhd2k_shmcat [-n name] [channel ...]
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "rhd2000shm.hpp"
+
+using namespace rhd2k;
+using std::size_t;
+
+static void
+usage()
+{
+        fprintf(stderr,
+                "usage: rhd2k_shmcat [-n name] [channel ...]\n\n"
+                "  -n name      shared memory segment (default /rhd2000)\n"
+                "  channel      channels to copy, e.g. A1_0 (default all)\n");
+        exit(1);
+}
+
+int
+main(int argc, char ** argv)
+{
+        char const * name = "/rhd2000";
+        int c;
+
+        while ((c = getopt(argc, argv, "n:h")) != -1) {
+                switch (c) {
+                case 'n':
+                        name = optarg;
+                        break;
+                default:
+                        usage();
+                }
+        }
+
+        try {
+                shm_reader reader(name);
+                shm_header const & h = reader.header();
+
+                std::vector<size_t> offsets;
+                for (size_t i = 0; i < h.nchannels; ++i) {
+                        bool wanted = (optind == argc);
+                        for (int a = optind; a < argc; ++a) {
+                                if (strcmp(argv[a], h.channels[i].name) == 0) wanted = true;
+                        }
+                        if (wanted) offsets.push_back(h.channels[i].byte_offset);
+                }
+                if (offsets.empty()) {
+                        fprintf(stderr, "no such channels\n");
+                        return 1;
+                }
+                fprintf(stderr, "%s: %u Hz, %zu of %u channels (amplifiers %s)\n", name,
+                        h.sampling_rate, offsets.size(), h.nchannels,
+                        h.twoscomp ? "signed" : "offset binary");
+
+                // poll a few times per ring
+                const useconds_t poll_usecs = 1e6 * h.capacity / h.sampling_rate / 8;
+                std::vector<uint16_t> out;
+                while (reader.running()) {
+                        size_t nframes;
+                        char const * frames = reader.peek(&nframes);
+                        if (nframes == 0) {
+                                usleep(poll_usecs);
+                                continue;
+                        }
+                        out.resize(nframes * offsets.size());
+                        for (size_t t = 0; t < nframes; ++t) {
+                                char const * frame = frames + t * h.frame_size;
+                                for (size_t i = 0; i < offsets.size(); ++i) {
+                                        out[t * offsets.size() + i] =
+                                                *reinterpret_cast<uint16_t const *>(frame + offsets[i]);
+                                }
+                        }
+                        if (!reader.release(nframes)) {
+                                fprintf(stderr, "overrun (%lu); skipping to newest frame\n",
+                                        reader.overruns());
+                                continue;
+                        }
+                        if (fwrite(&out[0], sizeof(uint16_t), out.size(), stdout) < out.size())
+                                break;
+                }
+        }
+        catch (std::runtime_error const & e) {
+                fprintf(stderr, "error: %s\n", e.what());
+                return 1;
+        }
+        return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ *   Intan RHD2000 eval board Backend for Jack
+ *
+ *   Print the timing statistics published by a running driver.
+ *
+ *   usage: rhd2k_stats [-n name] [-i seconds]
+ *
+ *   Copyright (C) 2013 C Daniel Meliza
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rhd2k_stats.h"
+
+static void
+usage()
+{
+        fprintf(stderr,
+                "usage: rhd2k_stats [-n name] [-i seconds]\n\n"
+                "  -n name      shared memory segment (default " RHD2K_STATS_DEFAULT_NAME ")\n"
+                "  -i seconds   print statistics at this interval\n");
+        exit(1);
+}
+
+static void
+print_stats(rhd2k_stats_t const & s)
+{
+        const double period_us = 1e6 * s.period_size / s.sample_rate;
+        printf("rate: %u Hz  period: %u frames (%.1f us)  fifo latency: %u  transfer: %u\n",
+               s.sample_rate, s.period_size, period_us, s.fifo_latency, s.transfer_size);
+        printf("cycles: %llu  delayed: %llu  xruns: %llu  fifo: %u (max %u)\n",
+               (unsigned long long)s.cycles, (unsigned long long)s.delayed_cycles,
+               (unsigned long long)s.xruns, s.fifo_frames, s.fifo_max);
+        printf("bad periods: header %llu  timestamp %llu  filler %llu\n",
+               (unsigned long long)s.frame_faults[1], (unsigned long long)s.frame_faults[2],
+               (unsigned long long)s.frame_faults[3]);
+        printf("%-10s %10s %9s %9s %9s %9s %9s %9s %7s\n", "stage (us)", "count", "mean",
+               "p50", "p90", "p99", "p99.9", "max", "%cycle");
+        for (size_t i = 0; i < RHD2K_NSTAGES; ++i) {
+                rhd2k_histogram_t const & h = s.stages[i];
+                if (h.count == 0) continue;
+                const double mean = 1e-3 * h.total_ns / h.count;
+                printf("%-10s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %7.2f\n",
+                       rhd2k_stage_names[i], (unsigned long long)h.count, mean,
+                       1e-3 * rhd2k_hist_quantile(h, 0.5),
+                       1e-3 * rhd2k_hist_quantile(h, 0.9),
+                       1e-3 * rhd2k_hist_quantile(h, 0.99),
+                       1e-3 * rhd2k_hist_quantile(h, 0.999),
+                       1e-3 * h.max_ns,
+                       100.0 * mean / period_us);
+        }
+}
+
+int
+main(int argc, char ** argv)
+{
+        char const * name = RHD2K_STATS_DEFAULT_NAME;
+        double interval = 0;
+        int c;
+
+        while ((c = getopt(argc, argv, "n:i:h")) != -1) {
+                switch (c) {
+                case 'n':
+                        name = optarg;
+                        break;
+                case 'i':
+                        interval = atof(optarg);
+                        break;
+                default:
+                        usage();
+                }
+        }
+
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) {
+                fprintf(stderr, "unable to open %s: %s (is the driver running?)\n",
+                        name, strerror(errno));
+                return 1;
+        }
+        void * p = mmap(0, sizeof(rhd2k_stats_t), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+                fprintf(stderr, "unable to map %s: %s\n", name, strerror(errno));
+                return 1;
+        }
+        rhd2k_stats_t const * shared = static_cast<rhd2k_stats_t const *>(p);
+        if (shared->magic != rhd2k_stats_magic || shared->version != rhd2k_stats_version) {
+                fprintf(stderr, "%s is not a statistics segment from this driver version\n", name);
+                return 1;
+        }
+
+        // copy so that a line isn't computed from two different states
+        rhd2k_stats_t * snapshot = static_cast<rhd2k_stats_t *>(malloc(sizeof(rhd2k_stats_t)));
+        do {
+                memcpy(snapshot, shared, sizeof(rhd2k_stats_t));
+                if (snapshot->magic != rhd2k_stats_magic) {
+                        fprintf(stderr, "driver has exited\n");
+                        break;
+                }
+                print_stats(*snapshot);
+                if (interval > 0) {
+                        printf("\n");
+                        fflush(stdout);
+                        usleep(interval * 1e6);
+                }
+        } while (interval > 0);
+
+        free(snapshot);
+        munmap(p, sizeof(rhd2k_stats_t));
+        return 0;
+}